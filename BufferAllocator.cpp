@@ -0,0 +1,120 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <climits>
+#include <cstdio>
+
+#include "BufferAllocator.h"
+#include "metrics.h"
+
+AVBufferRef* BufferAllocator::allocate(size_t size, const MemoryPolicy &policy) {
+    static std::atomic<uint64_t> &huge_mappings = Metrics::counter("buffer allocator: huge page mappings");
+    static std::atomic<uint64_t> &fallbacks = Metrics::counter("buffer allocator: huge page fallbacks");
+
+    // small buffers (audio) gain nothing from a mapping of their own
+    if ((policy.pages == MemoryPolicy::Pages::Normal && policy.numa_node < 0) || size < HUGE_PAGE_SIZE / 2) {
+        return av_buffer_alloc(size);
+    }
+
+    const size_t length = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    void *data = MAP_FAILED;
+    if (policy.pages == MemoryPolicy::Pages::Explicit) {
+        data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED) {
+            fallbacks.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    if (data == MAP_FAILED) {
+        data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        if (policy.pages != MemoryPolicy::Pages::Normal && madvise(data, length, MADV_HUGEPAGE) == 0) {
+            huge_mappings.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        huge_mappings.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // before the first touch, so the pages are faulted on the node whoever writes them first
+    if (policy.numa_node >= 0) {
+        // one bit per node, as many words as the node number needs
+        constexpr int WORD_BITS = sizeof(unsigned long) * CHAR_BIT;
+        std::vector<unsigned long> node_mask(policy.numa_node / WORD_BITS + 1, 0);
+        node_mask.back() = 1UL << (policy.numa_node % WORD_BITS);
+        // the kernel reads maxnode - 1 bits
+        const unsigned long max_node = node_mask.size() * WORD_BITS + 1;
+        if (syscall(SYS_mbind, data, length, MPOL_PREFERRED, node_mask.data(), max_node, 0) != 0) {
+            std::cerr << "buffer allocator: can't bind buffer to node " << policy.numa_node << std::endl;
+        }
+    }
+
+    AVBufferRef *buffer = av_buffer_create(static_cast<uint8_t*>(data), static_cast<int>(size), &BufferAllocator::release, reinterpret_cast<void*>(length), 0);
+    if (!buffer) {
+        munmap(data, length);
+    }
+    return buffer;
+}
+
+int BufferAllocator::currentNode() {
+    unsigned int cpu;
+    unsigned int node;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return -1;
+    }
+    return static_cast<int>(node);
+}
+
+bool BufferAllocator::bindToNode(int node) {
+    if (node < 0) {
+        return false;
+    }
+
+    // ranges as "0-7,16-23"
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (!std::getline(file, list)) {
+        return false;
+    }
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return false;
+    }
+    cpu_set_t node_cpus;
+    CPU_ZERO(&node_cpus);
+    std::stringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first;
+        int last;
+        const int fields = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (fields < 1) {
+            continue;
+        } else if (fields == 1) {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            // never leave the cpus the process was started on (taskset, cgroups)
+            if (CPU_ISSET(cpu, &allowed)) {
+                CPU_SET(cpu, &node_cpus);
+            }
+        }
+    }
+
+    if (CPU_COUNT(&node_cpus) == 0 || sched_setaffinity(0, sizeof(node_cpus), &node_cpus) != 0) {
+        std::cerr << "buffer allocator: can't bind threads to node " << node << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void BufferAllocator::release(void *opaque, uint8_t *data) {
+    munmap(data, reinterpret_cast<size_t>(opaque));
+}
@@ -0,0 +1,44 @@
+#ifndef REMOTE_DESKTOP_BUFFERALLOCATOR_H
+#define REMOTE_DESKTOP_BUFFERALLOCATOR_H
+
+extern "C" {
+#include <libavutil/buffer.h>
+};
+
+#include <cstddef>
+
+// where the memory of large frame buffers comes from
+struct MemoryPolicy {
+    enum class Pages {
+        // plain av_buffer_alloc
+        Normal,
+        // anonymous mapping with MADV_HUGEPAGE, the kernel backs it with huge pages when it can
+        Transparent,
+        // MAP_HUGETLB from the reserved pool (vm.nr_hugepages), falls back to transparent when empty
+        Explicit,
+    };
+
+    Pages pages = Pages::Normal;
+    // -1 lets the first touch decide, otherwise pages are bound (preferred) to this node
+    int numa_node = -1;
+};
+
+// av_buffer allocation following a MemoryPolicy, for FramePool
+class BufferAllocator {
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    static AVBufferRef* allocate(size_t size, const MemoryPolicy &policy);
+
+    // node of the cpu running the calling thread, -1 when unknown
+    static int currentNode();
+    // keep the calling thread, and the threads it creates from now on, on the cpus of the node
+    // so the buffers bound to it stay local, false when the node cpus are unknown or not allowed
+    static bool bindToNode(int node);
+
+private:
+    static void release(void *opaque, uint8_t *data);
+};
+
+
+#endif //REMOTE_DESKTOP_BUFFERALLOCATOR_H
@@ -0,0 +1,95 @@
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/time.h>
+};
+
+#include "CaptureScheduler.h"
+
+// margin added to the learned lead, absorbs small variations of the conversion time
+constexpr auto LEAD_MARGIN = std::chrono::microseconds(500);
+
+CaptureScheduler::CaptureScheduler(int framerate) : name("capture scheduler"), interval(std::chrono::nanoseconds(1'000'000'000 / framerate)),
+        next_ready(std::chrono::steady_clock::now()), last_capture(std::chrono::steady_clock::now()), capture_stamp(AV_NOPTS_VALUE),
+        lost_frames(Metrics::counter(name + ": frames lost in the pipeline")),
+        lead_time(Metrics::histogram(name + ": lead (us)")) {
+
+}
+
+bool CaptureScheduler::waitCaptureTime(std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(mutex);
+    // one frame at a time in the pipeline, but a frame lost on the way must not stall capture
+    while (in_flight) {
+        const auto lost_time = last_capture + 2 * interval;
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= lost_time) {
+            lost_frames.fetch_add(1, std::memory_order_relaxed);
+            // its slot is gone, a deadline left behind would capture at once
+            while (next_ready - lead - LEAD_MARGIN < now) {
+                next_ready += interval;
+            }
+            break;
+        } else if (now >= deadline) {
+            return false;
+        }
+        cv.wait_until(lock, std::min(lost_time, deadline));
+    }
+
+    const auto capture_time = next_ready - lead - LEAD_MARGIN;
+    lock.unlock();
+    std::this_thread::sleep_until(capture_time);
+    lock.lock();
+
+    in_flight = true;
+    last_capture = std::chrono::steady_clock::now();
+    capture_stamp = av_gettime();
+    return true;
+}
+
+void CaptureScheduler::notifyConsumed(int64_t capture_time) {
+    const auto now = std::chrono::steady_clock::now();
+    mutex.lock();
+    if (!inFlight(capture_time)) {
+        // declared lost already, the capture went on without it
+        mutex.unlock();
+        return;
+    }
+    if (capture_time != AV_NOPTS_VALUE) {
+        // exponential moving average with 1/8 weight
+        const std::chrono::nanoseconds pipeline_duration = std::chrono::microseconds(av_gettime() - capture_time);
+        lead += (pipeline_duration - lead) / 8;
+        lead_time.record(std::chrono::duration_cast<std::chrono::microseconds>(lead).count());
+    }
+    release(now);
+    mutex.unlock();
+    cv.notify_all();
+}
+
+void CaptureScheduler::notifyDropped(int64_t capture_time) {
+    const auto now = std::chrono::steady_clock::now();
+    mutex.lock();
+    if (!inFlight(capture_time)) {
+        mutex.unlock();
+        return;
+    }
+    // says nothing of the pipeline duration, the lead is kept
+    release(now);
+    mutex.unlock();
+    cv.notify_all();
+}
+
+bool CaptureScheduler::inFlight(int64_t capture_time) const {
+    // frames without capture time can not be told apart, taken as the one in flight
+    return in_flight && (capture_time == AV_NOPTS_VALUE || capture_stamp == AV_NOPTS_VALUE || capture_time >= capture_stamp);
+}
+
+void CaptureScheduler::release(std::chrono::steady_clock::time_point now) {
+    // keep the framerate cadence, unless the encoder was late
+    next_ready = std::max(next_ready + interval, now + interval / 2);
+    in_flight = false;
+}
+
+std::chrono::nanoseconds CaptureScheduler::getLead() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return lead;
+}
@@ -0,0 +1,56 @@
+#ifndef REMOTE_DESKTOP_CAPTURESCHEDULER_H
+#define REMOTE_DESKTOP_CAPTURESCHEDULER_H
+
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "metrics.h"
+
+// pull mode: the grabber captures a frame only when the encoder will soon be ready to take it,
+// ahead of time by the learned duration of the stages in between (capture, conversion)
+class CaptureScheduler {
+private:
+    std::string name;
+
+    std::chrono::nanoseconds interval;
+    std::chrono::nanoseconds lead = std::chrono::nanoseconds(0);
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool in_flight = false;
+    std::chrono::steady_clock::time_point next_ready;
+    std::chrono::steady_clock::time_point last_capture;
+    // av_gettime (us) when the frame in flight was let through, the answers for older frames come too late
+    int64_t capture_stamp;
+
+    // frames never submitted by the encoder, capture went on without them
+    std::atomic<uint64_t> &lost_frames;
+    Histogram &lead_time;
+
+public:
+    explicit CaptureScheduler(int framerate);
+    ~CaptureScheduler() = default;
+
+    // grabber side, wait until it is time to capture, return false on timeout
+    bool waitCaptureTime(std::chrono::milliseconds timeout);
+
+    // encoder side, the frame captured at capture_time (us, av_gettime clock) has just been submitted
+    void notifyConsumed(int64_t capture_time);
+    // a stage dropped the frame captured at capture_time, the next capture keeps the cadence
+    void notifyDropped(int64_t capture_time);
+
+    std::chrono::nanoseconds getLead();
+
+private:
+    // lock held, whether the frame captured at capture_time is the one in flight
+    bool inFlight(int64_t capture_time) const;
+    // lock held, the frame in flight left the pipeline, the next one is due one interval later
+    void release(std::chrono::steady_clock::time_point now);
+};
+
+
+#endif //REMOTE_DESKTOP_CAPTURESCHEDULER_H
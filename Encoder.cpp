@@ -1,25 +1,103 @@
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <iostream>
 #include <thread>
 #include <chrono>
 #include <csignal>
+#include <cstring>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/time.h>
+#include <libavutil/intreadwrite.h>
+};
 
 #include "Encoder.h"
 #include "exception.h"
+#include "timing.h"
 
-Encoder::Encoder(std::string name) : name(std::move(name)) {
-
+Encoder::Encoder(std::string name) : name(std::move(name)),
+        capture_to_submit(Metrics::histogram(this->name + ": capture to submit (us)")),
+        capture_to_packet(Metrics::histogram(this->name + ": capture to packet (us)")),
+        encode_time(Metrics::histogram(this->name + ": encode time (us)")),
+        frame_qp(Metrics::histogram(this->name + ": frame qp")),
+        reconfigure_stall(Metrics::histogram(this->name + ": reconfigure stall (us)")),
+        packet_size(Metrics::histogram(this->name + ": packet size (bytes)")),
+        key_frames(Metrics::counter(this->name + ": key frames")),
+        drain_wakeups(Metrics::counter(this->name + ": drain wakeups")),
+        rate_monitor(this->name),
+        payload_allocations(Metrics::counter(this->name + ": payload pool allocations")) {
+    frame_times.fill({AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE});
+    drain_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (drain_event < 0) {
+        throw InitFail("fail to create drain event");
+    }
 }
 
 Encoder::~Encoder() {
     std::cout << name << ": next lines are triggered by ~Encoder() call" << std::endl;
     stop();
     avcodec_free_context(&codec_ctx);
+    av_buffer_pool_uninit(&payload_pool);
+    av_packet_free(&inline_packet);
+    close(drain_event);
 }
 
 AVCodecContext* Encoder::getContext() const {
     return codec_ctx;
 }
 
+std::string Encoder::getParam(const std::string &key) const {
+    auto it = params.find(key);
+    return it == params.end() ? std::string() : it->second;
+}
+
+std::shared_lock<std::shared_mutex> Encoder::readContext() const {
+    return std::shared_lock<std::shared_mutex>(context_mutex);
+}
+
+void Encoder::setScheduler(CaptureScheduler *scheduler) {
+    this->scheduler = scheduler;
+}
+
+void Encoder::usePayloadPool() {
+    // ignored by the codecs without AV_CODEC_CAP_DR1, which allocate their packets themselves
+    codec_ctx->opaque = this;
+    codec_ctx->get_encode_buffer = &Encoder::getEncodeBuffer;
+}
+
+int Encoder::getEncodeBuffer(AVCodecContext *ctx, AVPacket *packet, int /*flags*/) {
+    auto *encoder = static_cast<Encoder*>(ctx->opaque);
+    // called with the encoder lock held, by one thread at a time
+    const int needed = packet->size + AV_INPUT_BUFFER_PADDING_SIZE;
+    if (!encoder->payload_pool || needed > encoder->payload_size) {
+        // buffers still referenced are freed when released
+        av_buffer_pool_uninit(&encoder->payload_pool);
+        encoder->payload_size = FFALIGN(std::max(needed, encoder->payload_size * 2), 4096);
+        encoder->payload_pool = av_buffer_pool_init2(encoder->payload_size, encoder, &Encoder::allocatePayload, nullptr);
+        if (!encoder->payload_pool) {
+            encoder->payload_size = 0;
+            return AVERROR(ENOMEM);
+        }
+    }
+
+    packet->buf = av_buffer_pool_get(encoder->payload_pool);
+    if (!packet->buf) {
+        return AVERROR(ENOMEM);
+    }
+    packet->data = packet->buf->data;
+    std::memset(packet->data + packet->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    return 0;
+}
+
+AVBufferRef* Encoder::allocatePayload(void *opaque, int size) {
+    // only reached when the pool has no free buffer, stays flat in steady state
+    auto *encoder = static_cast<Encoder*>(opaque);
+    encoder->payload_allocations.fetch_add(1, std::memory_order_relaxed);
+    return av_buffer_alloc(size);
+}
+
 void Encoder::start() {
     startFeed();
     startDrain();
@@ -54,7 +132,9 @@ void Encoder::stopFeed() {
 }
 
 void Encoder::startDrain() {
-    if (initialized && drain_stop_condition.load(std::memory_order_relaxed)) {
+    if (inline_drain.load(std::memory_order_relaxed)) {
+        std::cout << name << ": packets are drained inline, no drain thread" << std::endl;
+    } else if (initialized && drain_stop_condition.load(std::memory_order_relaxed)) {
         drain_stop_condition.store(false, std::memory_order_relaxed);
         drain_thread = std::thread(&Encoder::runDrain, this);
     } else {
@@ -75,32 +155,36 @@ void Encoder::stopDrain() {
     }
 }
 
+void Encoder::setInlineDrain(bool enabled) {
+    if (!drain_stop_condition.load(std::memory_order_relaxed)) {
+        std::cout << name << ": drain thread running, stop it before changing the drain mode" << std::endl;
+        return;
+    }
+    inline_drain.store(enabled, std::memory_order_relaxed);
+}
+
 void Encoder::runDrain() {
     std::cerr << name << " drain thread pid is " << gettid() << std::endl;
-    std::mutex m;
     AVPacket *packet = av_packet_alloc();
     int ret = 0;
     try {
         while (!drain_stop_condition.load(std::memory_order_relaxed)) {
+            std::unique_lock<std::mutex> mlock(drain_mutex);
             encoder_lock.lock();
             ret = avcodec_receive_packet(codec_ctx, packet);
             encoder_lock.unlock();
             if (ret == AVERROR(EAGAIN)) {
-                std::unique_lock<std::mutex> mlock(m);
-                encoder_cv.wait(mlock, [this, &ret, &packet] {
-                    encoder_lock.lock();
-                    ret = avcodec_receive_packet(codec_ctx, packet);
-                    encoder_lock.unlock();
-                    return ret != AVERROR(EAGAIN);
-                });
-            }
-
-            if (ret < 0) {
+                // no codec call while waiting, the next frame sent is the only reason to try again
+                mlock.unlock();
+                if (waitDrainEvent(std::chrono::milliseconds(100))) {
+                    drain_wakeups.fetch_add(1, std::memory_order_relaxed);
+                }
+                continue;
+            } else if (ret < 0) {
                 throw RunError("error when receiving packet from encoder");
-            } else {
-                forward(packet);
-                av_packet_unref(packet);
             }
+
+            handlePacket(packet);
         }
     } catch (const std::exception &e) {
         std::cout << e.what() << std::endl;
@@ -109,6 +193,132 @@ void Encoder::runDrain() {
     av_packet_free(&packet);
 }
 
+void Encoder::notifyDrain() {
+    if (inline_drain.load(std::memory_order_relaxed)) {
+        drainInline();
+        return;
+    }
+
+    // the counter keeps the event until it is read, a frame sent before the drain thread waits is not missed,
+    // nor one sent while it is stopped: its packets are received once it starts again, or by flush
+    const uint64_t one = 1;
+    if (::write(drain_event, &one, sizeof(one)) != sizeof(one)) {
+        std::cout << name << ": fail to signal drain thread" << std::endl;
+    }
+}
+
+bool Encoder::waitDrainEvent(std::chrono::milliseconds timeout) {
+    pollfd fd = {drain_event, POLLIN, 0};
+    if (poll(&fd, 1, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+    }
+
+    // several frames sent in a row make a single wake-up
+    uint64_t count;
+    return ::read(drain_event, &count, sizeof(count)) == sizeof(count);
+}
+
+void Encoder::drainInline() {
+    if (!inline_packet) {
+        inline_packet = av_packet_alloc();
+        if (!inline_packet) {
+            throw RunError("could not allocate packet");
+        }
+    }
+
+    while (true) {
+        encoder_lock.lock();
+        const int ret = avcodec_receive_packet(codec_ctx, inline_packet);
+        encoder_lock.unlock();
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return;
+        } else if (ret < 0) {
+            throw RunError("error when receiving packet from encoder");
+        }
+
+        handlePacket(inline_packet);
+    }
+}
+
+void Encoder::handlePacket(AVPacket *packet) {
+    if (last_packet_time == AV_NOPTS_VALUE) {
+        std::cerr << name << ": first packet ready " << millisecondsSinceStart() << "ms after process start" << std::endl;
+    }
+
+    const int64_t now = av_gettime();
+    const FrameTimes times = findFrameTimes(packet->pts);
+    if (times.capture_time != AV_NOPTS_VALUE) {
+        capture_to_packet.record(now - times.capture_time);
+    }
+    if (times.submit_time != AV_NOPTS_VALUE) {
+        encode_time.record(now - times.submit_time);
+    }
+
+    // reserved is left out, zeroed
+    FrameStats stats = {packet->pts, times.capture_time, times.submit_time, now, packet->size, -1,
+                        times.codec_time == AV_NOPTS_VALUE ? -1 : static_cast<int32_t>(times.codec_time),
+                        times.codec_cpu_time == AV_NOPTS_VALUE ? -1 : static_cast<int32_t>(times.codec_cpu_time),
+                        AV_PICTURE_TYPE_NONE, static_cast<uint8_t>((packet->flags & AV_PKT_FLAG_KEY) != 0)};
+    // quality as a lambda (qp * FF_QP2LAMBDA) on 32 bits little endian, then the picture type
+    int stats_size = 0;
+    const uint8_t *quality_stats = av_packet_get_side_data(packet, AV_PKT_DATA_QUALITY_STATS, &stats_size);
+    if (quality_stats && stats_size >= 5) {
+        stats.qp = static_cast<int32_t>(AV_RL32(quality_stats)) / FF_QP2LAMBDA;
+        stats.pict_type = quality_stats[4];
+        frame_qp.record(stats.qp);
+    }
+
+    // first packet of a reopened codec, the gap since the last one is what the client sees
+    if (reconfigured.exchange(false) && last_packet_time != AV_NOPTS_VALUE) {
+        reconfigure_stall.record(now - last_packet_time);
+        std::cerr << name << ": stream resumed after " << (now - last_packet_time) / 1000 << "ms" << std::endl;
+    }
+    last_packet_time = now;
+    rate_monitor.record(now, packet->size);
+    packet_size.record(packet->size);
+    if (packet->flags & AV_PKT_FLAG_KEY) {
+        key_frames.fetch_add(1, std::memory_order_relaxed);
+        last_key_pts = packet->pts;
+    }
+
+    Source<const FrameStats>::forward(&stats);
+    Source<AVPacket>::forward(packet);
+    av_packet_unref(packet);
+}
+
+void Encoder::recordFrameTimes(int64_t pts, int64_t capture_time) {
+    const int64_t submit_time = av_gettime();
+    frame_times_lock.lock();
+    frame_times[frame_times_index++ % frame_times.size()] = {pts, capture_time, submit_time, AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+    frame_times_lock.unlock();
+}
+
+void Encoder::recordCodecTime(int64_t pts, int64_t start, int64_t cpu_start) {
+    const int64_t codec_time = av_gettime() - start;
+    const int64_t codec_cpu_time = threadCpuMicroseconds() - cpu_start;
+    frame_times_lock.lock();
+    // the entry just recorded, unless a frame was dropped since
+    FrameTimes &times = frame_times[(frame_times_index - 1) % frame_times.size()];
+    if (times.pts == pts) {
+        times.codec_time = codec_time;
+        times.codec_cpu_time = codec_cpu_time;
+    }
+    frame_times_lock.unlock();
+}
+
+Encoder::FrameTimes Encoder::findFrameTimes(int64_t pts) {
+    FrameTimes times = {pts, AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE, AV_NOPTS_VALUE};
+    frame_times_lock.lock();
+    for (const auto& entry : frame_times) {
+        if (entry.pts == pts) {
+            times = entry;
+            break;
+        }
+    }
+    frame_times_lock.unlock();
+    return times;
+}
+
 void Encoder::flush() {
     if (!feed_stop_condition || !drain_stop_condition) {
         std::cout << name << ": flush order ignored, stop runFeed/runDrain threads first" << std::endl;
@@ -129,7 +339,7 @@ void Encoder::flush() {
                 throw RunError("error while flushing encoder");
             }
 
-            forward(packet);
+            Source<AVPacket>::forward(packet);
             av_packet_unref(packet);
         }
     } catch (const std::exception &e) {
@@ -139,3 +349,55 @@ void Encoder::flush() {
     av_packet_free(&packet);
     initialized = false;
 }
+
+bool Encoder::reconfigure(const std::unordered_map<std::string, std::string> &changes) {
+    const int64_t start = av_gettime();
+    // init replaces params, kept to fall back to
+    const std::unordered_map<std::string, std::string> previous_params = params;
+    std::unordered_map<std::string, std::string> new_params = params;
+    bool applied = true;
+    for (const auto& [key, val] : changes) {
+        new_params[key] = val;
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    {
+        // drain thread is either waiting for a packet or done with the last one, so packets stay ordered
+        std::lock_guard<std::mutex> drain_guard(drain_mutex);
+        encoder_lock.lock();
+        int ret = avcodec_send_frame(codec_ctx, nullptr);
+        while (ret >= 0) {
+            ret = avcodec_receive_packet(codec_ctx, packet);
+            if (ret >= 0) {
+                // the tail of the old stream, counted and logged as any other packet
+                handlePacket(packet);
+            }
+        }
+
+        try {
+            // a new context starts with SPS/PPS and a key frame
+            std::unique_lock<std::shared_mutex> context_guard(context_mutex);
+            try {
+                init(new_params);
+            } catch (const std::exception &e) {
+                // the old codec is flushed and freed already, the stream goes on with the previous parameters
+                std::cout << name << ": " << e.what() << ", change refused, back to the previous parameters" << std::endl;
+                applied = false;
+                init(previous_params);
+            }
+        } catch (...) {
+            encoder_lock.unlock();
+            av_packet_free(&packet);
+            throw;
+        }
+        reconfigured = true;
+        encoder_lock.unlock();
+
+        // still holding the drain: the first packets of the new stream must not reach the RTP muxers
+        // of the old one, the client would wait for the next key frame
+        std::cerr << name << ": reconfigured in " << (av_gettime() - start) / 1000 << "ms" << std::endl;
+        Source<const AVCodecContext>::forward(codec_ctx);
+    }
+    av_packet_free(&packet);
+    return applied;
+}
@@ -13,17 +13,58 @@ extern "C" {
 #include <thread>
 #include <atomic>
 #include <mutex>
-#include <condition_variable>
+#include <shared_mutex>
+#include <array>
+#include <chrono>
 
 #include "Sink.h"
 #include "Source.h"
+#include "CaptureScheduler.h"
+#include "metrics.h"
+#include "RateMonitor.h"
 
-class Encoder : public Sink<AVFrame>, public Source<AVPacket> {
+// parameters to change on a running encoder, same keys as its init options
+using EncoderChanges = std::unordered_map<std::string, std::string>;
+
+// frame a client could not decode, pts in the encoder time base
+struct FrameLoss {
+    int64_t pts;
+};
+
+// one per packet out of the encoder, times in us on the av_gettime clock, AV_NOPTS_VALUE when unknown
+// also the 56 bytes record of FrameStatsLog, fields in this order, host byte order, no implicit padding
+struct FrameStats {
+    int64_t pts;
+    int64_t capture_time;
+    int64_t submit_time;
+    int64_t packet_time;
+    int32_t size;
+    // quantizer and picture type reported by the codec in the packet quality stats, -1 and 0 without them
+    int32_t qp;
+    // wall and thread cpu time (us) of the feeding thread in avcodec_send_frame, -1 when not measured:
+    // what a frame costs the feeding thread, without the delay of the frames queued in the codec pipeline;
+    // the cpu of the codec's own threads is not in codec_cpu_time, the call only waits for them
+    int32_t codec_time;
+    int32_t codec_cpu_time;
+    uint8_t pict_type;
+    uint8_t key;
+    // zero, written to the log as is
+    uint8_t reserved[6];
+};
+static_assert(sizeof(FrameStats) == 56, "FrameStats is a log record, its layout must not change");
+
+// also a source of codec context, forwarded each time the encoder is reopened with new parameters,
+// and of frame stats, for each packet before it is forwarded
+class Encoder : public Sink<AVFrame>, public Source<AVPacket>, public Source<const AVCodecContext>, public Source<const FrameStats> {
 protected:
     std::string name;
     bool initialized = false;
 
+    // parameters given to init, reused by reconfigure
+    std::unordered_map<std::string, std::string> params;
     AVCodecContext *codec_ctx = nullptr;
+    // held exclusively by reconfigure while the context is replaced
+    mutable std::shared_mutex context_mutex;
     int64_t frame_id = 0;
 
     std::atomic<bool> feed_stop_condition = true;
@@ -31,17 +72,85 @@ protected:
     std::atomic<bool> drain_stop_condition = true;
     std::thread drain_thread;
     spinlock encoder_lock;
-    std::condition_variable encoder_cv;
+    // eventfd written by the feeding side after each frame sent, one wake-up of the drain thread per frame
+    int drain_event = -1;
+    // held by the drain thread from receiving a packet to forwarding it
+    std::mutex drain_mutex;
+    // packets received by the feeding thread itself instead of a drain thread, see setInlineDrain
+    std::atomic<bool> inline_drain = false;
+    AVPacket *inline_packet = nullptr;
+    std::atomic<uint64_t> &drain_wakeups;
+
+    CaptureScheduler *scheduler = nullptr;
+    // capture and submit times (us, av_gettime clock) of the frames inside the encoder, by pts, and their codec call
+    struct FrameTimes {
+        int64_t pts;
+        int64_t capture_time;
+        int64_t submit_time;
+        int64_t codec_time;
+        int64_t codec_cpu_time;
+    };
+    std::array<FrameTimes, 32> frame_times;
+    size_t frame_times_index = 0;
+    spinlock frame_times_lock;
+    Histogram &capture_to_submit;
+    Histogram &capture_to_packet;
+    // from avcodec_send_frame to its packet, the time spent in the codec
+    Histogram &encode_time;
+    Histogram &frame_qp;
+
+    std::atomic<int64_t> last_packet_time = AV_NOPTS_VALUE;
+    std::atomic<bool> reconfigured = false;
+    Histogram &reconfigure_stall;
+    // size of each packet, its tail shows the bursts sent at key frames
+    Histogram &packet_size;
+    std::atomic<uint64_t> &key_frames;
+    // last frame a client can start decoding from, key frame or start of an intra refresh
+    std::atomic<int64_t> last_key_pts = AV_NOPTS_VALUE;
+    // output bitrate, and how it follows the bitrate changes
+    RateMonitor rate_monitor;
+
+    // payloads of the packets returned by codecs supporting get_encode_buffer, sized on the largest packet
+    AVBufferPool *payload_pool = nullptr;
+    int payload_size = 0;
+    std::atomic<uint64_t> &payload_allocations;
 
     explicit Encoder(std::string name);
     ~Encoder() override;
 
     virtual void runFeed() = 0;
     void runDrain();
+    // to call after each avcodec_send_frame: wakes the drain thread up, or receives the packets right away in inline mode
+    void notifyDrain();
+    bool waitDrainEvent(std::chrono::milliseconds timeout);
+    void drainInline();
+    // metrics and forwarding of a packet received from the codec, unref it
+    void handlePacket(AVPacket *packet);
+
+    // to call right before avcodec_send_frame
+    void recordFrameTimes(int64_t pts, int64_t capture_time);
+    // to call right after avcodec_send_frame, encoder lock still held so the packet is not received before,
+    // with the av_gettime and threadCpuMicroseconds values taken before the call
+    void recordCodecTime(int64_t pts, int64_t start, int64_t cpu_start);
+    FrameTimes findFrameTimes(int64_t pts);
+
+    // take the packet payloads from payload_pool, to call before avcodec_open2
+    void usePayloadPool();
+    // AVCodecContext.get_encode_buffer callback, opaque must point to the encoder
+    static int getEncodeBuffer(AVCodecContext *ctx, AVPacket *packet, int flags);
+    // payload_pool allocator, counts the allocations
+    static AVBufferRef* allocatePayload(void *opaque, int size);
 
 public:
     virtual void init(const std::unordered_map<std::string, std::string> &params) = 0;
     AVCodecContext* getContext() const;
+    // current value of an init parameter, changes included, empty when not set; to call from the feeding thread
+    // or a sink of the packets or frame stats, the parameters are replaced by reconfigure otherwise
+    std::string getParam(const std::string &key) const;
+    // to hold while using the context from another thread than the feeding one, reconfigure may free it otherwise
+    std::shared_lock<std::shared_mutex> readContext() const;
+    // tell the scheduler each time a frame is submitted, for pull mode capture
+    void setScheduler(CaptureScheduler *scheduler);
 
     void start();
     void stop();
@@ -49,10 +158,17 @@ public:
     void stopFeed();
     void startDrain();
     void stopDrain();
+    // inline mode: no drain thread, packets are received by the thread feeding the codec right after each frame,
+    // lowest latency for low delay encoders which give the packet of a frame as soon as it is sent
+    // to choose before feeding, without drain thread running; otherwise packets wait in the codec for one
+    void setInlineDrain(bool enabled);
 
     void handle(AVFrame *frame) override = 0;
 
     void flush();
+    // drain the current stream and reopen the codec with the changed parameters, must be called by the feeding thread;
+    // a change the codec refuses is logged and the codec reopened with the previous parameters, false then
+    bool reconfigure(const std::unordered_map<std::string, std::string> &changes);
 };
 
 
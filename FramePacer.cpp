@@ -0,0 +1,42 @@
+#include <ctime>
+#include <cerrno>
+
+#include "FramePacer.h"
+
+FramePacer::FramePacer(const std::string &name, int framerate, LatePolicy late_policy) : name(name),
+        interval(1'000'000'000 / framerate), late_policy(late_policy),
+        lateness(Metrics::histogram(name + ": capture lateness (us)")),
+        skipped(Metrics::counter(name + ": skipped capture slots")) {
+
+}
+
+void FramePacer::wait() {
+    if (origin < 0) {
+        origin = now();
+        frame_index = 0;
+    }
+
+    const int64_t deadline = origin + frame_index * interval;
+    const timespec ts = {static_cast<time_t>(deadline / 1'000'000'000), static_cast<long>(deadline % 1'000'000'000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR);
+
+    const int64_t wakeup = now();
+    const int64_t late = wakeup - deadline;
+    lateness.record(late / 1000);
+    ++frame_index;
+    if (late_policy == LatePolicy::Skip && late >= interval) {
+        const int64_t missed = late / interval;
+        frame_index += missed;
+        skipped.fetch_add(missed, std::memory_order_relaxed);
+    }
+}
+
+void FramePacer::reset() {
+    origin = -1;
+}
+
+int64_t FramePacer::now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+}
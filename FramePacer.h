@@ -0,0 +1,44 @@
+#ifndef REMOTE_DESKTOP_FRAMEPACER_H
+#define REMOTE_DESKTOP_FRAMEPACER_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include "metrics.h"
+
+// wakes up on a fixed grid of absolute CLOCK_MONOTONIC deadlines, so sleep errors never accumulate
+class FramePacer {
+public:
+    enum class LatePolicy {
+        // capture the late frame right away and keep the grid, next ones come closer together
+        CatchUp,
+        // give up the slots already missed and wait for the next one of the grid
+        Skip,
+    };
+
+private:
+    std::string name;
+    int64_t interval;
+    LatePolicy late_policy;
+
+    int64_t origin = -1;
+    int64_t frame_index = 0;
+
+    Histogram &lateness;
+    std::atomic<uint64_t> &skipped;
+
+public:
+    FramePacer(const std::string &name, int framerate, LatePolicy late_policy=LatePolicy::Skip);
+    ~FramePacer() = default;
+
+    // sleep until the next deadline
+    void wait();
+    // next wait() starts a new grid
+    void reset();
+
+    static int64_t now();
+};
+
+
+#endif //REMOTE_DESKTOP_FRAMEPACER_H
@@ -0,0 +1,159 @@
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#include <libavutil/channel_layout.h>
+};
+
+#include <mutex>
+#include <algorithm>
+#include <climits>
+
+#include "FramePool.h"
+
+// plane alignment, enough for AVX-512 loads
+constexpr int ALIGN = 64;
+
+FramePool::FramePool(const std::string &name) : name(name),
+        allocations(Metrics::counter(name + ": pool allocations")) {
+
+}
+
+FramePool::~FramePool() {
+    // buffers still referenced are freed when released
+    av_buffer_pool_uninit(&pool);
+}
+
+void FramePool::setMemoryPolicy(const MemoryPolicy &policy) {
+    std::lock_guard<spinlock> guard(lock);
+    memory_policy = policy;
+    format = -1;
+}
+
+int FramePool::get(AVFrame *frame) {
+    return get(frame, frame->width, frame->height);
+}
+
+int FramePool::getBuffer2(AVCodecContext *ctx, AVFrame *frame, int /*flags*/) {
+    auto *frame_pool = static_cast<FramePool*>(ctx->opaque);
+    if (ctx->codec_type != AVMEDIA_TYPE_VIDEO) {
+        return frame_pool->get(frame);
+    }
+
+    // decoders may write up to the aligned dimensions
+    int width = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(ctx, &width, &height, linesize_align);
+    return frame_pool->get(frame, width, height);
+}
+
+int FramePool::get(AVFrame *frame, int padded_width, int padded_height) {
+    const bool video = frame->width > 0 && frame->height > 0;
+    const int frame_channels = frame->channels ? frame->channels : av_get_channel_layout_nb_channels(frame->channel_layout);
+    if (frame->format < 0 || (!video && (frame->nb_samples <= 0 || frame_channels <= 0))) {
+        return AVERROR(EINVAL);
+    }
+
+    std::lock_guard<spinlock> guard(lock);
+    const bool same_key = format == frame->format && (video ?
+            nb_samples == 0 && width == padded_width && height == padded_height :
+            nb_samples == frame->nb_samples && channels == frame_channels);
+    if (!pool || !same_key) {
+        av_buffer_pool_uninit(&pool);
+        format = frame->format;
+        width = video ? padded_width : 0;
+        height = video ? padded_height : 0;
+        nb_samples = video ? 0 : frame->nb_samples;
+        channels = video ? 0 : frame_channels;
+
+        const int size = video ? setupVideo(padded_width, padded_height) : setupAudio();
+        if (size >= 0) {
+            pool = av_buffer_pool_init2(size + ALIGN, this, &FramePool::allocate, nullptr);
+        }
+        if (!pool) {
+            format = -1;
+            return size < 0 ? size : AVERROR(ENOMEM);
+        }
+    }
+
+    frame->buf[0] = av_buffer_pool_get(pool);
+    if (!frame->buf[0]) {
+        return AVERROR(ENOMEM);
+    }
+
+    uint8_t *base = reinterpret_cast<uint8_t*>(FFALIGN(reinterpret_cast<uintptr_t>(frame->buf[0]->data), ALIGN));
+    for (int i = 0; i < planes; ++i) {
+        frame->data[i] = base + offsets[i];
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
+
+int FramePool::setupVideo(int padded_width, int padded_height) {
+    const auto pix_fmt = static_cast<AVPixelFormat>(format);
+    if (!av_pix_fmt_desc_get(pix_fmt)) {
+        return AVERROR(EINVAL);
+    }
+
+    int ret = av_image_fill_linesizes(linesize, pix_fmt, FFALIGN(padded_width, ALIGN));
+    if (ret < 0) {
+        return ret;
+    }
+
+    ptrdiff_t linesizes[4];
+    for (int i = 0; i < 4; ++i) {
+        linesize[i] = FFALIGN(linesize[i], ALIGN);
+        linesizes[i] = linesize[i];
+    }
+
+    size_t sizes[4];
+    ret = av_image_fill_plane_sizes(sizes, pix_fmt, padded_height, linesizes);
+    if (ret < 0) {
+        return ret;
+    }
+
+    size_t total = 0;
+    planes = 0;
+    for (int i = 0; i < 4 && sizes[i]; ++i) {
+        offsets[i] = total;
+        total += sizes[i];
+        planes = i + 1;
+    }
+
+    // some SIMD readers go a little past the last line, same padding as av_frame_get_buffer
+    total += 16;
+    return total > INT_MAX - ALIGN ? AVERROR(EINVAL) : static_cast<int>(total);
+}
+
+int FramePool::setupAudio() {
+    const auto sample_fmt = static_cast<AVSampleFormat>(format);
+    planes = av_sample_fmt_is_planar(sample_fmt) ? channels : 1;
+    if (planes > AV_NUM_DATA_POINTERS) {
+        // would need extended_data allocated apart, not worth it for the channel counts used here
+        return AVERROR(ENOSYS);
+    }
+
+    int line;
+    const int ret = av_samples_get_buffer_size(&line, channels, nb_samples, sample_fmt, ALIGN);
+    if (ret < 0) {
+        return ret;
+    }
+
+    // for audio only linesize[0] is set, all planes have the same size
+    std::fill(std::begin(linesize), std::end(linesize), 0);
+    linesize[0] = line;
+    for (int i = 0; i < planes; ++i) {
+        offsets[i] = static_cast<size_t>(i) * line;
+    }
+
+    return line * planes;
+}
+
+AVBufferRef* FramePool::allocate(void *opaque, int size) {
+    // only reached when the pool has no free buffer, stays flat in steady state
+    auto *frame_pool = static_cast<FramePool*>(opaque);
+    frame_pool->allocations.fetch_add(1, std::memory_order_relaxed);
+    return BufferAllocator::allocate(size, frame_pool->memory_policy);
+}
@@ -0,0 +1,62 @@
+#ifndef REMOTE_DESKTOP_FRAMEPOOL_H
+#define REMOTE_DESKTOP_FRAMEPOOL_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/buffer.h>
+#include <libavutil/frame.h>
+};
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include "spinlock.h"
+#include "metrics.h"
+#include "BufferAllocator.h"
+
+// drop-in replacement of av_frame_get_buffer backed by an AVBufferPool
+// the pool is keyed on format and geometry, and rebuilt when they change
+class FramePool {
+private:
+    std::string name;
+    spinlock lock;
+    AVBufferPool *pool = nullptr;
+
+    // key of the current pool
+    int format = -1;
+    int width = 0;
+    int height = 0;
+    int nb_samples = 0;
+    int channels = 0;
+
+    // layout of a buffer, planes are at the given offsets from the aligned start
+    int linesize[AV_NUM_DATA_POINTERS] = {};
+    size_t offsets[AV_NUM_DATA_POINTERS] = {};
+    int planes = 0;
+
+    MemoryPolicy memory_policy;
+    std::atomic<uint64_t> &allocations;
+
+public:
+    explicit FramePool(const std::string &name);
+    ~FramePool();
+
+    // backing of the buffers allocated from now on, the pool is rebuilt on the next get
+    void setMemoryPolicy(const MemoryPolicy &policy);
+
+    // same contract as av_frame_get_buffer(frame, 0): format and width/height or nb_samples/channels must be set
+    int get(AVFrame *frame);
+
+    // AVCodecContext.get_buffer2 callback, opaque must point to the pool
+    static int getBuffer2(AVCodecContext *ctx, AVFrame *frame, int flags);
+
+private:
+    int get(AVFrame *frame, int padded_width, int padded_height);
+    int setupVideo(int padded_width, int padded_height);
+    int setupAudio();
+    static AVBufferRef* allocate(void *opaque, int size);
+};
+
+
+#endif //REMOTE_DESKTOP_FRAMEPOOL_H
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <algorithm>
+
+#include "FrameStatsLog.h"
+#include "exception.h"
+
+FrameStatsLog::FrameStatsLog(const std::string &name) : name(name), queue(256),
+        dropped_records(Metrics::counter(name + ": dropped records")) {
+
+}
+
+FrameStatsLog::~FrameStatsLog() {
+    std::cout << name << ": next lines are triggered by ~FrameStatsLog() call" << std::endl;
+    stop();
+    if (file) {
+        fclose(file);
+    }
+}
+
+void FrameStatsLog::init(const std::unordered_map<std::string, std::string> &params) {
+    for (const auto& [key, val] : params) {
+        if (key == "path") {
+            path = val;
+        } else if (key == "max_size") {
+            max_size = std::max<size_t>(sizeof(FrameStats), std::stoull(val));
+        } else {
+            std::cout << name << ": option " << key << " not found" << std::endl;
+        }
+    }
+    if (path.empty()) {
+        throw InitFail("frame stats log needs a path");
+    }
+
+    open();
+    initialized = true;
+}
+
+void FrameStatsLog::start() {
+    if (initialized && stop_condition.load(std::memory_order_relaxed)) {
+        stop_condition.store(false, std::memory_order_relaxed);
+        thread = std::thread(&FrameStatsLog::run, this);
+    } else {
+        std::cout << name << ": not initialized or thread already running" << std::endl;
+    }
+}
+
+void FrameStatsLog::stop() {
+    if (!stop_condition.load(std::memory_order_relaxed)) {
+        stop_condition.store(true, std::memory_order_relaxed);
+        if (thread.joinable()) {
+            thread.join();
+        } else {
+            std::cout << name << ": thread is not joinable" << std::endl;
+        }
+    } else {
+        std::cout << name << ": thread is not running" << std::endl;
+    }
+}
+
+void FrameStatsLog::handle(const FrameStats *stats) {
+    if (!queue.try_enqueue(*stats)) {
+        dropped_records.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void FrameStatsLog::run() {
+    FrameStats stats;
+    try {
+        while (!stop_condition.load(std::memory_order_relaxed)) {
+            if (!queue.wait_dequeue_timed(stats, std::chrono::milliseconds(100))) {
+                // records reach the file at least every 100ms of silence, for readers following it
+                fflush(file);
+                continue;
+            }
+
+            if (file_size + sizeof(stats) > max_size) {
+                rotate();
+            }
+            if (fwrite(&stats, sizeof(stats), 1, file) != 1) {
+                throw RunError("fail to write frame stats");
+            }
+            file_size += sizeof(stats);
+        }
+    } catch (const std::exception &e) {
+        std::cout << e.what() << std::endl;
+    }
+    fflush(file);
+}
+
+void FrameStatsLog::open() {
+    if (file) {
+        fclose(file);
+    }
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        throw InitFail("fail to open frame stats log");
+    }
+    file_size = 0;
+}
+
+void FrameStatsLog::rotate() {
+    fclose(file);
+    file = nullptr;
+    const std::string previous = path + ".1";
+    if (std::rename(path.c_str(), previous.c_str()) != 0) {
+        std::cout << name << ": fail to move " << path << " to " << previous << ", overwritten" << std::endl;
+    }
+    open();
+}
@@ -0,0 +1,55 @@
+#ifndef REMOTE_DESKTOP_FRAMESTATSLOG_H
+#define REMOTE_DESKTOP_FRAMESTATSLOG_H
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+
+#include "readerwriterqueue/readerwritercircularbuffer.h"
+
+#include "Sink.h"
+#include "Encoder.h"
+#include "metrics.h"
+
+// rolling binary log of the frame stats of an encoder, 56 bytes FrameStats records back to back, no header:
+// pts, capture_time, submit_time, packet_time as int64, size, qp, codec_time and codec_cpu_time as int32,
+// pict_type and key as uint8, 6 zero bytes, in host byte order (little endian on the x86 hosts running the server)
+// the file is moved to <path>.1 once it reaches max_size, so at most two files are kept
+class FrameStatsLog : public Sink<const FrameStats> {
+private:
+    std::string name;
+    bool initialized = false;
+
+    std::string path;
+    size_t max_size = 64 << 20;
+    FILE *file = nullptr;
+    size_t file_size = 0;
+
+    std::atomic<bool> stop_condition = true;
+    std::thread thread;
+    // written from the drain thread of the encoder, never blocks it
+    moodycamel::BlockingReaderWriterCircularBuffer<FrameStats> queue;
+    std::atomic<uint64_t> &dropped_records;
+
+public:
+    explicit FrameStatsLog(const std::string &name="frame stats log");
+    ~FrameStatsLog() override;
+
+    // path, and max_size in bytes
+    void init(const std::unordered_map<std::string, std::string> &params);
+
+    void start();
+    void stop();
+
+    void handle(const FrameStats *stats) override;
+
+private:
+    void run();
+    void open();
+    void rotate();
+};
+
+
+#endif //REMOTE_DESKTOP_FRAMESTATSLOG_H
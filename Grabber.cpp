@@ -1,10 +1,20 @@
 #include <iostream>
 #include <csignal>
 
+extern "C" {
+#include <libavutil/time.h>
+};
+
 #include "Grabber.h"
 #include "exception.h"
 
-Grabber::Grabber(std::string name) : name(std::move(name)) {
+// past this delay after a resume (us), packets are taken whatever their timestamp
+constexpr int64_t MAX_STALE_DELAY = 1'000'000;
+
+Grabber::Grabber(std::string name) : name(std::move(name)),
+        capture_intervals(Metrics::histogram(this->name + ": capture interval (us)")),
+        frame_pool(this->name),
+        stale_packets(Metrics::counter(this->name + ": packets dropped after resume")) {
 
 }
 
@@ -25,6 +35,14 @@ AVCodecContext *Grabber::getContext() {
     return codec_ctx;
 }
 
+void Grabber::setScheduler(CaptureScheduler *scheduler) {
+    this->scheduler = scheduler;
+}
+
+void Grabber::setMemoryPolicy(const MemoryPolicy &policy) {
+    frame_pool.setMemoryPolicy(policy);
+}
+
 void Grabber::start() {
     if (initialized && stop_condition.load(std::memory_order_relaxed)) {
         stop_condition.store(false, std::memory_order_relaxed);
@@ -47,13 +65,55 @@ void Grabber::stop() {
     }
 }
 
+void Grabber::pause() {
+    paused.store(true, std::memory_order_relaxed);
+}
+
+void Grabber::resume() {
+    {
+        std::lock_guard<std::mutex> guard(pause_mutex);
+        paused.store(false, std::memory_order_relaxed);
+    }
+    pause_cv.notify_one();
+}
+
 void Grabber::run() {
     std::cerr << name << ": pid is " << gettid() << std::endl;
     AVPacket *packet = av_packet_alloc();
     AVFrame *frame = av_frame_alloc();
+    int64_t last_pts = AV_NOPTS_VALUE;
+    bool parked = false;
+    int64_t resume_time = AV_NOPTS_VALUE;
     int ret;
     try {
         while (!stop_condition.load(std::memory_order_relaxed)) {
+            if (paused.load(std::memory_order_relaxed)) {
+                parked = true;
+                std::unique_lock<std::mutex> guard(pause_mutex);
+                pause_cv.wait_for(guard, std::chrono::milliseconds(100), [this] { return !paused.load(std::memory_order_relaxed); });
+                continue;
+            } else if (parked) {
+                // the pause is neither a late frame nor a capture interval
+                parked = false;
+                resume_time = av_gettime();
+                last_pts = AV_NOPTS_VALUE;
+                if (pacer) {
+                    pacer->reset();
+                }
+            }
+
+            if (scheduler) {
+                if (!scheduler->waitCaptureTime(std::chrono::milliseconds(100))) {
+                    continue;
+                }
+            } else if (pacer) {
+                pacer->wait();
+            }
+
+            if (!checkSource()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
             if (av_read_frame(format_ctx, packet) < 0) {
                 throw RunError("can't grab frame");
             }
@@ -62,6 +122,24 @@ void Grabber::run() {
                 throw RunError("wrong index");
             }
 
+            // devices keep buffering while parked (alsa), what was captured before the resume is dropped
+            if (resume_time != AV_NOPTS_VALUE) {
+                const int64_t capture_time = packet->pts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+                        av_rescale_q(packet->pts, format_ctx->streams[stream_index]->time_base, {1, 1000000});
+                if (capture_time != AV_NOPTS_VALUE && capture_time < resume_time && av_gettime() - resume_time < MAX_STALE_DELAY) {
+                    stale_packets.fetch_add(1, std::memory_order_relaxed);
+                    av_packet_unref(packet);
+                    continue;
+                }
+                resume_time = AV_NOPTS_VALUE;
+            }
+
+            // pts is the capture time given by the device
+            if (last_pts != AV_NOPTS_VALUE && packet->pts != AV_NOPTS_VALUE) {
+                capture_intervals.record(av_rescale_q(packet->pts - last_pts, format_ctx->streams[stream_index]->time_base, {1, 1000000}));
+            }
+            last_pts = packet->pts;
+
             Source<AVPacket>::forward(packet);
 
             ret = avcodec_send_packet(codec_ctx, packet);
@@ -13,8 +13,15 @@ extern "C" {
 #include <unordered_map>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #include "Source.h"
+#include "CaptureScheduler.h"
+#include "FramePacer.h"
+#include "metrics.h"
+#include "FramePool.h"
 
 class Grabber : public Source<AVPacket>, public Source<AVFrame> {
 protected:
@@ -27,6 +34,19 @@ protected:
 
     std::atomic<bool> stop_condition = true;
     std::thread grab_thread;
+    CaptureScheduler *scheduler = nullptr;
+    // set by devices that do not pace themselves
+    std::unique_ptr<FramePacer> pacer;
+    Histogram &capture_intervals;
+    // decoded frames buffers, set as the decoder get_buffer2 by the subclasses whose decoder allocates (pcm),
+    // decoders referencing the packet (rawvideo) never call it
+    FramePool frame_pool;
+
+    // parked without closing the device, nor the codecs downstream
+    std::atomic<bool> paused = false;
+    std::mutex pause_mutex;
+    std::condition_variable pause_cv;
+    std::atomic<uint64_t> &stale_packets;
 
     explicit Grabber(std::string name);
     ~Grabber() override;
@@ -34,12 +54,21 @@ protected:
 public:
     virtual void init(std::unordered_map<std::string, std::string> &params) = 0;
     AVCodecContext* getContext();
+    // capture when the scheduler says so instead of the device own timer, set before start()
+    void setScheduler(CaptureScheduler *scheduler);
+    // memory of the decoded frames, when the decoder does not reference the packets
+    void setMemoryPolicy(const MemoryPolicy &policy);
 
     void start();
     void stop();
+    // stop capturing until resume(), the thread stays up so capture restarts on the next frame slot
+    void pause();
+    void resume();
 
 protected:
     void run();
+    // called by the grab thread before each capture, may reopen the device, false when it can not be read for now
+    virtual bool checkSource() { return true; }
 };
 
 #endif
\ No newline at end of file
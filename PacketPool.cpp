@@ -0,0 +1,83 @@
+extern "C" {
+#include <libavutil/mem.h>
+};
+
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "PacketPool.h"
+#include "exception.h"
+
+PacketPool::PacketPool(const std::string &name, size_t size) : name(name), entries(size),
+        allocations(Metrics::counter(name + ": packet pool allocations")) {
+    free_entries.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        entries[i].packet = av_packet_alloc();
+        if (!entries[i].packet) {
+            throw InitFail("fail to allocate packet pool");
+        }
+        free_entries.push_back(i);
+    }
+}
+
+PacketPool::~PacketPool() {
+    for (auto& entry : entries) {
+        av_packet_free(&entry.packet);
+        av_freep(&entry.payload);
+    }
+}
+
+AVPacket* PacketPool::copy(const AVPacket *packet) {
+    size_t index;
+    {
+        std::lock_guard<spinlock> guard(lock);
+        if (free_entries.empty()) {
+            return nullptr;
+        }
+        index = free_entries.back();
+        free_entries.pop_back();
+    }
+
+    // only the owner of the entry touches it until release
+    Entry &entry = entries[index];
+    const size_t needed = static_cast<size_t>(packet->size) + AV_INPUT_BUFFER_PADDING_SIZE;
+    if (needed > entry.capacity) {
+        // key frames come back regularly, leave room for a bigger one
+        const size_t capacity = FFALIGN(std::max(needed, entry.capacity * 2), 4096);
+        av_freep(&entry.payload);
+        entry.payload = static_cast<uint8_t*>(av_malloc(capacity));
+        entry.capacity = entry.payload ? capacity : 0;
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (!entry.payload) {
+            release(entry.packet);
+            return nullptr;
+        }
+    }
+
+    // side data (encoder stats) is not used by the muxers, not copying it keeps the copy allocation free
+    AVPacket *out = entry.packet;
+    std::memcpy(entry.payload, packet->data, packet->size);
+    std::memset(entry.payload + packet->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+    out->buf = nullptr;
+    out->data = entry.payload;
+    out->size = packet->size;
+    out->pts = packet->pts;
+    out->dts = packet->dts;
+    out->duration = packet->duration;
+    out->flags = packet->flags;
+    out->stream_index = packet->stream_index;
+    return out;
+}
+
+void PacketPool::release(AVPacket *packet) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].packet == packet) {
+            std::lock_guard<spinlock> guard(lock);
+            free_entries.push_back(i);
+            return;
+        }
+    }
+    std::cerr << name << ": released packet is not from the pool" << std::endl;
+}
@@ -0,0 +1,45 @@
+#ifndef REMOTE_DESKTOP_PACKETPOOL_H
+#define REMOTE_DESKTOP_PACKETPOOL_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+};
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "spinlock.h"
+#include "metrics.h"
+
+// fixed set of packets owning their payload storage, for sinks that keep packets past handle()
+// copies are not refcounted so the muxer uses them in place, storage only grows on a bigger packet
+class PacketPool {
+private:
+    struct Entry {
+        AVPacket *packet = nullptr;
+        uint8_t *payload = nullptr;
+        size_t capacity = 0;
+    };
+
+    std::string name;
+    std::vector<Entry> entries;
+    // indexes of the entries not in flight
+    std::vector<size_t> free_entries;
+    spinlock lock;
+
+    std::atomic<uint64_t> &allocations;
+
+public:
+    PacketPool(const std::string &name, size_t size);
+    ~PacketPool();
+
+    // copy of the packet payload and timing in a free entry, nullptr when all of them are in flight
+    AVPacket* copy(const AVPacket *packet);
+    // give back a packet returned by copy
+    void release(AVPacket *packet);
+};
+
+
+#endif //REMOTE_DESKTOP_PACKETPOOL_H
@@ -0,0 +1,109 @@
+#include <mutex>
+#include <algorithm>
+#include <cstdlib>
+
+#include "RateMonitor.h"
+
+// long enough to hold a few frames at any framerate, short enough to see a step quickly
+constexpr int64_t WINDOW = 500'000;
+// rate is not given before this much of the window is filled
+constexpr int64_t MIN_WINDOW = 250'000;
+// convergence is judged on the rate over this last span of the packets sent after the step (us),
+// a few frames, so it is seen within about half of it instead of waiting for the window
+constexpr int64_t STEP_WINDOW = 100'000;
+// how long a step is followed for the overshoot
+constexpr int64_t OBSERVATION = 2'000'000;
+// distance to the target (percent) under which the rate has converged
+constexpr int64_t CONVERGENCE_MARGIN = 10;
+
+RateMonitor::RateMonitor(const std::string &name) : name(name),
+        convergence(Metrics::histogram(name + ": rate convergence (us)")),
+        overshoot(Metrics::histogram(name + ": rate overshoot (%)")),
+        not_converged(Metrics::counter(name + ": rate steps not converged")) {
+
+}
+
+void RateMonitor::step(int64_t bitrate, int64_t time) {
+    std::lock_guard<spinlock> guard(lock);
+    if (observing) {
+        finishStep();
+    }
+    target = bitrate;
+    step_time = time;
+    peak = 0;
+    observing = bitrate > 0;
+    converged = false;
+}
+
+void RateMonitor::record(int64_t time, int64_t size) {
+    std::lock_guard<spinlock> guard(lock);
+    // drop what left the window, and the oldest packet when it is full
+    while (count > 0 && (time - packets[first].first > WINDOW || count == packets.size())) {
+        window_bytes -= packets[first].second;
+        first = (first + 1) % packets.size();
+        --count;
+    }
+    packets[(first + count) % packets.size()] = {time, size};
+    ++count;
+    window_bytes += size;
+
+    if (!observing) {
+        return;
+    }
+
+    // only packets sent after the step count: a short span for the convergence, the window for the peak
+    const int64_t recent = rateSince(step_time, STEP_WINDOW, time);
+    if (recent > 0 && !converged && std::abs(recent - target) * 100 <= target * CONVERGENCE_MARGIN) {
+        convergence.record(time - step_time);
+        converged = true;
+    }
+    peak = std::max(peak, rateSince(step_time, WINDOW, time));
+    if (time - step_time >= OBSERVATION) {
+        finishStep();
+    }
+}
+
+int64_t RateMonitor::getRate() {
+    std::lock_guard<spinlock> guard(lock);
+    return count > 0 ? rate(packets[(first + count - 1) % packets.size()].first) : 0;
+}
+
+int64_t RateMonitor::rate(int64_t time) const {
+    const int64_t duration = time - packets[first].first;
+    if (duration < MIN_WINDOW) {
+        return 0;
+    }
+    // the last packet ends the window, it does not count in the duration
+    return (window_bytes - packets[(first + count - 1) % packets.size()].second) * 8 * 1'000'000 / duration;
+}
+
+int64_t RateMonitor::rateSince(int64_t since, int64_t span, int64_t time) const {
+    since = std::max(since, time - span);
+    // newest packets first, before the last one which ends the span
+    int64_t bytes = 0;
+    int64_t start = time;
+    for (size_t i = count; i > 1; --i) {
+        const auto& packet = packets[(first + i - 2) % packets.size()];
+        if (packet.first < since) {
+            break;
+        }
+        bytes += packet.second;
+        start = packet.first;
+    }
+    const int64_t duration = time - start;
+    if (duration < span / 2) {
+        return 0;
+    }
+    // as in rate(), the last packet ends the span and does not count
+    return bytes * 8 * 1'000'000 / duration;
+}
+
+void RateMonitor::finishStep() {
+    if (!converged) {
+        not_converged.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (peak > 0) {
+        overshoot.record(std::max<int64_t>(0, peak * 100 / target - 100));
+    }
+    observing = false;
+}
@@ -0,0 +1,55 @@
+#ifndef REMOTE_DESKTOP_RATEMONITOR_H
+#define REMOTE_DESKTOP_RATEMONITOR_H
+
+#include <string>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include "spinlock.h"
+#include "metrics.h"
+
+// output bitrate of an encoder over a sliding window, and how it follows each change of the target:
+// time until it is within 10% of the new target, and the highest rate seen in the following seconds
+class RateMonitor {
+private:
+    std::string name;
+    spinlock lock;
+
+    // packets of the window, time (us) and size (bytes)
+    std::array<std::pair<int64_t, int64_t>, 256> packets = {};
+    size_t first = 0;
+    size_t count = 0;
+    int64_t window_bytes = 0;
+
+    // current step, observed until the end of the observation period or the next step
+    int64_t target = 0;
+    int64_t step_time = 0;
+    int64_t peak = 0;
+    bool observing = false;
+    bool converged = false;
+
+    Histogram &convergence;
+    Histogram &overshoot;
+    std::atomic<uint64_t> &not_converged;
+
+public:
+    explicit RateMonitor(const std::string &name);
+    ~RateMonitor() = default;
+
+    // target bitrate changed at the given time (us)
+    void step(int64_t bitrate, int64_t time);
+    // packet output at the given time (us)
+    void record(int64_t time, int64_t size);
+    // bits per second over the window, 0 until it is long enough
+    int64_t getRate();
+
+private:
+    int64_t rate(int64_t time) const;
+    // same over the packets sent from the given time and within the span, 0 while they cover less than half of it
+    int64_t rateSince(int64_t since, int64_t span, int64_t time) const;
+    void finishStep();
+};
+
+
+#endif //REMOTE_DESKTOP_RATEMONITOR_H
@@ -48,4 +48,8 @@ protected:
     }
 };
 
+// frames are cloned for each sink, see source.cpp
+template <>
+void Source<AVFrame>::forward(AVFrame *frame);
+
 #endif //REMOTE_DESKTOP_SOURCE_H
@@ -21,18 +21,30 @@ void AlsaGrabber::init(std::unordered_map<std::string, std::string> &params) {
 
     // set options
     AVDictionary *options = nullptr;
+    bool fast_start = false;
     for (const auto& [key, val] : params) {
-        av_dict_set(&options, key.c_str(), val.c_str(),0);
+        if (key == "fast_start") {
+            fast_start = val == "1";
+        } else {
+            av_dict_set(&options, key.c_str(), val.c_str(),0);
+        }
     }
 
     format_ctx = avformat_alloc_context();
+    if (fast_start) {
+        // nothing to detect, the demuxer header already describes the stream
+        format_ctx->probesize = 32;
+        format_ctx->max_analyze_duration = 0;
+    }
     AVInputFormat *ifmt = av_find_input_format("alsa");
     //av_dict_set(&options, "sample_rate", "44100", 0);
     if(avformat_open_input(&format_ctx, "default", ifmt, &options) != 0) {
         throw InitFail("Couldn't open input stream");
     }
 
-    if(avformat_find_stream_info(format_ctx,NULL) < 0) {
+    // read_header of alsa (codec, sample rate, channels) fills the stream parameters from the device configuration,
+    // probing only reads and decodes frames for nothing
+    if(!fast_start && avformat_find_stream_info(format_ctx,NULL) < 0) {
         throw InitFail("Couldn't find stream information");
     }
 
@@ -51,6 +63,8 @@ void AlsaGrabber::init(std::unordered_map<std::string, std::string> &params) {
         throw InitFail("Could not allocate video codec context");
     }
 
+    codec_ctx->opaque = &frame_pool;
+    codec_ctx->get_buffer2 = FramePool::getBuffer2;
     if(avcodec_open2(codec_ctx, codec, NULL) < 0) {
         throw InitFail("Could not open codec");
     }
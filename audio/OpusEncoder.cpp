@@ -14,7 +14,7 @@ static int check_sample_fmt(const AVCodec *codec, AVSampleFormat sample_fmt) {
     return 0;
 }
 
-OpusEncoder::OpusEncoder() : Encoder("opus encoder") {
+OpusEncoder::OpusEncoder() : Encoder("opus encoder"), frame_pool(name) {
 
 }
 
@@ -28,6 +28,7 @@ void OpusEncoder::init(const std::unordered_map<std::string, std::string> &param
     if (codec_ctx) {
         avcodec_free_context(&codec_ctx);
     }
+    this->params = params;
 
     if (fifo) {
         av_audio_fifo_free(fifo);
@@ -69,6 +70,7 @@ void OpusEncoder::init(const std::unordered_map<std::string, std::string> &param
         }
     }
 
+    usePayloadPool();
     if (avcodec_open2(codec_ctx, codec, NULL) < 0) {
         throw InitFail("could not open codec");
     }
@@ -110,7 +112,7 @@ void OpusEncoder::runFeed() {
             frame->sample_rate = codec_ctx->sample_rate;
             frame->channels = codec_ctx->channels;
             frame->channel_layout = codec_ctx->channel_layout;
-            if (av_frame_get_buffer(frame, 0) < 0) {
+            if (frame_pool.get(frame) < 0) {
                 throw RunError("can't allocate frame buffer");
             }
 
@@ -134,7 +136,7 @@ void OpusEncoder::feedImpl(AVFrame *frame) {
     encoder_lock.lock();
     int ret = avcodec_send_frame(codec_ctx, frame);
     encoder_lock.unlock();
-    encoder_cv.notify_all();
+    notifyDrain();
     if (ret >= 0) {
         frame_id += frame->nb_samples;
     /*} if (ret == AVERROR(EAGAIN)) {
@@ -167,7 +169,7 @@ void OpusEncoder::handle(AVFrame *frame) {
             frame->sample_rate = codec_ctx->sample_rate;
             frame->channels = codec_ctx->channels;
             frame->channel_layout = codec_ctx->channel_layout;
-            if (av_frame_get_buffer(frame, 0) < 0) {
+            if (frame_pool.get(frame) < 0) {
                 throw RunError("can't allocate frame buffer");
             }
 
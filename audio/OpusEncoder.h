@@ -10,14 +10,19 @@ extern "C" {
 #include <libswscale/swscale.h>
 };
 
+#include <mutex>
+#include <condition_variable>
+
 #include "../Encoder.h"
 #include "../spinlock.h"
+#include "../FramePool.h"
 
 class OpusEncoder : public Encoder {
 private:
     AVAudioFifo *fifo = nullptr;
     spinlock lock;
     std::condition_variable cv;
+    FramePool frame_pool;
 
 public:
     explicit OpusEncoder();
@@ -3,22 +3,58 @@
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <future>
+#include <array>
+#include <vector>
+#include <memory>
+#include <algorithm>
 
 #include "video/X11Grabber.h"
 #include "video/FrameConverter.h"
 #include "video/H264Encoder.h"
+#include "video/HEVCEncoder.h"
+#include "video/AV1Encoder.h"
+#include "video/CursorTracker.h"
+#include "video/EncoderScheduler.h"
+#include "video/EncoderGovernor.h"
 #include "audio/AlsaGrabber.h"
 #include "audio/OpusEncoder.h"
 #include "network/socket_server.h"
+#include "timing.h"
+#include "metrics.h"
+#include "CaptureScheduler.h"
+#include "BufferAllocator.h"
+#include "FrameStatsLog.h"
+#include "exception.h"
 
 
+constexpr auto METRICS_PERIOD = std::chrono::seconds(10);
+
 std::atomic<bool> stop = false;
 void signalHandler(int signum) {
     std::cout << "Interrupt signal (" << signum << ") received.\n";
     stop.store(true, std::memory_order_relaxed);
 }
 
-int main() {
+// pipeline modes are given on the command line as mode=value, the first value is the default
+std::string modeOption(int argc, char **argv, const std::string &mode, const std::vector<std::string> &values) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg.rfind(mode + "=", 0) != 0) {
+            continue;
+        }
+
+        const std::string value = arg.substr(mode.size() + 1);
+        if (std::find(values.begin(), values.end(), value) == values.end()) {
+            std::cerr << mode << ": unknown value " << value << std::endl;
+            throw InitFail("unknown mode value");
+        }
+        return value;
+    }
+    return values.front();
+}
+
+int main(int argc, char **argv) {
     signal(SIGINT, signalHandler);
     //signal(SIGTERM, signalHandler);
 
@@ -27,29 +63,84 @@ int main() {
     avformat_network_init();
 
     try {
-        //audio chain
-        std::unordered_map<std::string, std::string> audio_capture_options = {
-                //{"sample_rate", "44100"},
-        };
+        // "push" lets x11grab capture on its own timer, "pull" captures just in time for the encoder
+        const std::string capture_mode = modeOption(argc, argv, "capture_mode", {"push", "pull"});
+        // "frame" converts whole frames on each thread, "slice" splits every frame across the threads for lower latency
+        const std::string conversion_mode = modeOption(argc, argv, "conversion_mode", {"slice", "frame"});
+        // "shared" runs one encoder per simulcast tier, "group" adds encoders for groups of sessions asking for similar bitrates
+        const std::string encoding_mode = modeOption(argc, argv, "encoding_mode", {"shared", "group"});
+        // "thread" receives video packets on a drain thread, "inline" on the thread sending the frames, one less handoff
+        const std::string drain_mode = modeOption(argc, argv, "drain_mode", {"thread", "inline"});
+        // clients allowed to change their encoder parameters: "own" only alone on a bitrate group encoder, "none", or "any"
+        const std::string encoder_changes = modeOption(argc, argv, "encoder_changes", {"own", "none", "any"});
+        // codecs offered besides h264 to the clients asking for them, each one runs its own encoder at the main resolution
+        const std::vector<std::string> extra_codecs = {}; // "hevc", "av1"
+        // capture stops while no client is connected, codecs stay open so the first one gets a stream right away
+        const bool park_when_idle = true;
+        // software encoding only: faster presets then lower framerates when the host cpu is contended
+        const bool use_governor = false;
+        // rolling binary log of the main video encoder frame stats, empty to disable
+        const std::string frame_stats_path = ""; // "/tmp/remote-desktop-frames.bin"
+        // large frames on huge pages, on the node the pipeline threads are bound to, no thread is created before this point
+        const int frame_node = BufferAllocator::currentNode();
+        const MemoryPolicy frame_memory = {MemoryPolicy::Pages::Transparent, BufferAllocator::bindToNode(frame_node) ? frame_node : -1};
+        CaptureScheduler capture_scheduler(60);
+
+        // chains do not depend on each other, so they are initialized in parallel
         AlsaGrabber audio_source;
-        audio_source.init(audio_capture_options);
-
-        std::unordered_map<std::string, std::string> audio_encoder_options = {
-                {"bitrate", "128000"},
-                {"sample_rate", std::to_string(audio_source.getContext()->sample_rate)},
-                {"sample_format", std::to_string(audio_source.getContext()->sample_fmt)},
-                {"channels", std::to_string(audio_source.getContext()->channels)},
-                {"application", "lowdelay"},
-                {"frame_duration", "10"},
-                {"fec", "1"},
-                {"packet_loss", "25"},
-        };
         OpusEncoder audio_encoder;
-        audio_encoder.init(audio_encoder_options);
-        audio_source.Source<AVFrame>::attachSink(&audio_encoder);
+        X11Grabber video_source;
+        CursorTracker cursor_tracker;
+        H264Encoder video_encoder(true);
+        FrameConverter video_converter;
+
+        // simulcast ladder below the main stream, each tier is scaled from the one above and has its own encoder
+        const std::vector<std::array<int, 3>> video_ladder = {
+                {1280, 720, 6000000},
+                {960, 540, 3500000},
+        };
+        std::vector<std::unique_ptr<H264Encoder>> tier_encoders;
+        for (const auto& tier : video_ladder) {
+            tier_encoders.push_back(std::make_unique<H264Encoder>(true, "h264 encoder " + std::to_string(tier[1]) + "p"));
+        }
 
-        audio_encoder.startDrain();
-        audio_source.start();
+        std::vector<std::unique_ptr<VideoEncoder>> codec_encoders;
+        for (const auto& codec : extra_codecs) {
+            // av1 has no RTP packetization in this FFmpeg, its encoder would run for nothing
+            const AVCodecDescriptor *descriptor = avcodec_descriptor_get_by_name(codec.c_str());
+            if (!descriptor || !RTPVideoSender::supports(descriptor->id)) {
+                std::cout << codec << " can not be sent over rtp, not offered" << std::endl;
+            } else if (codec == "hevc") {
+                codec_encoders.push_back(std::make_unique<HEVCEncoder>(true));
+            } else if (codec == "av1") {
+                codec_encoders.push_back(std::make_unique<AV1Encoder>());
+            }
+        }
+
+        //audio chain
+        auto audio_chain = std::async(std::launch::async, [&audio_source, &audio_encoder] {
+            std::unordered_map<std::string, std::string> audio_capture_options = {
+                    //{"sample_rate", "44100"},
+                    {"fast_start", "1"},
+            };
+            audio_source.init(audio_capture_options);
+
+            std::unordered_map<std::string, std::string> audio_encoder_options = {
+                    {"bitrate", "128000"},
+                    {"sample_rate", std::to_string(audio_source.getContext()->sample_rate)},
+                    {"sample_format", std::to_string(audio_source.getContext()->sample_fmt)},
+                    {"channels", std::to_string(audio_source.getContext()->channels)},
+                    {"application", "lowdelay"},
+                    {"frame_duration", "10"},
+                    {"fec", "1"},
+                    {"packet_loss", "25"},
+            };
+            audio_encoder.init(audio_encoder_options);
+            audio_source.Source<AVFrame>::attachSink(&audio_encoder);
+
+            audio_encoder.startDrain();
+            audio_source.start();
+        });
 
         //video chain
         std::unordered_map<std::string, std::string> video_grabber_options = {
@@ -57,11 +148,23 @@ int main() {
                 {"video_size", "1920x1080"},
                 {"framerate", "60"},
                 {"follow_mouse", "centered"},
-                {"probesize", "32M"},
+                {"draw_mouse", "0"}, // cursor is sent apart by the cursor tracker
+                {"fast_start", "1"},
+                //{"probesize", "32M"}, // without fast_start
+                {"late_policy", "skip"},
+                // in pull mode the capture scheduler drives capture instead of the pacer
+                {"pacing", capture_mode == "pull" ? "external" : "pacer"},
         };
-        X11Grabber video_source;
-        video_source.init(video_grabber_options);
-        video_source.start();
+        auto video_capture = std::async(std::launch::async, [&video_source, &cursor_tracker, &video_grabber_options] {
+            video_source.init(video_grabber_options);
+
+            std::unordered_map<std::string, std::string> cursor_tracker_options = {
+                    {"video_size", video_grabber_options["video_size"]},
+                    {"follow_mouse", video_grabber_options["follow_mouse"]},
+                    {"poll_rate", "250"},
+            };
+            cursor_tracker.init(cursor_tracker_options);
+        });
 
         std::unordered_map<std::string, std::string> video_encoder_options = {
                 {"bitrate", "15000000"},
@@ -77,34 +180,166 @@ int main() {
                 {"tune", "ull"}, // nvenc
                 {"rc", "cbr"}, // nvenc
                 {"zerolatency", "1"}, // nvenc
+                //{"roi", "1"}, // software, better quality around the cursor at the same bitrate
+                //{"intra_refresh", "1"}, // software, no key frame burst, gop_size is the refresh period
         };
-        H264Encoder video_encoder(true);
-        video_encoder.init(video_encoder_options);
-        video_encoder.startDrain();
+        auto video_encoding = std::async(std::launch::async, [&video_encoder, &video_encoder_options, &video_ladder, &tier_encoders, &codec_encoders, &drain_mode] {
+            video_encoder.init(video_encoder_options);
+            if (drain_mode == "thread") {
+                video_encoder.startDrain();
+            } else {
+                video_encoder.setInlineDrain(true);
+            }
 
-        FrameConverter video_converter;
-        if (video_source.getContext()->width != video_encoder.getContext()->width ||
-            video_source.getContext()->height != video_encoder.getContext()->height ||
-            video_source.getContext()->pix_fmt != video_encoder.getContext()->pix_fmt) {
-            video_converter.init(video_source.getContext(), video_encoder.getContext(), 2);
+            for (size_t i = 0; i < tier_encoders.size(); ++i) {
+                auto tier_options = video_encoder_options;
+                tier_options["width"] = std::to_string(video_ladder[i][0]);
+                tier_options["height"] = std::to_string(video_ladder[i][1]);
+                tier_options["bitrate"] = std::to_string(video_ladder[i][2]);
+                tier_encoders[i]->init(tier_options);
+                if (drain_mode == "thread") {
+                    tier_encoders[i]->startDrain();
+                } else {
+                    tier_encoders[i]->setInlineDrain(true);
+                }
+            }
+
+            // h264 speed and latency options do not carry over, each codec sets its own low latency defaults
+            for (auto& codec_encoder : codec_encoders) {
+                auto codec_options = video_encoder_options;
+                for (const char *key : {"preset", "tune", "rc", "zerolatency"}) {
+                    codec_options.erase(key);
+                }
+                codec_encoder->init(codec_options);
+                if (drain_mode == "thread") {
+                    codec_encoder->startDrain();
+                } else {
+                    codec_encoder->setInlineDrain(true);
+                }
+            }
+        });
+
+        video_capture.get();
+        video_encoding.get();
+        const bool use_converter = video_source.getContext()->width != video_encoder.getContext()->width ||
+                                   video_source.getContext()->height != video_encoder.getContext()->height ||
+                                   video_source.getContext()->pix_fmt != video_encoder.getContext()->pix_fmt;
+        if (use_converter) {
+            // partial: only tiles that changed since the previous frame are converted
+            video_converter.init(video_source.getContext(), video_encoder.getContext(), 2,
+                                 conversion_mode == "slice" ? FrameConverter::Parallelism::Slice : FrameConverter::Parallelism::Frame, true);
+            for (auto& tier_encoder : tier_encoders) {
+                video_converter.addTier(tier_encoder->getContext()->width, tier_encoder->getContext()->height).attachSink(tier_encoder.get());
+            }
+            video_converter.setMemoryPolicy(frame_memory);
             video_converter.start();
             video_converter.attachSink(&video_encoder);
             video_source.Source<AVFrame>::attachSink(&video_converter);
         } else {
+            // no converter to scale the ladder from
             video_source.Source<AVFrame>::attachSink(&video_encoder);
+            tier_encoders.clear();
+        }
+        // other codecs and group encoders share the frames of the main resolution
+        Source<AVFrame> &main_frames = use_converter ?
+                static_cast<Source<AVFrame>&>(video_converter) : static_cast<Source<AVFrame>&>(video_source);
+        for (auto& codec_encoder : codec_encoders) {
+            main_frames.attachSink(codec_encoder.get());
+        }
+        // cursor position for the region of interest
+        cursor_tracker.attachSink(&video_encoder);
+        for (auto& tier_encoder : tier_encoders) {
+            cursor_tracker.attachSink(tier_encoder.get());
+        }
+        for (auto& codec_encoder : codec_encoders) {
+            cursor_tracker.attachSink(codec_encoder.get());
+        }
+        // the scheduler outlives the server using it
+        std::unique_ptr<EncoderScheduler> encoder_scheduler;
+        if (encoding_mode == "group") {
+            encoder_scheduler = std::make_unique<EncoderScheduler>(main_frames, true);
+            auto scheduler_options = video_encoder_options;
+            scheduler_options["max_encoders"] = "4";
+            scheduler_options["cores_per_encoder"] = "2";
+            scheduler_options["first_core"] = "2"; // capture and conversion
+            encoder_scheduler->init(scheduler_options);
+            encoder_scheduler->setCursorSource(&cursor_tracker);
+        }
+        EncoderGovernor encoder_governor;
+        if (use_governor) {
+            encoder_governor.setEncoder(&video_encoder);
+            encoder_governor.init({
+                    {"presets", "veryfast,superfast,ultrafast"},
+                    {"framerates", "45,30"},
+            });
+            video_encoder.Source<const FrameStats>::attachSink(&encoder_governor);
+            encoder_governor.attachSink(&video_encoder);
+        }
+        FrameStatsLog frame_stats_log;
+        if (!frame_stats_path.empty()) {
+            frame_stats_log.init({{"path", frame_stats_path}, {"max_size", std::to_string(64 << 20)}});
+            frame_stats_log.start();
+            video_encoder.Source<const FrameStats>::attachSink(&frame_stats_log);
         }
+        if (capture_mode == "pull") {
+            video_source.setScheduler(&capture_scheduler);
+            video_converter.setScheduler(&capture_scheduler);
+            video_encoder.setScheduler(&capture_scheduler);
+        }
+
+        // start capture once the whole chain is ready, earlier frames would be thrown away
+        video_source.start();
+        cursor_tracker.start();
 
-        SocketServer server(audio_encoder, video_encoder);
+        audio_chain.get();
+        std::cerr << "pipeline ready " << millisecondsSinceStart() << "ms after process start" << std::endl;
+
+        SocketServer server(audio_encoder, video_encoder, &cursor_tracker);
+        for (auto& tier_encoder : tier_encoders) {
+            server.addVideoTier(*tier_encoder);
+        }
+        for (auto& codec_encoder : codec_encoders) {
+            server.addVideoCodec(*codec_encoder);
+        }
+        server.setEncoderScheduler(encoder_scheduler.get());
+        server.setEncoderChangePolicy(encoder_changes == "any" ? EncoderChangePolicy::Any :
+                                      encoder_changes == "none" ? EncoderChangePolicy::None : EncoderChangePolicy::OwnEncoder);
+        server.setCaptureRate(std::stoi(video_grabber_options["framerate"]));
+        if (park_when_idle) {
+            server.parkWhenIdle(video_source);
+            server.parkWhenIdle(audio_source);
+        }
         server.init();
         server.start();
 
+        auto next_metrics = std::chrono::steady_clock::now() + METRICS_PERIOD;
         while (!stop.load(std::memory_order_relaxed)) {
             std::this_thread::sleep_for(std::chrono::seconds(1));
+            if (std::chrono::steady_clock::now() >= next_metrics) {
+                std::cout << "metrics (capture mode " << capture_mode << ", conversion mode " << conversion_mode
+                          << ", encoding mode " << encoding_mode << ", drain mode " << drain_mode << "):" << std::endl;
+                Metrics::print(std::cout);
+                next_metrics += METRICS_PERIOD;
+            }
         }
 
         std::cout << "stop all threads..." << std::endl;
         server.stop();
+        cursor_tracker.stop();
         video_encoder.stop();
+        if (use_governor) {
+            video_encoder.Source<const FrameStats>::detachSink(&encoder_governor);
+        }
+        if (!frame_stats_path.empty()) {
+            video_encoder.Source<const FrameStats>::detachSink(&frame_stats_log);
+            frame_stats_log.stop();
+        }
+        for (auto& tier_encoder : tier_encoders) {
+            tier_encoder->stop();
+        }
+        for (auto& codec_encoder : codec_encoders) {
+            codec_encoder->stop();
+        }
         video_converter.stop();
         video_source.stop();
         audio_encoder.stop();
@@ -0,0 +1,114 @@
+#include <iomanip>
+
+#include "metrics.h"
+
+spinlock Metrics::lock;
+std::map<std::string, Histogram> Metrics::histograms;
+std::map<std::string, std::atomic<uint64_t>> Metrics::counters;
+
+void Histogram::record(int64_t value) {
+    buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    int64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
+
+void Histogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getCount() const {
+    return count.load(std::memory_order_relaxed);
+}
+
+double Histogram::getMean() const {
+    const uint64_t n = getCount();
+    return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.;
+}
+
+int64_t Histogram::getMax() const {
+    return max.load(std::memory_order_relaxed);
+}
+
+int64_t Histogram::getPercentile(double p) const {
+    const uint64_t n = getCount();
+    if (n == 0) {
+        return 0;
+    }
+
+    const auto rank = static_cast<uint64_t>(p * n);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return bucketLowerBound(i);
+        }
+    }
+
+    return getMax();
+}
+
+void Histogram::print(std::ostream &os) const {
+    std::ios state(nullptr);
+    state.copyfmt(os);
+    os << "count=" << getCount() << " mean=" << std::fixed << std::setprecision(1) << getMean();
+    os.copyfmt(state);
+    os << " p50=" << getPercentile(0.5) << " p90=" << getPercentile(0.9)
+       << " p99=" << getPercentile(0.99) << " max=" << getMax();
+}
+
+size_t Histogram::bucketIndex(int64_t value) {
+    if (value < 4) {
+        return value < 0 ? 0 : value;
+    }
+
+    const int exponent = 63 - __builtin_clzll(value);
+    const size_t index = 4 * (exponent - 1) + ((value >> (exponent - 2)) & 3);
+    return index < BUCKETS ? index : BUCKETS - 1;
+}
+
+int64_t Histogram::bucketLowerBound(size_t index) {
+    if (index < 4) {
+        return index;
+    }
+
+    return static_cast<int64_t>(4 + index % 4) << (index / 4 - 1);
+}
+
+Histogram& Metrics::histogram(const std::string &name) {
+    lock.lock();
+    Histogram &histogram = histograms[name];
+    lock.unlock();
+    return histogram;
+}
+
+std::atomic<uint64_t>& Metrics::counter(const std::string &name) {
+    lock.lock();
+    std::atomic<uint64_t> &counter = counters[name];
+    lock.unlock();
+    return counter;
+}
+
+void Metrics::print(std::ostream &os) {
+    lock.lock();
+    for (const auto& [name, counter] : counters) {
+        os << name << ": " << counter.load(std::memory_order_relaxed) << '\n';
+    }
+    for (const auto& [name, histogram] : histograms) {
+        if (histogram.getCount() == 0) {
+            continue;
+        }
+
+        os << name << ": ";
+        histogram.print(os);
+        os << '\n';
+    }
+    lock.unlock();
+    os.flush();
+}
@@ -0,0 +1,53 @@
+#ifndef REMOTE_DESKTOP_METRICS_H
+#define REMOTE_DESKTOP_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <string>
+#include <ostream>
+
+#include "spinlock.h"
+
+// lock-free log-linear histogram, 4 buckets per power of 2 so error is below 25%
+class Histogram {
+public:
+    static constexpr size_t BUCKETS = 128;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets = {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<int64_t> sum = 0;
+    std::atomic<int64_t> max = 0;
+
+public:
+    void record(int64_t value);
+    void reset();
+
+    uint64_t getCount() const;
+    double getMean() const;
+    int64_t getMax() const;
+    int64_t getPercentile(double p) const;
+
+    void print(std::ostream &os) const;
+
+private:
+    static size_t bucketIndex(int64_t value);
+    static int64_t bucketLowerBound(size_t index);
+};
+
+// process wide registry, returned references stay valid until exit
+class Metrics {
+private:
+    static spinlock lock;
+    static std::map<std::string, Histogram> histograms;
+    static std::map<std::string, std::atomic<uint64_t>> counters;
+
+public:
+    static Histogram& histogram(const std::string &name);
+    static std::atomic<uint64_t>& counter(const std::string &name);
+
+    static void print(std::ostream &os);
+};
+
+#endif //REMOTE_DESKTOP_METRICS_H
@@ -1,10 +1,15 @@
 #include <string>
 #include <iostream>
 
+extern "C" {
+#include <libavutil/time.h>
+};
+
 #include "RTPAudioSender.h"
 #include "../exception.h"
 
-RTPAudioSender::RTPAudioSender() : name("rtp audio sender"), queue(4) {
+RTPAudioSender::RTPAudioSender() : name("rtp audio sender"), packet_pool(name, 5), queue(4),
+        send_time(Metrics::histogram(name + ": send (us)")) {
 
 }
 
@@ -104,11 +109,15 @@ void RTPAudioSender::run() {
             }
 
             av_packet_rescale_ts(packet, src_timebase, stream->time_base);
-            if (av_interleaved_write_frame(format_ctx, packet) < 0) {
+            // single stream, nothing to interleave: av_write_frame sends the packet in place
+            // where av_interleaved_write_frame would first move it to its own queue
+            const int64_t start = av_gettime();
+            const int ret = av_write_frame(format_ctx, packet);
+            send_time.record(av_gettime() - start);
+            packet_pool.release(packet);
+            if (ret < 0) {
                 throw InitFail("Error while writing");
             }
-
-            av_packet_free(&packet);
         }
     } catch (const std::exception &e) {
         std::cout << e.what() << std::endl;
@@ -116,9 +125,15 @@ void RTPAudioSender::run() {
 }
 
 void RTPAudioSender::handle(AVPacket *packet) {
-    if (!queue.try_enqueue(packet)) {
+    // the packet is only lent for this call
+    AVPacket *copy = packet_pool.copy(packet);
+    if (!copy) {
+        std::cout << name << ": no free packet in the pool" << std::endl;
+        return;
+    }
+    if (!queue.try_enqueue(copy)) {
         std::cout << name << ": queue is full" << std::endl;
-        av_packet_free(&packet);
+        packet_pool.release(copy);
     }
 }
 
@@ -17,6 +17,8 @@ extern "C" {
 #include "../readerwriterqueue/readerwritercircularbuffer.h"
 
 #include "../Sink.h"
+#include "../PacketPool.h"
+#include "../metrics.h"
 
 class RTPAudioSender : public Sink<AVPacket> {
 private:
@@ -30,7 +32,10 @@ private:
 
     std::atomic<bool> stop_condition = true;
     std::thread thread;
+    // packets in the queue and the one being sent, copied from the encoder output
+    PacketPool packet_pool;
     moodycamel::BlockingReaderWriterCircularBuffer<AVPacket*> queue;
+    Histogram &send_time;
 
 public:
     RTPAudioSender();
@@ -1,10 +1,18 @@
 #include <string>
 #include <iostream>
 
+extern "C" {
+#include <libavutil/time.h>
+};
+
 #include "RTPVideoSender.h"
 #include "../exception.h"
 
-RTPVideoSender::RTPVideoSender() : name("rtp video sender"), queue(4) {
+// payload of a udp datagram in an ethernet frame, the rtp muxer default when writing to a udp url
+constexpr int RTP_PACKET_SIZE = 1472;
+
+RTPVideoSender::RTPVideoSender() : name("rtp video sender"), packet_pool(name, 5), queue(4),
+        send_time(Metrics::histogram(name + ": send (us)")) {
 
 }
 
@@ -14,7 +22,24 @@ RTPVideoSender::~RTPVideoSender() {
     avformat_free_context(format_ctx);
 }
 
-void RTPVideoSender::init(const char *url, AVCodecContext *codec_ctx, const char *type) {
+void RTPVideoSender::init(const char *url, const AVCodecContext *codec_ctx, const char *type) {
+    std::lock_guard<std::mutex> output_guard(output_mutex);
+    // re-init check, close old output
+    if (format_ctx) {
+        if (initialized) {
+            flush();
+        }
+        avformat_free_context(format_ctx);
+        format_ctx = nullptr;
+        stream = nullptr;
+    }
+    // packets of the old stream left in the queue would be sent with the new parameters, and set first_pts
+    AVPacket *packet = nullptr;
+    while (queue.try_dequeue(packet)) {
+        packet_pool.release(packet);
+    }
+    first_pts = AV_NOPTS_VALUE;
+
     format = av_guess_format(type, url, NULL);
     if (!format) {
         throw InitFail("could not guess format");
@@ -62,11 +87,14 @@ void RTPVideoSender::init(const char *url, AVCodecContext *codec_ctx, const char
         throw InitFail("error occurred when opening output file");
     }
 
+    // set by the muxer when writing the header
+    stream_timebase = stream->time_base;
     av_dump_format(format_ctx, 0, url, 1);
     initialized = true;
 }
 
 std::string RTPVideoSender::generateSdp() {
+    std::lock_guard<std::mutex> output_guard(output_mutex);
     char buffer[1024];
     if(av_sdp_create(&format_ctx, 1, buffer, sizeof(buffer)) < 0) {
         throw InitFail("fail to generate sdp");
@@ -75,6 +103,42 @@ std::string RTPVideoSender::generateSdp() {
     return buffer;
 }
 
+int64_t RTPVideoSender::toPts(int64_t offset) {
+    std::lock_guard<std::mutex> output_guard(output_mutex);
+    const int64_t first = first_pts;
+    if (first == AV_NOPTS_VALUE || !initialized) {
+        return AV_NOPTS_VALUE;
+    }
+    return first + av_rescale_q(offset, stream_timebase, src_timebase);
+}
+
+bool RTPVideoSender::supports(AVCodecID codec_id, const char *type) {
+    // the rtp muxer has no codec query, writing its header is what refuses the codecs it can not packetize
+    AVFormatContext *ctx = nullptr;
+    if (avformat_alloc_output_context2(&ctx, nullptr, type, nullptr) < 0) {
+        return false;
+    }
+
+    bool supported = false;
+    AVStream *st = avformat_new_stream(ctx, nullptr);
+    // a packet size, or the muxer refuses to start whatever the codec
+    if (st && avio_open_dyn_packet_buf(&ctx->pb, RTP_PACKET_SIZE) >= 0) {
+        st->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
+        st->codecpar->codec_id = codec_id;
+        st->codecpar->width = 64;
+        st->codecpar->height = 64;
+        st->time_base = {1, 90000};
+        supported = avformat_write_header(ctx, nullptr) >= 0;
+
+        uint8_t *buffer = nullptr;
+        avio_close_dyn_buf(ctx->pb, &buffer);
+        av_free(buffer);
+        ctx->pb = nullptr;
+    }
+    avformat_free_context(ctx);
+    return supported;
+}
+
 void RTPVideoSender::start() {
     if (initialized && stop_condition.load(std::memory_order_relaxed)) {
         stop_condition.store(false, std::memory_order_relaxed);
@@ -105,12 +169,19 @@ void RTPVideoSender::run() {
                 continue;
             }
 
+            if (first_pts == AV_NOPTS_VALUE) {
+                first_pts = packet->pts;
+            }
             av_packet_rescale_ts(packet, src_timebase, stream->time_base);
-            if (av_interleaved_write_frame(format_ctx, packet) < 0) {
+            // single stream, nothing to interleave: av_write_frame sends the packet in place
+            // where av_interleaved_write_frame would first move it to its own queue
+            const int64_t start = av_gettime();
+            const int ret = av_write_frame(format_ctx, packet);
+            send_time.record(av_gettime() - start);
+            packet_pool.release(packet);
+            if (ret < 0) {
                 throw InitFail("Error while writing");
             }
-
-            av_packet_free(&packet);
         }
     } catch (const std::exception &e) {
         std::cout << e.what() << std::endl;
@@ -118,9 +189,15 @@ void RTPVideoSender::run() {
 }
 
 void RTPVideoSender::handle(AVPacket *packet) {
-    if (!queue.try_enqueue(packet)) {
+    // the packet is only lent for this call
+    AVPacket *copy = packet_pool.copy(packet);
+    if (!copy) {
+        std::cout << name << ": no free packet in the pool" << std::endl;
+        return;
+    }
+    if (!queue.try_enqueue(copy)) {
         std::cout << name << ": queue is full" << std::endl;
-        av_packet_free(&packet);
+        packet_pool.release(copy);
     }
 }
 
@@ -13,10 +13,13 @@ extern "C" {
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <mutex>
 
 #include "../readerwriterqueue/readerwritercircularbuffer.h"
 
 #include "../Sink.h"
+#include "../PacketPool.h"
+#include "../metrics.h"
 
 class RTPVideoSender : public Sink<AVPacket> {
 private:
@@ -27,17 +30,30 @@ private:
     AVFormatContext *format_ctx = nullptr;
     AVStream *stream = nullptr;
     AVRational src_timebase;
+    // the session thread reads the output (sdp, time bases) while another thread may init it again
+    std::mutex output_mutex;
+    AVRational stream_timebase;
+    // pts of the first packet sent since init, origin of the frame offsets given by the client
+    std::atomic<int64_t> first_pts = AV_NOPTS_VALUE;
 
     std::atomic<bool> stop_condition = true;
     std::thread thread;
+    // packets in the queue and the one being sent, copied from the encoder output
+    PacketPool packet_pool;
     moodycamel::BlockingReaderWriterCircularBuffer<AVPacket*> queue;
+    Histogram &send_time;
 
 public:
     RTPVideoSender();
     ~RTPVideoSender() override;
 
-    void init(const char *url, AVCodecContext *codec_ctx, const char *type="rtp");
+    // may be called again, after stop(), when the codec parameters change
+    void init(const char *url, const AVCodecContext *codec_ctx, const char *type="rtp");
     std::string generateSdp();
+    // pts of the frame at this offset (rtp clock) from the first one sent, AV_NOPTS_VALUE before it
+    int64_t toPts(int64_t offset);
+    // whether the muxer knows how to packetize this codec
+    static bool supports(AVCodecID codec_id, const char *type="rtp");
 
     void start();
     void stop();
@@ -3,11 +3,19 @@
 #include <sstream>
 #include <iomanip>
 #include <csignal>
+#include <algorithm>
+#include <cctype>
 
 #include "remote_session.h"
 #include "../exception.h"
 
 constexpr size_t BUFFER_SIZE = 4096;
+// command messages carry their size on 16 bits
+constexpr size_t MAX_COMMAND_SIZE = 0xffff;
+// bounds of the encoder parameters a client may ask for
+constexpr int64_t MAX_FRAMERATE = 240;
+constexpr int64_t MAX_GOP_SIZE = 1000;
+constexpr size_t MAX_PRESET_SIZE = 16;
 
 void appendJSONFormattedString(std::ostream &os, const std::string &s) {
     for (const char c : s) {
@@ -47,6 +55,23 @@ void appendJSONFormattedString(std::ostream &os, const std::string &s) {
     }
 }
 
+void appendBase64(std::ostream &os, const uint8_t *data, size_t size) {
+    static constexpr char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t i = 0;
+    for (; i + 2 < size; i += 3) {
+        const uint32_t v = data[i] << 16 | data[i + 1] << 8 | data[i + 2];
+        os << table[v >> 18 & 0x3f] << table[v >> 12 & 0x3f] << table[v >> 6 & 0x3f] << table[v & 0x3f];
+    }
+
+    if (i + 1 == size) {
+        const uint32_t v = data[i] << 16;
+        os << table[v >> 18 & 0x3f] << table[v >> 12 & 0x3f] << "==";
+    } else if (i + 2 == size) {
+        const uint32_t v = data[i] << 16 | data[i + 1] << 8;
+        os << table[v >> 18 & 0x3f] << table[v >> 12 & 0x3f] << table[v >> 6 & 0x3f] << '=';
+    }
+}
+
 RemoteSession::RemoteSession(sockaddr_in remote_address, int tcp_socket) : remote_address(remote_address), tcp_socket(tcp_socket) {
     remote_address.sin_port = 9999;
 }
@@ -91,6 +116,7 @@ void RemoteSession::init(AVCodecContext *audio_context, AVCodecContext *video_co
     std::sprintf(buffer, "rtp://%s:%d", inet_ntoa(remote_address.sin_addr), 10000);
     rtp_audio.init(buffer, audio_context);
     std::sprintf(buffer, "rtp://%s:%d", inet_ntoa(remote_address.sin_addr), 10002);
+    video_url = buffer;
     rtp_video.init(buffer, video_context);
 
     keyboard.init();
@@ -110,6 +136,19 @@ RTPVideoSender& RemoteSession::getRtpVideo() {
 
 }
 
+void RemoteSession::refreshVideo(const AVCodecContext *video_context) {
+    if (!initialized) {
+        return;
+    }
+
+    rtp_video.stop();
+    // new stream, frame offsets start over
+    acknowledged_pts = AV_NOPTS_VALUE;
+    rtp_video.init(video_url.c_str(), video_context);
+    rtp_video.start();
+    sendSdp(1, rtp_video.generateSdp());
+}
+
 void RemoteSession::start() {
     stop_condition = false;
     thread = std::thread(&RemoteSession::run, this);
@@ -215,6 +254,71 @@ void RemoteSession::write(const char *msg, size_t size) {
     writeImpl(msg, size);
 }
 
+void RemoteSession::writeDatagram(const char *msg, size_t size) {
+    datagram_lock.lock();
+    if (send(udp_socket, msg, size, 0) != static_cast<ssize_t>(size)) {
+        std::cout << "not all bytes was sent to " << inet_ntoa(remote_address.sin_addr) << ":" << remote_address.sin_port << std::endl;
+    }
+    datagram_lock.unlock();
+}
+
+void RemoteSession::handle(const CursorPosition *position) {
+    if (!initialized) {
+        return;
+    }
+
+    // shape goes through the reliable channel, before any position that refers to it
+    const CursorImage *shape = position->shape.get();
+    if (shape && sent_cursor_shapes.find(shape->serial) == sent_cursor_shapes.end()) {
+        // shapes too big for one message (large or hidpi cursors) are halved until they fit, the client scales them back
+        int scale = 1;
+        std::string msg;
+        do {
+            const int width = std::max(1, shape->width / scale);
+            const int height = std::max(1, shape->height / scale);
+            std::vector<uint8_t> pixels(4 * width * height);
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    const uint32_t pixel = shape->pixels[y * scale * shape->width + x * scale];
+                    uint8_t *out = &pixels[4 * (y * width + x)];
+                    out[0] = pixel & 0xff;
+                    out[1] = pixel >> 8 & 0xff;
+                    out[2] = pixel >> 16 & 0xff;
+                    out[3] = pixel >> 24 & 0xff;
+                }
+            }
+
+            std::stringstream ss;
+            ss << R"({"t":"C","s":)" << shape->serial << R"(,"w":)" << width << R"(,"h":)" << height
+               << R"(,"x":)" << shape->xhot / scale << R"(,"y":)" << shape->yhot / scale << R"(,"d":)" << scale << R"(,"p":")";
+            appendBase64(ss, pixels.data(), pixels.size());
+            ss << R"("})";
+            msg = ss.str();
+            scale *= 2;
+        } while (msg.size() > MAX_COMMAND_SIZE && (shape->width / scale > 0 || shape->height / scale > 0));
+
+        if (msg.size() <= MAX_COMMAND_SIZE) {
+            write(msg);
+            sent_cursor_shapes.insert(shape->serial);
+        } else {
+            std::cout << name << ": cursor shape " << shape->serial << " is too big to be sent" << std::endl;
+        }
+    }
+
+    char buffer[128];
+    const int size = std::snprintf(buffer, sizeof(buffer), R"({"t":"c","x":%d,"y":%d,"v":%d,"s":%lu})",
+                                   position->x, position->y, position->visible, shape ? shape->serial : 0);
+    writeDatagram(buffer, size);
+}
+
+void RemoteSession::sendSdp(int stream, const std::string &sdp) {
+    std::stringstream ss;
+    ss << R"({"t":"R","g":)" << stream << R"(,"k":0,"v":")";
+    appendJSONFormattedString(ss, sdp);
+    ss << R"("})";
+    write(ss.str());
+}
+
 void RemoteSession::handleCommands(uint8_t *buffer, size_t size, size_t capacity) {
     try {
         simdjson::ondemand::document document = parser.iterate(buffer, size, capacity);
@@ -224,24 +328,88 @@ void RemoteSession::handleCommands(uint8_t *buffer, size_t size, size_t capacity
             std::cout << "tcp keepalive from " << inet_ntoa(remote_address.sin_addr) << std::endl;
         } else if (type == "r") {
             const std::string_view query = document["q"];
-            // client ask a rtp endpoint
+            // client ask a rtp endpoint, optionally with the video codecs it decodes by preference,
+            // the server moves it to the first one offered and pushes the new sdp
+            simdjson::ondemand::array codecs;
+            if (query == "rtp" && document["c"].get_array().get(codecs) == simdjson::SUCCESS) {
+                for (auto codec : codecs) {
+                    const std::string_view codec_name = codec;
+                    const AVCodecDescriptor *descriptor = avcodec_descriptor_get_by_name(std::string(codec_name).c_str());
+                    if (descriptor && std::find(video_codecs.begin(), video_codecs.end(), descriptor->id) != video_codecs.end()) {
+                        wanted_codec = descriptor->id;
+                        break;
+                    }
+                }
+            }
             if (query == "rtp") {
-                std::stringstream ss;
-                ss << R"({"t":"R","g":0,"k":0,"v":")";
-                appendJSONFormattedString(ss, rtp_audio.generateSdp());
-                ss << R"("})";
-                write(ss.str());
-
-                ss.str(std::string());
-                ss.clear();
-                ss << R"({"t":"R","g":1,"k":0,"v":")";
-                appendJSONFormattedString(ss, rtp_video.generateSdp());
-                ss << R"("})";
-                write(ss.str());
+                sendSdp(0, rtp_audio.generateSdp());
+                sendSdp(1, rtp_video.generateSdp());
             }
         } else if (type == "n") {
             const int64_t val = document["v"].value();
-            forward(&val);
+            // -1 asks for a key frame, not a bitrate
+            if (val > 0) {
+                bandwidth = val;
+            }
+            Source<const int64_t>::forward(&val);
+        } else if (type == "e") {
+            // encoder parameters, each one optional: framerate, gop (refresh period with intra refresh), intra refresh,
+            // speed preset, and the resolution tier applied by the server
+            EncoderChanges changes;
+            for (auto field : document.get_object()) {
+                simdjson::ondemand::raw_json_string key = field.key();
+                if (key == "f") {
+                    int64_t framerate = field.value();
+                    if (framerate > 0 && framerate <= MAX_FRAMERATE) {
+                        if (max_framerate > 0 && framerate > max_framerate) {
+                            std::cout << name << ": framerate " << framerate << " above the capture rate, capped to " << max_framerate << std::endl;
+                            framerate = max_framerate;
+                        }
+                        changes["framerate"] = std::to_string(framerate);
+                    }
+                } else if (key == "g") {
+                    const int64_t gop_size = field.value();
+                    if (gop_size > 0 && gop_size <= MAX_GOP_SIZE) {
+                        changes["gop_size"] = std::to_string(gop_size);
+                    }
+                } else if (key == "i") {
+                    const int64_t intra_refresh = field.value();
+                    changes["intra_refresh"] = intra_refresh ? "1" : "0";
+                } else if (key == "p") {
+                    const std::string_view preset = field.value();
+                    if (!preset.empty() && preset.size() <= MAX_PRESET_SIZE &&
+                        std::all_of(preset.begin(), preset.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)); })) {
+                        changes["preset"] = std::string(preset);
+                    }
+                } else if (key == "r") {
+                    const int64_t tier = field.value();
+                    if (tier >= 0) {
+                        min_video_tier = tier;
+                    }
+                }
+            }
+            if (!changes.empty() && !owns_encoder) {
+                std::cout << name << ": encoder changes refused, the encoder is not its own" << std::endl;
+            } else if (!changes.empty()) {
+                Source<const EncoderChanges>::forward(&changes);
+            }
+        } else if (type == "a" || type == "l") {
+            // frame given by its rtp timestamp minus the one of the first frame received since the last sdp
+            const int64_t offset = document["v"].value();
+            const int64_t pts = rtp_video.toPts(offset);
+            if (pts == AV_NOPTS_VALUE) {
+                return;
+            }
+
+            // AV_NOPTS_VALUE is below any pts
+            int64_t acknowledged = acknowledged_pts;
+            if (type == "a") {
+                while (pts > acknowledged && !acknowledged_pts.compare_exchange_weak(acknowledged, pts)) {
+                }
+            } else if (pts > acknowledged) {
+                const FrameLoss loss = {pts};
+                Source<const FrameLoss>::forward(&loss);
+            }
         }
     } catch (const simdjson::simdjson_error &err) {
         std::cout << err.what() << std::endl;
@@ -317,9 +485,9 @@ void RemoteSession::handleInputs(uint8_t *buffer, size_t size, size_t capacity)
 void RemoteSession::writeImpl(const char *msg, size_t size) {
     uint8_t msg_header[3];
     msg_header[0] = 0xff;
-    for (size_t i = 0; i < sizeof(msg_header) - 1; i++){
-       msg_header[sizeof(msg_header) - 1 - i] = (size >> (8 * (sizeof(size) - i))) & 0xff;
-    }
+    // size in network byte order, as read by run()
+    msg_header[1] = (size >> 8) & 0xff;
+    msg_header[2] = size & 0xff;
 
     udp_socket_lock.lock();
     send(tcp_socket, msg_header, sizeof(msg_header), 0);
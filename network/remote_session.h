@@ -12,21 +12,32 @@ extern "C" {
 #include <netinet/in.h>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <vector>
 
 #include "../simdjson/singleheader/simdjson.h"
 
 #include "RTPAudioSender.h"
 #include "RTPVideoSender.h"
 #include "../Source.h"
+#include "../Sink.h"
+#include "../Encoder.h"
+#include "../video/CursorTracker.h"
 #include "../input/virtual_keyboard.h"
 #include "../input/virtual_mouse.h"
 #include "../input/virtual_gamepad.h"
 #include "../spinlock.h"
 
-class RemoteSession : public Source<const int64_t> {
+class VideoEncoder;
+
+// source of bitrate requests, frame losses and parameter changes for the video encoder
+class RemoteSession : public Source<const int64_t>, public Source<const FrameLoss>, public Source<const EncoderChanges>,
+                      public Sink<const CursorPosition> {
 public:
     std::string name;
-    bool initialized = false;
+    // set by the server thread, read by the cursor, encoder and command threads
+    std::atomic<bool> initialized = false;
 
     RTPAudioSender rtp_audio;
     RTPVideoSender rtp_video;
@@ -35,10 +46,12 @@ public:
     //std::unordered_map<int, VirtualGamepad> gamepads;
     VirtualGamepad gamepad;
 
+    std::string video_url;
     sockaddr_in remote_address;
     int tcp_socket;
     int udp_socket;
     spinlock udp_socket_lock;
+    spinlock datagram_lock;
     simdjson::ondemand::parser parser;
 
     bool stop_condition = true;
@@ -46,6 +59,29 @@ public:
 
     std::chrono::steady_clock::time_point last_update = std::chrono::steady_clock::now();
 
+    // last bitrate asked by the client (0 until the first request), and the simulcast tier it gets
+    std::atomic<int64_t> bandwidth = 0;
+    size_t video_tier = 0;
+    // best tier the client wants, it may ask for a lower resolution than its bandwidth allows
+    std::atomic<size_t> min_video_tier = 0;
+    // encoder of its bitrate group when the server runs one per group, instead of the shared one of the tier
+    VideoEncoder *video_group = nullptr;
+    // video codecs the server offers, set before start, and the first of them in the client preference order
+    std::vector<AVCodecID> video_codecs;
+    std::atomic<int> wanted_codec = AV_CODEC_ID_NONE;
+    // capture rate, set before start: no encoder gets more frames, a higher framerate asked is capped to it, 0 if unknown
+    int64_t max_framerate = 0;
+    // encoder of another codec at the main resolution, AV_CODEC_ID_NONE for the tiers one
+    int video_codec = AV_CODEC_ID_NONE;
+    // set by the server, parameter changes of the client are ignored otherwise
+    std::atomic<bool> owns_encoder = false;
+    // last frame the client decoded (pts), older losses are reports arriving late
+    // reset by the thread restarting rtp, updated by the session one
+    std::atomic<int64_t> acknowledged_pts = AV_NOPTS_VALUE;
+
+    // client keeps cursor shapes by serial, so each one is sent only once
+    std::unordered_set<unsigned long> sent_cursor_shapes;
+
 public:
     RemoteSession(sockaddr_in remote_address, int tcp_socket);
     ~RemoteSession();
@@ -53,6 +89,8 @@ public:
     void init(AVCodecContext *audio_context, AVCodecContext *video_context);
     RTPAudioSender& getRtpAudio();
     RTPVideoSender& getRtpVideo();
+    // video encoder was reopened, restart rtp with its new parameters and push the new sdp
+    void refreshVideo(const AVCodecContext *video_context);
 
     void start();
     void run();
@@ -62,8 +100,12 @@ public:
 
     void write(const std::string &msg);
     void write(const char *msg, size_t size);
+    void writeDatagram(const char *msg, size_t size);
+
+    void handle(const CursorPosition *position) override;
 
 private:
+    void sendSdp(int stream, const std::string &sdp);
     void handleCommands(uint8_t *buffer, size_t size, size_t capacity);
     void handleInputs(uint8_t *buffer, size_t size, size_t capacity);
 
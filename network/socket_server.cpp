@@ -2,21 +2,26 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <iostream>
+#include <algorithm>
 
 #include "socket_server.h"
 #include "../exception.h"
-#include "../video/H264Encoder.h"
 
 constexpr auto LOOKUP_DELAY = std::chrono::seconds(1);
 constexpr auto NOTIFY_DEADLINE_DELAY = std::chrono::seconds(15);
+// a session moves to a higher tier only with this much headroom (percent), so it does not flap
+constexpr int64_t TIER_UP_HEADROOM = 125;
 
-SocketServer::SocketServer(Encoder &audio_enc, Encoder &video_enc) : name("socket server"), audio_enc(audio_enc), video_enc(video_enc) {
-
+SocketServer::SocketServer(Encoder &audio_enc, VideoEncoder &video_enc, CursorTracker *cursor_tracker) : name("socket server"), audio_enc(audio_enc), cursor_tracker(cursor_tracker) {
+    addVideoTier(video_enc);
 }
 
 SocketServer::~SocketServer() {
     std::cout << name << ": next lines are triggered by ~SocketServer() call" << std::endl;
     stop();
+    for (auto& tier : video_tiers) {
+        tier.encoder->Source<const AVCodecContext>::detachSink(this);
+    }
     if (sockfd > 0) {
         close(sockfd);
         sockfd = -1;
@@ -27,10 +32,54 @@ SocketServer::~SocketServer() {
         std::cout << "purge session for " << (it->first & 0xFF) << '.' << (it->first >> 8 & 0xFF) << '.'
                   << (it->first >> 16 & 0xFF) << '.' << (it->first >> 24 & 0xFF) << std::endl;
         it->second.stop();
-        audio_enc.detachSink(&it->second.getRtpAudio());
-        video_enc.detachSink(&it->second.getRtpVideo());
+        detachSession(it->second);
         it = sessions.erase(it);
     }
+    releaseGroups();
+    if (encoder_scheduler) {
+        encoder_scheduler->setContextSink(nullptr);
+    }
+    for (auto& [codec, encoder] : codec_encoders) {
+        encoder->Source<const AVCodecContext>::detachSink(this);
+    }
+}
+
+void SocketServer::addVideoTier(VideoEncoder &video_enc) {
+    // nominal bitrate, the running one follows the clients requests
+    video_tiers.push_back({&video_enc, video_enc.getContext() ? video_enc.getContext()->bit_rate : 0});
+    video_enc.Source<const AVCodecContext>::attachSink(this);
+}
+
+void SocketServer::addVideoCodec(VideoEncoder &video_enc) {
+    const AVCodecContext *context = video_enc.getContext();
+    if (!context) {
+        std::cout << name << ": video encoder is not initialized, codec not offered" << std::endl;
+        return;
+    } else if (!RTPVideoSender::supports(context->codec_id)) {
+        std::cout << name << ": " << avcodec_get_name(context->codec_id) << " can not be sent over rtp, codec not offered" << std::endl;
+        return;
+    }
+    codec_encoders[context->codec_id] = &video_enc;
+    video_enc.Source<const AVCodecContext>::attachSink(this);
+}
+
+void SocketServer::parkWhenIdle(Grabber &grabber) {
+    idle_grabbers.push_back(&grabber);
+}
+
+void SocketServer::setEncoderScheduler(EncoderScheduler *scheduler) {
+    encoder_scheduler = scheduler;
+    if (encoder_scheduler) {
+        encoder_scheduler->setContextSink(this);
+    }
+}
+
+void SocketServer::setEncoderChangePolicy(EncoderChangePolicy policy) {
+    encoder_change_policy = policy;
+}
+
+void SocketServer::setCaptureRate(int framerate) {
+    capture_rate = framerate;
 }
 
 void SocketServer::init() {
@@ -68,6 +117,9 @@ void SocketServer::init() {
 void SocketServer::start() {
     if (initialized && stop_condition.load(std::memory_order_relaxed)) {
         stop_condition.store(false, std::memory_order_relaxed);
+        lock.lock();
+        updateIdle();
+        lock.unlock();
         listen_thread = std::thread(&SocketServer::listenSocket, this);
         purge_thread = std::thread(&SocketServer::purge, this);
     } else {
@@ -126,24 +178,35 @@ void SocketServer::listenSocket() {
                 << (it->first >> 8 & 0xFF) << '.' << (it->first >> 16 & 0xFF) << '.'
                 << (it->first >> 24 & 0xFF) << "), renew" << std::endl;
                 it->second.stop();
-                audio_enc.detachSink(&it->second.getRtpAudio());
-                video_enc.detachSink(&it->second.getRtpVideo());
+                detachSession(it->second);
                 sessions.erase(it);
             }
 
             auto res = sessions.emplace(std::piecewise_construct,
                                         std::forward_as_tuple(client_address.sin_addr.s_addr),
                                         std::forward_as_tuple(client_address, client_socket));
-            lock.unlock();
-            if (!res.second) {
-                continue;
+            if (res.second) {
+                // still under the lock: handle() and the purge thread only ever see a started and attached session
+                try {
+                    // bandwidth is unknown until the first client request, start with the best tier
+                    auto context_guard = video_tiers[0].encoder->readContext();
+                    res.first->second.video_codecs.push_back(video_tiers[0].encoder->getContext()->codec_id);
+                    for (const auto& [codec, encoder] : codec_encoders) {
+                        res.first->second.video_codecs.push_back(static_cast<AVCodecID>(codec));
+                    }
+                    res.first->second.max_framerate = capture_rate;
+                    res.first->second.init(audio_enc.getContext(), video_tiers[0].encoder->getContext());
+                    context_guard.unlock();
+                    res.first->second.start();
+                    attachSession(res.first->second);
+                } catch (const std::exception &e) {
+                    std::cout << name << ": " << e.what() << ", session dropped" << std::endl;
+                    sessions.erase(res.first);
+                }
             }
-
-            res.first->second.init(audio_enc.getContext(), video_enc.getContext());
-            res.first->second.start();
-            audio_enc.attachSink(&res.first->second.getRtpAudio());
-            video_enc.attachSink(&res.first->second.getRtpVideo());
-            res.first->second.attachSink(reinterpret_cast<H264Encoder*>(&video_enc));
+            updateIdle();
+            lock.unlock();
+            releaseGroups();
         }
     }
 }
@@ -153,6 +216,7 @@ void SocketServer::purge() {
     while (!stop_condition.load(std::memory_order_relaxed)) {
         std::this_thread::sleep_for(LOOKUP_DELAY);
         const auto current_time = std::chrono::steady_clock::now();
+        std::vector<std::pair<uint32_t, int64_t>> group_requests;
         lock.lock();
         auto it = sessions.begin();
         while (it != sessions.end()) {
@@ -160,13 +224,210 @@ void SocketServer::purge() {
                 std::cout << "purge session for " << (it->first & 0xFF) << '.' << (it->first >> 8 & 0xFF) << '.'
                           << (it->first >> 16 & 0xFF) << '.' << (it->first >> 24 & 0xFF) << std::endl;
                 it->second.stop();
-                audio_enc.detachSink(&it->second.getRtpAudio());
-                video_enc.detachSink(&it->second.getRtpVideo());
+                detachSession(it->second);
                 it = sessions.erase(it);
+                updateIdle();
+            } else if (switchCodec(it->second)) {
+                ++it;
             } else {
+                // never above the resolution the client asked for
+                const size_t tier = std::max(selectTier(it->second.video_tier, it->second.bandwidth),
+                                             std::min<size_t>(it->second.min_video_tier, video_tiers.size() - 1));
+                if (tier != it->second.video_tier) {
+                    switchTier(it->second, tier);
+                } else if (encoder_scheduler && tier == 0 && wantsGroup(it->second)) {
+                    group_requests.emplace_back(it->first, it->second.bandwidth);
+                }
                 ++it;
             }
         }
         lock.unlock();
+
+        // opening an encoder takes a while, and it notifies handle() which takes the lock
+        for (const auto& [address, bandwidth] : group_requests) {
+            switchGroup(address, bandwidth);
+        }
+        releaseGroups();
+    }
+}
+
+void SocketServer::handle(const AVCodecContext *video_context) {
+    lock.lock();
+    for (auto& [address, session] : sessions) {
+        // the other encoders may be reopened meanwhile
+        VideoEncoder &video_enc = sessionEncoder(session);
+        auto context_guard = video_enc.readContext();
+        const bool reopened = video_enc.getContext() == video_context;
+        context_guard.unlock();
+        if (reopened) {
+            session.refreshVideo(video_context);
+        }
+    }
+    lock.unlock();
+}
+
+void SocketServer::updateIdle() {
+    if (sessions.empty() == idle || idle_grabbers.empty()) {
+        return;
+    }
+
+    idle = sessions.empty();
+    for (Grabber *grabber : idle_grabbers) {
+        if (idle) {
+            grabber->pause();
+        } else {
+            grabber->resume();
+        }
+    }
+    std::cout << name << (idle ? ": no session, capture parked" : ": first session, capture resumed") << std::endl;
+}
+
+void SocketServer::attachSession(RemoteSession &session) {
+    VideoEncoder &video_enc = sessionEncoder(session);
+    audio_enc.Source<AVPacket>::attachSink(&session.getRtpAudio());
+    video_enc.Source<AVPacket>::attachSink(&session.getRtpVideo());
+    attachFeedback(session, video_enc);
+    if (cursor_tracker) {
+        cursor_tracker->attachSink(&session);
+    }
+
+    // as for a move, the client can not decode the stream before its next key frame, the encoder spaces them
+    video_enc.requestJoinKeyFrame();
+    updateEncoderOwners();
+}
+
+void SocketServer::detachSession(RemoteSession &session) {
+    VideoEncoder &video_enc = sessionEncoder(session);
+    audio_enc.Source<AVPacket>::detachSink(&session.getRtpAudio());
+    video_enc.Source<AVPacket>::detachSink(&session.getRtpVideo());
+    detachFeedback(session, video_enc);
+    if (cursor_tracker) {
+        cursor_tracker->detachSink(&session);
+    }
+    if (session.video_group) {
+        released_groups.push_back(session.video_group);
+        session.video_group = nullptr;
+    }
+    updateEncoderOwners();
+}
+
+void SocketServer::attachFeedback(RemoteSession &session, VideoEncoder &video_enc) {
+    session.Source<const int64_t>::attachSink(&video_enc);
+    session.Source<const FrameLoss>::attachSink(&video_enc);
+    session.Source<const EncoderChanges>::attachSink(&video_enc);
+}
+
+void SocketServer::detachFeedback(RemoteSession &session, VideoEncoder &video_enc) {
+    session.Source<const int64_t>::detachSink(&video_enc);
+    session.Source<const FrameLoss>::detachSink(&video_enc);
+    session.Source<const EncoderChanges>::detachSink(&video_enc);
+}
+
+void SocketServer::updateEncoderOwners() {
+    std::unordered_map<const VideoEncoder*, size_t> group_sessions;
+    for (const auto& [address, session] : sessions) {
+        if (session.video_group) {
+            ++group_sessions[session.video_group];
+        }
+    }
+    for (auto& [address, session] : sessions) {
+        session.owns_encoder = encoder_change_policy == EncoderChangePolicy::Any ||
+                               (encoder_change_policy == EncoderChangePolicy::OwnEncoder && session.video_group &&
+                                group_sessions[session.video_group] == 1);
+    }
+}
+
+VideoEncoder& SocketServer::sessionEncoder(const RemoteSession &session) const {
+    if (session.video_codec != AV_CODEC_ID_NONE) {
+        return *codec_encoders.at(session.video_codec);
+    }
+    return session.video_group ? *session.video_group : *video_tiers[session.video_tier].encoder;
+}
+
+size_t SocketServer::selectTier(size_t current, int64_t bandwidth) const {
+    if (bandwidth <= 0) {
+        return current;
+    }
+
+    for (size_t i = 0; i < video_tiers.size(); ++i) {
+        const int64_t needed = i < current ? video_tiers[i].bitrate * TIER_UP_HEADROOM / 100 : video_tiers[i].bitrate;
+        if (needed <= bandwidth) {
+            return i;
+        }
     }
+    return video_tiers.size() - 1;
+}
+
+void SocketServer::switchTier(RemoteSession &session, size_t tier) {
+    moveSession(session, tier, nullptr);
+}
+
+bool SocketServer::wantsGroup(const RemoteSession &session) {
+    const int64_t bandwidth = session.bandwidth;
+    return bandwidth > 0 && !(session.video_group && encoder_scheduler->fits(session.video_group, bandwidth));
+}
+
+void SocketServer::switchGroup(uint32_t address, int64_t bandwidth) {
+    // over budget, the session stays where it is, on its group or on the shared encoder
+    VideoEncoder *group = encoder_scheduler->acquire(bandwidth);
+    if (!group) {
+        return;
+    }
+
+    lock.lock();
+    // the session may have left, or moved to another tier or codec, while the lock was free
+    auto it = sessions.find(address);
+    if (it == sessions.end() || it->second.video_tier != 0 || it->second.video_codec != AV_CODEC_ID_NONE || group == it->second.video_group) {
+        released_groups.push_back(group);
+    } else {
+        moveSession(it->second, 0, group);
+    }
+    lock.unlock();
+}
+
+void SocketServer::releaseGroups() {
+    std::vector<VideoEncoder*> groups;
+    lock.lock();
+    groups.swap(released_groups);
+    lock.unlock();
+    for (VideoEncoder *group : groups) {
+        encoder_scheduler->release(group);
+    }
+}
+
+bool SocketServer::switchCodec(RemoteSession &session) {
+    // the tiers codec, or one the server does not run, keeps the session on the tiers
+    const int wanted = session.wanted_codec;
+    const int codec = codec_encoders.count(wanted) ? wanted : AV_CODEC_ID_NONE;
+    if (codec != session.video_codec) {
+        moveSession(session, 0, nullptr, codec);
+    }
+    return codec != AV_CODEC_ID_NONE;
+}
+
+void SocketServer::moveSession(RemoteSession &session, size_t tier, VideoEncoder *group, int codec) {
+    VideoEncoder &old_enc = sessionEncoder(session);
+    old_enc.Source<AVPacket>::detachSink(&session.getRtpVideo());
+    detachFeedback(session, old_enc);
+    if (session.video_group) {
+        // may stop the old encoder once the lock is free, it is not used past this point
+        released_groups.push_back(session.video_group);
+    }
+
+    session.video_tier = tier;
+    session.video_group = group;
+    session.video_codec = codec;
+    VideoEncoder &video_enc = sessionEncoder(session);
+    auto context_guard = video_enc.readContext();
+    std::cout << name << ": " << session.name << " moves to video tier " << tier << (group ? " on its own bitrate group" : "")
+              << " in " << avcodec_get_name(video_enc.getContext()->codec_id)
+              << " (" << video_enc.getContext()->width << "x" << video_enc.getContext()->height << ")" << std::endl;
+    session.refreshVideo(video_enc.getContext());
+    context_guard.unlock();
+    video_enc.Source<AVPacket>::attachSink(&session.getRtpVideo());
+    attachFeedback(session, video_enc);
+
+    // the client can not decode the new stream before its next key frame, the encoder spaces them
+    video_enc.requestJoinKeyFrame();
+    updateEncoderOwners();
 }
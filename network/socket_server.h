@@ -5,32 +5,83 @@
 #ifndef REMOTE_DESKTOP_SOCKET_SERVER_H
 #define REMOTE_DESKTOP_SOCKET_SERVER_H
 #include <unordered_map>
+#include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
 
 #include "../Encoder.h"
+#include "../Grabber.h"
+#include "../Sink.h"
+#include "../video/CursorTracker.h"
+#include "../video/VideoEncoder.h"
+#include "../video/EncoderScheduler.h"
 #include "remote_session.h"
-#include "../spinlock.h"
 
-class SocketServer {
+// sessions allowed to change the parameters of their video encoder with the "e" command,
+// a change reopens the encoder for every session on it
+enum class EncoderChangePolicy {
+    None,
+    // a session alone on its bitrate group encoder, the tiers and codec encoders keep the server configuration
+    OwnEncoder,
+    Any,
+};
+
+// listen to the video encoders to refresh sessions when they are reopened
+class SocketServer : public Sink<const AVCodecContext> {
+    // simulcast video stream, a session gets the best one its bandwidth allows
+    struct VideoTier {
+        VideoEncoder *encoder;
+        int64_t bitrate;
+    };
+
     std::string name;
     bool initialized = false;
 
     Encoder &audio_enc;
-    Encoder &video_enc;
+    // ordered from the highest bitrate down, first one is the encoder given to the constructor
+    std::vector<VideoTier> video_tiers;
+    CursorTracker *cursor_tracker;
+    // optional, sessions on the first tier get an encoder for their own bitrate group when set
+    EncoderScheduler *encoder_scheduler = nullptr;
+    // encoders of other codecs at the main resolution, by codec id, for the clients asking for them
+    std::unordered_map<int, VideoEncoder*> codec_encoders;
+    EncoderChangePolicy encoder_change_policy = EncoderChangePolicy::OwnEncoder;
+    // frames per second of the capture, given to the sessions, 0 if unknown
+    int capture_rate = 0;
 
     int sockfd = -1;
 
     std::unordered_map<uint32_t, RemoteSession> sessions;
-    spinlock lock;
+    // held through RTP restarts and command writes, a mutex so the other threads sleep meanwhile
+    std::mutex lock;
+    // group encoders left by their sessions, released once the lock is free: the last release stops the
+    // encoder, which waits for its threads, one of them may be waiting on the lock in handle()
+    std::vector<VideoEncoder*> released_groups;
+    // paused while there is no session, the chains behind them wait on their empty queues
+    std::vector<Grabber*> idle_grabbers;
+    bool idle = false;
 
     std::atomic<bool> stop_condition = true;
     std::thread listen_thread;
     std::thread purge_thread;
 
 public:
-    SocketServer(Encoder &audio_enc, Encoder &video_enc);
-    ~SocketServer();
+    SocketServer(Encoder &audio_enc, VideoEncoder &video_enc, CursorTracker *cursor_tracker=nullptr);
+    ~SocketServer() override;
+
+    // lower bitrate stream, add in decreasing order before start
+    void addVideoTier(VideoEncoder &video_enc);
+    // another codec offered to the clients, ignored when RTP can not packetize it, add before start
+    void addVideoCodec(VideoEncoder &video_enc);
+    // pause this grabber when the last session leaves and resume it on the next connection, add before start
+    void parkWhenIdle(Grabber &grabber);
+    // run sessions of the first tier on per bitrate group encoders, set before start
+    void setEncoderScheduler(EncoderScheduler *scheduler);
+    // set before start
+    void setEncoderChangePolicy(EncoderChangePolicy policy);
+    // framerate of the video grabber, the encoders never get more frames, set before start
+    void setCaptureRate(int framerate);
 
     void init();
 
@@ -39,6 +90,34 @@ public:
 
     void listenSocket();
     void purge();
+
+    void handle(const AVCodecContext *video_context) override;
+
+private:
+    // pause or resume the idle grabbers when the first session comes or the last one leaves, lock held
+    void updateIdle();
+    // lock held, the session is started
+    void attachSession(RemoteSession &session);
+    // lock held
+    void detachSession(RemoteSession &session);
+    // bitrate requests, frame losses and parameter changes of the session go to the encoder
+    void attachFeedback(RemoteSession &session, VideoEncoder &video_enc);
+    void detachFeedback(RemoteSession &session, VideoEncoder &video_enc);
+    VideoEncoder& sessionEncoder(const RemoteSession &session) const;
+    // which sessions may change their encoder after one joined or left an encoder, lock held
+    void updateEncoderOwners();
+    size_t selectTier(size_t current, int64_t bandwidth) const;
+    void switchTier(RemoteSession &session, size_t tier);
+    // whether the session would be better on another bitrate group, the group is acquired without the lock
+    bool wantsGroup(const RemoteSession &session);
+    void switchGroup(uint32_t address, int64_t bandwidth);
+    // releases the groups left meanwhile, lock not held
+    void releaseGroups();
+    // true when the session stays on the encoder of another codec, tiers and groups do not apply then
+    bool switchCodec(RemoteSession &session);
+    // video from another encoder, group is nullptr for the shared encoder of the tier,
+    // codec is AV_CODEC_ID_NONE for the tiers one
+    void moveSession(RemoteSession &session, size_t tier, VideoEncoder *group, int codec=AV_CODEC_ID_NONE);
 };
 
 
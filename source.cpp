@@ -9,11 +9,5 @@ void Source<AVFrame>::forward(AVFrame *frame) {
     lock.unlock();
 }
 
-template <>
-void Source<AVPacket>::forward(AVPacket *packet) {
-    lock.lock();
-    for (auto& sink : sinks) {
-        sink->handle(av_packet_clone(packet));
-    }
-    lock.unlock();
-}
\ No newline at end of file
+// packets use the generic forward: they are lent to the sinks for the duration of handle()
+// and the ones kept longer are copied into a PacketPool, which is cheaper than a clone per sink
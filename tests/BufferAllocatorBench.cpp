@@ -0,0 +1,110 @@
+// frame buffers with and without huge pages and node binding: cost of the first touch of a new buffer
+// and of the colour conversion into pooled buffers, 1080p YUV420P output
+// usage: buffer_allocator_bench [frames], run it bound to one node (numactl --cpunodebind) on multi node hosts
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <random>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../FramePool.h"
+#include "../BufferAllocator.h"
+#include "../video/ColorConverter.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+
+static AVFrame* poolFrame(FramePool &pool) {
+    AVFrame *frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = WIDTH;
+    frame->height = HEIGHT;
+    if (pool.get(frame) < 0) {
+        std::cerr << "could not allocate frame" << std::endl;
+        std::exit(2);
+    }
+    return frame;
+}
+
+static void run(const char *label, const MemoryPolicy &policy, const ColorConverter &converter, const AVFrame *source, int frames) {
+    FramePool pool(std::string("bench ") + label);
+    pool.setMemoryPolicy(policy);
+
+    // a new buffer each time, the page faults are the cost
+    const int fresh = 16;
+    std::vector<AVFrame*> held;
+    int64_t start = av_gettime_relative();
+    for (int i = 0; i < fresh; ++i) {
+        AVFrame *frame = poolFrame(pool);
+        converter.convert(source, frame);
+        held.push_back(frame);
+    }
+    const double first_touch = static_cast<double>(av_gettime_relative() - start) / fresh;
+    for (auto& frame : held) {
+        av_frame_free(&frame);
+    }
+
+    // steady state, buffers come back from the pool, three frames in flight as in the pipeline
+    std::vector<AVFrame*> in_flight;
+    start = av_gettime_relative();
+    for (int i = 0; i < frames; ++i) {
+        AVFrame *frame = poolFrame(pool);
+        converter.convert(source, frame);
+        in_flight.push_back(frame);
+        if (in_flight.size() == 3) {
+            av_frame_free(&in_flight.front());
+            in_flight.erase(in_flight.begin());
+        }
+    }
+    const double steady = static_cast<double>(av_gettime_relative() - start) / frames;
+    for (auto& frame : in_flight) {
+        av_frame_free(&frame);
+    }
+
+    std::cout << std::setw(24) << label << ": first touch " << std::fixed << std::setprecision(0) << first_touch
+              << " us/frame, pooled " << steady << " us/frame" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 500;
+    const int node = BufferAllocator::currentNode();
+
+    AVFrame *source = av_frame_alloc();
+    source->format = AV_PIX_FMT_BGR0;
+    source->width = WIDTH;
+    source->height = HEIGHT;
+    if (av_frame_get_buffer(source, 64) < 0) {
+        std::cerr << "could not allocate frame" << std::endl;
+        return 2;
+    }
+    std::mt19937 random(1);
+    for (int j = 0; j < HEIGHT; ++j) {
+        for (int i = 0; i < WIDTH; ++i) {
+            const uint32_t pixel = random();
+            std::memcpy(source->data[0] + j * source->linesize[0] + 4 * i, &pixel, 4);
+        }
+    }
+
+    ColorConverter converter;
+    converter.init(AV_PIX_FMT_YUV420P, AVCOL_SPC_UNSPECIFIED, AVCOL_RANGE_UNSPECIFIED);
+
+    std::cout << WIDTH << "x" << HEIGHT << ", " << converter.getKernelName() << " conversion, node " << node << std::endl;
+    run("normal", {MemoryPolicy::Pages::Normal, -1}, converter, source, frames);
+    run("normal, bound", {MemoryPolicy::Pages::Normal, node}, converter, source, frames);
+    run("transparent", {MemoryPolicy::Pages::Transparent, -1}, converter, source, frames);
+    run("transparent, bound", {MemoryPolicy::Pages::Transparent, node}, converter, source, frames);
+    run("explicit", {MemoryPolicy::Pages::Explicit, -1}, converter, source, frames);
+    run("explicit, bound", {MemoryPolicy::Pages::Explicit, node}, converter, source, frames);
+    std::cout << "huge page mappings " << Metrics::counter("buffer allocator: huge page mappings").load()
+              << ", fallbacks " << Metrics::counter("buffer allocator: huge page fallbacks").load() << std::endl;
+
+    av_frame_free(&source);
+    return 0;
+}
@@ -0,0 +1,197 @@
+// bitrate against quality against cpu of the three software encoders with their low latency defaults, 720p60
+// paced in real time on the synthetic source: the bitrate reached, the psnr of the decoded frames against
+// the source ones, and the process cpu time while encoding in cores
+// usage: codec_bench [seconds] [bitrates in kbps, comma separated]
+
+#include <time.h>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "../video/HEVCEncoder.h"
+#include "../video/AV1Encoder.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1280;
+constexpr int HEIGHT = 720;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+
+// packets and their capture times, decoded once the run is over
+class Stream : public Sink<AVPacket>, public Sink<const FrameStats> {
+public:
+    std::vector<AVPacket*> packets;
+    std::unordered_map<int64_t, int64_t> capture_times;
+    int64_t bytes = 0;
+
+    ~Stream() override {
+        for (auto &packet : packets) {
+            av_packet_free(&packet);
+        }
+    }
+
+    // lent for the call only
+    void handle(AVPacket *packet) override {
+        packets.push_back(av_packet_clone(packet));
+        bytes += packet->size;
+    }
+
+    void handle(const FrameStats *stats) override {
+        capture_times[stats->pts] = stats->capture_time;
+    }
+};
+
+static int64_t processCpuMicroseconds() {
+    timespec time = {};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return static_cast<int64_t>(time.tv_sec) * 1'000'000 + time.tv_nsec / 1000;
+}
+
+static double squaredError(const AVFrame *a, const AVFrame *b, int plane, int width, int height) {
+    double error = 0;
+    for (int j = 0; j < height; ++j) {
+        const uint8_t *line_a = a->data[plane] + j * a->linesize[plane];
+        const uint8_t *line_b = b->data[plane] + j * b->linesize[plane];
+        for (int i = 0; i < width; ++i) {
+            const int d = line_a[i] - line_b[i];
+            error += d * d;
+        }
+    }
+    return error;
+}
+
+// mean psnr over the decoded frames, each one against the source frame of its capture time, 0 without a decoder
+static double psnr(const Stream &stream, AVCodecID codec_id, const std::unordered_map<int64_t, int> &indexes) {
+    AVCodec *codec = avcodec_find_decoder(codec_id);
+    AVCodecContext *ctx = codec ? avcodec_alloc_context3(codec) : nullptr;
+    if (!ctx || avcodec_open2(ctx, codec, nullptr) < 0) {
+        avcodec_free_context(&ctx);
+        return 0;
+    }
+    AVFrame *decoded = av_frame_alloc();
+    AVFrame *source = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    double total = 0;
+    int frames = 0;
+    auto receive = [&] {
+        while (avcodec_receive_frame(ctx, decoded) >= 0) {
+            const auto capture = stream.capture_times.find(decoded->best_effort_timestamp);
+            const auto index = capture == stream.capture_times.end() ? indexes.end() : indexes.find(capture->second);
+            if (index != indexes.end() && decoded->format == AV_PIX_FMT_YUV420P && decoded->width == WIDTH && decoded->height == HEIGHT) {
+                drawMovingBand(source, index->second);
+                const double error = squaredError(source, decoded, 0, WIDTH, HEIGHT) +
+                                     squaredError(source, decoded, 1, WIDTH / 2, HEIGHT / 2) +
+                                     squaredError(source, decoded, 2, WIDTH / 2, HEIGHT / 2);
+                const double mse = error / (WIDTH * HEIGHT * 3 / 2);
+                total += mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 100;
+                ++frames;
+            }
+            av_frame_unref(decoded);
+        }
+    };
+    for (AVPacket *packet : stream.packets) {
+        if (avcodec_send_packet(ctx, packet) >= 0) {
+            receive();
+        }
+    }
+    avcodec_send_packet(ctx, nullptr);
+    receive();
+
+    av_frame_free(&source);
+    av_frame_free(&decoded);
+    avcodec_free_context(&ctx);
+    return frames ? total / frames : 0;
+}
+
+static void run(const char *codec, int64_t bitrate, int seconds) {
+    std::unique_ptr<VideoEncoder> encoder;
+    AVCodecID codec_id;
+    const std::string name = std::string(codec) + " bench " + std::to_string(bitrate / 1000) + "kbps";
+    if (std::string(codec) == "h264") {
+        encoder = std::make_unique<H264Encoder>(false, name);
+        codec_id = AV_CODEC_ID_H264;
+    } else if (std::string(codec) == "hevc") {
+        encoder = std::make_unique<HEVCEncoder>(false, name);
+        codec_id = AV_CODEC_ID_HEVC;
+    } else {
+        encoder = std::make_unique<AV1Encoder>(name);
+        codec_id = AV_CODEC_ID_AV1;
+    }
+    try {
+        encoder->init({
+                {"bitrate", std::to_string(bitrate)},
+                {"width", std::to_string(WIDTH)},
+                {"height", std::to_string(HEIGHT)},
+                {"framerate", "60"},
+                {"gop_size", "120"},
+                {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+        });
+    } catch (const std::exception &e) {
+        std::cout << std::setw(6) << codec << " " << std::setw(6) << bitrate / 1000 << "kbps: not available, " << e.what() << std::endl;
+        return;
+    }
+    Stream stream;
+    encoder->Source<AVPacket>::attachSink(&stream);
+    encoder->Source<const FrameStats>::attachSink(&stream);
+    encoder->start();
+
+    // capture time of each source frame, the decoded ones are compared to the frame drawn at its index
+    std::unordered_map<int64_t, int> indexes;
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    const int64_t cpu_start = processCpuMicroseconds();
+    const int64_t start = av_gettime_relative();
+    int64_t next = start;
+    for (int i = 0; i < seconds * 60; ++i) {
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        indexes[frame->pts] = i;
+        encoder->handle(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    encoder->stop();
+    const double cores = static_cast<double>(processCpuMicroseconds() - cpu_start) / (av_gettime_relative() - start);
+    encoder->Source<AVPacket>::detachSink(&stream);
+    encoder->Source<const FrameStats>::detachSink(&stream);
+    av_frame_free(&picture);
+
+    const double quality = psnr(stream, codec_id, indexes);
+    std::cout << std::setw(6) << codec << " " << std::setw(6) << bitrate / 1000 << "kbps: " << std::setw(6) << stream.bytes * 8 / seconds / 1000
+              << "kbps out, " << stream.packets.size() << " frames, psnr " << std::fixed << std::setprecision(2) << quality
+              << " dB" << (quality == 0 ? " (no decoder)" : "") << ", cpu " << std::setprecision(2) << cores << " cores" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const int seconds = argc > 1 ? std::atoi(argv[1]) : 10;
+    std::vector<int64_t> bitrates;
+    std::stringstream list(argc > 2 ? argv[2] : "1000,2000,4000");
+    for (std::string kbps; std::getline(list, kbps, ',');) {
+        bitrates.push_back(std::stoll(kbps) * 1000);
+    }
+
+    std::cout << WIDTH << "x" << HEIGHT << " 60 fps, low latency defaults, " << seconds << "s per run" << std::endl;
+    for (const char *codec : {"h264", "hevc", "av1"}) {
+        for (int64_t bitrate : bitrates) {
+            run(codec, bitrate, seconds);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// BGR0 to YUV420P conversion time per frame for each kernel the cpu supports and for swscale,
+// at 1080p and 1440p on a single thread
+// usage: color_converter_bench [frames]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <functional>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/ColorConverter.h"
+#include "test_utils.h"
+
+static void report(const char *name, int frames, const std::function<void()> &convert) {
+    // one untimed run to fault in the buffers
+    convert();
+    const int64_t start = av_gettime();
+    for (int i = 0; i < frames; ++i) {
+        convert();
+    }
+    const double per_frame = static_cast<double>(av_gettime() - start) / frames;
+    std::cout << "    " << std::setw(8) << name << ": " << std::fixed << std::setprecision(0) << per_frame << " us/frame" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 200;
+    __builtin_cpu_init();
+
+    ColorConverter converter;
+    converter.init(AV_PIX_FMT_YUV420P, AVCOL_SPC_UNSPECIFIED, AVCOL_RANGE_UNSPECIFIED);
+    const ColorConverter::Coefficients &c = converter.getCoefficients();
+
+    const int sizes[][2] = {{1920, 1080}, {2560, 1440}};
+    for (const auto &size : sizes) {
+        const int width = size[0];
+        const int height = size[1];
+        AVFrame *source = allocFrame(AV_PIX_FMT_BGR0, width, height);
+        AVFrame *sink = allocFrame(AV_PIX_FMT_YUV420P, width, height);
+        std::mt19937 random(1);
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                const uint32_t pixel = random();
+                std::memcpy(source->data[0] + j * source->linesize[0] + 4 * i, &pixel, 4);
+            }
+        }
+        uint8_t *const dst[3] = {sink->data[0], sink->data[1], sink->data[2]};
+        const int dst_stride[3] = {sink->linesize[0], sink->linesize[1], sink->linesize[2]};
+
+        std::cout << width << "x" << height << ", " << frames << " frames" << std::endl;
+        report("scalar", frames, [&] {
+            ColorConverter::convertScalar(c, false, source->data[0], source->linesize[0], dst, dst_stride, width, height);
+        });
+        if (__builtin_cpu_supports("sse4.1")) {
+            report("sse4.1", frames, [&] {
+                ColorConverter::convertSSE41(c, false, source->data[0], source->linesize[0], dst, dst_stride, width, height);
+            });
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            report("avx2", frames, [&] {
+                ColorConverter::convertAVX2(c, false, source->data[0], source->linesize[0], dst, dst_stride, width, height);
+            });
+        }
+        // the flags FrameConverter used before the kernels
+        SwsContext *sws = sws_getContext(width, height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_YUV420P,
+                                         SWS_AREA, nullptr, nullptr, nullptr);
+        report("swscale", frames, [&] {
+            sws_scale(sws, source->data, source->linesize, 0, height, sink->data, sink->linesize);
+        });
+        sws_freeContext(sws);
+        av_frame_free(&sink);
+        av_frame_free(&source);
+    }
+    return 0;
+}
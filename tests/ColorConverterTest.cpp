@@ -0,0 +1,189 @@
+// BGR0 to YUV420P/NV12 kernels: the SIMD ones must match the scalar one bit for bit, all must stay
+// within 1 of a floating point reference and close to swscale (same formula, different rounding)
+// usage: color_converter_test, returns non zero on failure
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <string>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/frame.h>
+};
+
+#include "../video/ColorConverter.h"
+#include "test_utils.h"
+
+using Kernel = void (*)(const ColorConverter::Coefficients &, bool, const uint8_t *, int, uint8_t *const [3], const int [3], int, int);
+
+struct NamedKernel {
+    const char *name;
+    Kernel kernel;
+    bool available;
+};
+
+// one more pixel than needed on each row so the source can start unaligned
+static AVFrame* sourceFrame(int width, int height, bool noise) {
+    AVFrame *frame = allocFrame(AV_PIX_FMT_BGR0, width + 1, height);
+    std::mt19937 random(width * 31 + height);
+    for (int j = 0; j < height; ++j) {
+        uint8_t *row = frame->data[0] + j * frame->linesize[0];
+        for (int i = 0; i < width + 1; ++i) {
+            uint8_t *p = row + 4 * i;
+            if (noise) {
+                const uint32_t r = random();
+                std::memcpy(p, &r, 4);
+            } else {
+                // smooth gradients with a few hard edges, as a desktop has
+                p[0] = static_cast<uint8_t>(i * 255 / width);
+                p[1] = static_cast<uint8_t>(j * 255 / height);
+                p[2] = (i / 64 + j / 64) % 2 ? 230 : 20;
+                p[3] = 0;
+            }
+        }
+    }
+    return frame;
+}
+
+static void runKernel(Kernel kernel, const ColorConverter::Coefficients &c, bool nv12, const AVFrame *source, int offset, AVFrame *sink, int width, int height) {
+    uint8_t *const dst[3] = {sink->data[0], sink->data[1], nv12 ? nullptr : sink->data[2]};
+    const int dst_stride[3] = {sink->linesize[0], sink->linesize[1], nv12 ? 0 : sink->linesize[2]};
+    kernel(c, nv12, source->data[0] + 4 * offset, source->linesize[0], dst, dst_stride, width, height);
+}
+
+static bool samePlanes(const AVFrame *a, const AVFrame *b, bool nv12, int width, int height) {
+    const int chroma_width = nv12 ? (width + 1) / 2 * 2 : (width + 1) / 2;
+    const int widths[3] = {width, chroma_width, chroma_width};
+    const int heights[3] = {height, (height + 1) / 2, (height + 1) / 2};
+    for (int plane = 0; plane < (nv12 ? 2 : 3); ++plane) {
+        for (int j = 0; j < heights[plane]; ++j) {
+            if (std::memcmp(a->data[plane] + j * a->linesize[plane], b->data[plane] + j * b->linesize[plane], widths[plane]) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// BT.601 limited range in floating point, chroma from the 2x2 block average
+static int referenceError(const AVFrame *source, const AVFrame *sink, int width, int height) {
+    const double kr = 0.299, kb = 0.114, kg = 1. - kr - kb;
+    const auto pixel = [&](int i, int j) {
+        return source->data[0] + std::min(j, height - 1) * source->linesize[0] + 4 * std::min(i, width - 1);
+    };
+    int max_error = 0;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const uint8_t *p = pixel(i, j);
+            const double y = 16. + 219. / 255. * (kr * p[2] + kg * p[1] + kb * p[0]);
+            max_error = std::max(max_error, std::abs(sink->data[0][j * sink->linesize[0] + i] - static_cast<int>(std::lround(y))));
+        }
+    }
+    for (int j = 0; j < height; j += 2) {
+        for (int i = 0; i < width; i += 2) {
+            double b = 0, g = 0, r = 0;
+            for (int k = 0; k < 4; ++k) {
+                const uint8_t *p = pixel(i + k % 2, j + k / 2);
+                b += p[0] / 4.;
+                g += p[1] / 4.;
+                r += p[2] / 4.;
+            }
+            const double luma = kr * r + kg * g + kb * b;
+            const double u = 128. + 224. / 255. * (b - luma) / (2. * (1. - kb));
+            const double v = 128. + 224. / 255. * (r - luma) / (2. * (1. - kr));
+            const uint8_t cu = sink->data[1][j / 2 * sink->linesize[1] + i / 2];
+            const uint8_t cv = sink->data[2][j / 2 * sink->linesize[2] + i / 2];
+            max_error = std::max(max_error, std::abs(cu - static_cast<int>(std::lround(std::clamp(u, 0., 255.)))));
+            max_error = std::max(max_error, std::abs(cv - static_cast<int>(std::lround(std::clamp(v, 0., 255.)))));
+        }
+    }
+    return max_error;
+}
+
+static double psnr(const AVFrame *a, const AVFrame *b, int plane, int width, int height) {
+    double sum = 0;
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const int d = a->data[plane][j * a->linesize[plane] + i] - b->data[plane][j * b->linesize[plane] + i];
+            sum += d * d;
+        }
+    }
+    const double mse = sum / (static_cast<double>(width) * height);
+    return mse == 0 ? 99. : 10. * std::log10(255. * 255. / mse);
+}
+
+int main() {
+    __builtin_cpu_init();
+    const NamedKernel kernels[] = {
+            {"scalar", ColorConverter::convertScalar, true},
+            {"sse4.1", ColorConverter::convertSSE41, __builtin_cpu_supports("sse4.1") != 0},
+            {"avx2", ColorConverter::convertAVX2, __builtin_cpu_supports("avx2") != 0},
+    };
+
+    ColorConverter converter;
+    converter.init(AV_PIX_FMT_YUV420P, AVCOL_SPC_UNSPECIFIED, AVCOL_RANGE_UNSPECIFIED);
+    const ColorConverter::Coefficients &c = converter.getCoefficients();
+
+    // odd sizes and sizes that are not a multiple of the vector width exercise the tails
+    const int sizes[][2] = {{1920, 1080}, {2560, 1440}, {1921, 1081}, {33, 7}, {17, 18}, {2, 2}, {1, 1}};
+    for (const auto &size : sizes) {
+        const int width = size[0];
+        const int height = size[1];
+        AVFrame *source = sourceFrame(width, height, true);
+        for (bool nv12 : {false, true}) {
+            const AVPixelFormat format = nv12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+            // an offset of one pixel makes the source rows unaligned
+            for (int offset : {0, 1}) {
+                const std::string label = std::string(nv12 ? " nv12 " : " yuv420p ") + std::to_string(width) + "x" + std::to_string(height) +
+                                          (offset ? " unaligned" : "");
+                AVFrame *expected = allocFrame(format, width, height);
+                runKernel(kernels[0].kernel, c, nv12, source, offset, expected, width, height);
+                if (!nv12 && offset == 0) {
+                    const int error = referenceError(source, expected, width, height);
+                    check(error <= 1, "scalar" + label + " is " + std::to_string(error) + " off the reference");
+                }
+                for (const NamedKernel &k : kernels) {
+                    if (!k.available) {
+                        continue;
+                    }
+                    AVFrame *sink = allocFrame(format, width, height);
+                    runKernel(k.kernel, c, nv12, source, offset, sink, width, height);
+                    check(samePlanes(expected, sink, nv12, width, height), k.name + label + " differs from scalar");
+                    av_frame_free(&sink);
+                }
+                av_frame_free(&expected);
+            }
+        }
+        av_frame_free(&source);
+    }
+
+    // swscale on a desktop like picture, not bit exact: it rounds in other places and filters the chroma
+    const int width = 1920;
+    const int height = 1080;
+    AVFrame *source = sourceFrame(width, height, false);
+    AVFrame *ours = allocFrame(AV_PIX_FMT_YUV420P, width, height);
+    AVFrame *theirs = allocFrame(AV_PIX_FMT_YUV420P, width, height);
+    converter.convert(source, ours, 0, 0, width, height);
+    SwsContext *sws = sws_getContext(width, height, AV_PIX_FMT_BGR0, width, height, AV_PIX_FMT_YUV420P,
+                                     SWS_BILINEAR | SWS_ACCURATE_RND, nullptr, nullptr, nullptr);
+    sws_scale(sws, source->data, source->linesize, 0, height, theirs->data, theirs->linesize);
+    const double planes[3] = {
+            psnr(ours, theirs, 0, width, height),
+            psnr(ours, theirs, 1, width / 2, height / 2),
+            psnr(ours, theirs, 2, width / 2, height / 2),
+    };
+    std::cout << converter.getKernelName() << " against swscale: psnr y " << planes[0] << " u " << planes[1] << " v " << planes[2] << " dB" << std::endl;
+    check(planes[0] >= 45., "luma psnr against swscale");
+    check(planes[1] >= 38. && planes[2] >= 38., "chroma psnr against swscale");
+    sws_freeContext(sws);
+    av_frame_free(&theirs);
+    av_frame_free(&ours);
+    av_frame_free(&source);
+
+    return testResult();
+}
@@ -0,0 +1,166 @@
+// wake-ups of the drain per frame and submit to packet latency, x264 at 720p60 paced in real time:
+// the encoder drain thread (eventfd), inline draining, and the condition variable design it replaced,
+// whose predicate called the codec on every wake-up
+// usage: drain_bench [frames]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/opt.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1280;
+constexpr int HEIGHT = 720;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+
+// frames at 60 fps, the callback sends one to the codec
+template<class Send>
+static void feed(int frames, Send send) {
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < frames; ++i) {
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        send(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    av_frame_free(&picture);
+}
+
+static void print(const char *label, double wakeups, const Histogram &latency) {
+    std::cout << std::setw(10) << label << ": " << std::fixed << std::setprecision(2) << wakeups << " wake-ups/frame, submit to packet (us) ";
+    latency.print(std::cout);
+    std::cout << std::endl;
+}
+
+static void runEncoder(bool inline_drain, int frames) {
+    const std::string name = inline_drain ? "inline drain bench" : "thread drain bench";
+    H264Encoder encoder(false, name);
+    encoder.init({
+            {"bitrate", "8000000"},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    });
+    if (inline_drain) {
+        encoder.setInlineDrain(true);
+    } else {
+        encoder.startDrain();
+    }
+    // no feed thread, frames are sent to the codec by this thread
+    feed(frames, [&encoder](AVFrame *frame) {
+        encoder.handle(frame);
+    });
+    encoder.stop();
+
+    const double wakeups = static_cast<double>(Metrics::counter(name + ": drain wakeups").load()) / frames;
+    print(inline_drain ? "inline" : "eventfd", wakeups, Metrics::histogram(name + ": encode time (us)"));
+}
+
+// the drain before the eventfd: a condition variable notified after each frame sent,
+// its predicate receiving from the codec, under the encoder lock, on every wake-up: each one is a codec call
+static void runConditionVariable(int frames) {
+    AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    ctx->width = WIDTH;
+    ctx->height = HEIGHT;
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    ctx->time_base = {1, 1'000'000};
+    ctx->framerate = {60, 1};
+    ctx->bit_rate = 8'000'000;
+    ctx->gop_size = 120;
+    av_opt_set(ctx->priv_data, "preset", "veryfast", 0);
+    av_opt_set(ctx->priv_data, "tune", "zerolatency", 0);
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        std::cerr << "could not open libx264" << std::endl;
+        std::exit(2);
+    }
+
+    std::mutex drain_mutex;
+    std::condition_variable encoder_cv;
+    spinlock encoder_lock;
+    bool stop = false;
+    uint64_t wakeups = 0;
+    Histogram &latency = Metrics::histogram("condition variable drain bench: encode time (us)");
+
+    std::thread drain([&] {
+        AVPacket *packet = av_packet_alloc();
+        std::unique_lock<std::mutex> mlock(drain_mutex);
+        while (!stop) {
+            encoder_lock.lock();
+            int ret = avcodec_receive_packet(ctx, packet);
+            encoder_lock.unlock();
+            if (ret == AVERROR(EAGAIN)) {
+                encoder_cv.wait(mlock, [&] {
+                    ++wakeups;
+                    if (stop) {
+                        return true;
+                    }
+                    encoder_lock.lock();
+                    ret = avcodec_receive_packet(ctx, packet);
+                    encoder_lock.unlock();
+                    return ret != AVERROR(EAGAIN);
+                });
+            }
+            if (ret >= 0) {
+                // pts are the submit times
+                latency.record(av_gettime() - packet->pts);
+                av_packet_unref(packet);
+            } else if (!stop) {
+                break;
+            }
+        }
+        av_packet_free(&packet);
+    });
+
+    feed(frames, [&](AVFrame *frame) {
+        frame->pts = av_gettime();
+        encoder_lock.lock();
+        avcodec_send_frame(ctx, frame);
+        encoder_lock.unlock();
+        av_frame_free(&frame);
+        encoder_cv.notify_one();
+    });
+    {
+        std::lock_guard<std::mutex> guard(drain_mutex);
+        stop = true;
+    }
+    encoder_cv.notify_one();
+    drain.join();
+    avcodec_free_context(&ctx);
+
+    print("condvar", static_cast<double>(wakeups) / frames, latency);
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 1200;
+    std::cout << frames << " frames at " << WIDTH << "x" << HEIGHT << " 60 fps, x264 veryfast zerolatency" << std::endl;
+    runConditionVariable(frames);
+    runEncoder(false, frames);
+    runEncoder(true, frames);
+    return 0;
+}
@@ -0,0 +1,206 @@
+// FrameConverter latency and throughput, BGR0 to YUV420P at 1080p and 1440p, frame against slice parallelism
+// on 1 to N threads: latency paced at 60 fps, from handle() to the converted frame, and throughput with
+// the queue kept full; then partial conversion against whole frames on typical desktop updates at 1080p
+// usage: frame_converter_bench [frames] [max threads]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/FrameConverter.h"
+#include "test_utils.h"
+
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+
+// converted frames, their latency from the submit time carried in pts
+class Output : public Sink<AVFrame> {
+public:
+    Histogram &latency;
+    std::atomic<int64_t> received = 0;
+
+    explicit Output(const std::string &name) : latency(Metrics::histogram(name + ": latency (us)")) {
+
+    }
+
+    void handle(AVFrame *frame) override {
+        latency.record(av_gettime() - frame->pts);
+        received.fetch_add(1, std::memory_order_release);
+        av_frame_free(&frame);
+    }
+};
+
+static AVFrame* noisePicture(int width, int height) {
+    AVFrame *picture = allocFrame(AV_PIX_FMT_BGR0, width, height);
+    std::mt19937 random(width + height);
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            const uint32_t pixel = random();
+            std::memcpy(picture->data[0] + j * picture->linesize[0] + 4 * i, &pixel, 4);
+        }
+    }
+    return picture;
+}
+
+static void waitReceived(const Output &output, int64_t count) {
+    while (output.received.load(std::memory_order_acquire) < count) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+}
+
+static void run(int width, int height, int threads, FrameConverter::Parallelism parallelism, int frames) {
+    const bool slice = parallelism == FrameConverter::Parallelism::Slice;
+    const std::string name = "converter bench " + std::to_string(height) + "p " + (slice ? "slice " : "frame ") + std::to_string(threads);
+    AVCodecContext *source_ctx = avcodec_alloc_context3(nullptr);
+    AVCodecContext *sink_ctx = avcodec_alloc_context3(nullptr);
+    source_ctx->width = sink_ctx->width = width;
+    source_ctx->height = sink_ctx->height = height;
+    source_ctx->pix_fmt = AV_PIX_FMT_BGR0;
+    sink_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+
+    FrameConverter converter;
+    Output output(name);
+    converter.init(source_ctx, sink_ctx, threads, parallelism);
+    converter.attachSink(&output);
+    converter.start();
+    AVFrame *picture = noisePicture(width, height);
+
+    // one frame at a time, at 60 fps, nothing waits in the queue
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < frames; ++i) {
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        converter.handle(frame);
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    waitReceived(output, frames);
+    const double mean = output.latency.getMean();
+    const int64_t p99 = output.latency.getPercentile(99);
+
+    // frames back to back, no more in flight than the converter queue holds or the last ones would be dropped
+    const int in_flight = std::min(threads + 1, 4);
+    const int64_t start = av_gettime();
+    for (int i = 0; i < frames; ++i) {
+        waitReceived(output, frames + i - in_flight + 1);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        converter.handle(frame);
+    }
+    waitReceived(output, 2 * frames);
+    const double throughput = frames * 1'000'000.0 / (av_gettime() - start);
+
+    converter.stop();
+    converter.detachSink(&output);
+    av_frame_free(&picture);
+    avcodec_free_context(&source_ctx);
+    avcodec_free_context(&sink_ctx);
+
+    std::cout << "    " << (slice ? "slice" : "frame") << " x" << threads << ": latency mean " << std::fixed << std::setprecision(0)
+              << mean << " us, p99 " << p99 << " us, throughput " << std::setprecision(1) << throughput << " fps" << std::endl;
+}
+
+// a changing rectangle of the given size moving over a still picture, a fresh buffer each frame as from the grabber
+static void runPartial(const char *update, int update_width, int update_height, FrameConverter::Parallelism parallelism, int threads, int frames) {
+    constexpr int width = 1920;
+    constexpr int height = 1080;
+    AVCodecContext *source_ctx = avcodec_alloc_context3(nullptr);
+    AVCodecContext *sink_ctx = avcodec_alloc_context3(nullptr);
+    source_ctx->width = sink_ctx->width = width;
+    source_ctx->height = sink_ctx->height = height;
+    source_ctx->pix_fmt = AV_PIX_FMT_BGR0;
+    sink_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+
+    Histogram &conversion_time = Metrics::histogram("video frame converter: conversion (us)");
+    std::atomic<uint64_t> &converted_tiles = Metrics::counter("video frame converter: converted tiles");
+    std::atomic<uint64_t> &reused_tiles = Metrics::counter("video frame converter: reused tiles");
+    AVFrame *picture = noisePicture(width, height);
+    std::mt19937 random(update_width + update_height);
+    std::cout << "    " << update << " " << update_width << "x" << update_height << std::endl;
+    for (bool partial : {false, true}) {
+        FrameConverter converter;
+        Output output(std::string("partial bench ") + update + (partial ? " partial" : " whole"));
+        converter.init(source_ctx, sink_ctx, threads, parallelism, partial);
+        converter.attachSink(&output);
+        converter.start();
+        conversion_time.reset();
+        const uint64_t converted_before = converted_tiles.load();
+        const uint64_t reused_before = reused_tiles.load();
+
+        for (int i = 0; i < frames; ++i) {
+            const int x = (i * 16) % (width - update_width + 1);
+            const int y = (i * 4) % (height - update_height + 1);
+            for (int j = y; j < y + update_height; ++j) {
+                for (int k = x; k < x + update_width; ++k) {
+                    const uint32_t pixel = random();
+                    std::memcpy(picture->data[0] + j * picture->linesize[0] + 4 * k, &pixel, 4);
+                }
+            }
+            AVFrame *frame = allocFrame(AV_PIX_FMT_BGR0, width, height);
+            av_frame_copy(frame, picture);
+            frame->pts = av_gettime();
+            converter.handle(frame);
+            waitReceived(output, i + 1);
+        }
+
+        converter.stop();
+        converter.detachSink(&output);
+        const uint64_t converted = converted_tiles.load() - converted_before;
+        const uint64_t reused = reused_tiles.load() - reused_before;
+        std::cout << "        " << (partial ? "partial" : "whole  ") << ": conversion mean " << std::fixed << std::setprecision(0)
+                  << conversion_time.getMean() << " us, p99 " << conversion_time.getPercentile(99) << " us";
+        if (partial) {
+            std::cout << ", " << std::setprecision(1) << (converted + reused ? 100.0 * reused / (converted + reused) : 0.0) << "% tiles reused";
+        }
+        std::cout << std::endl;
+    }
+
+    av_frame_free(&picture);
+    avcodec_free_context(&source_ctx);
+    avcodec_free_context(&sink_ctx);
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 300;
+    const int max_threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::min(8u, std::max(1u, std::thread::hardware_concurrency())));
+
+    const int sizes[][2] = {{1920, 1080}, {2560, 1440}};
+    for (const auto &size : sizes) {
+        std::cout << size[0] << "x" << size[1] << ", " << frames << " frames" << std::endl;
+        for (int threads = 1; threads <= max_threads; ++threads) {
+            run(size[0], size[1], threads, FrameConverter::Parallelism::Frame, frames);
+            run(size[0], size[1], threads, FrameConverter::Parallelism::Slice, frames);
+        }
+    }
+
+    // partial conversion keeps the frames in order, one thread or slices
+    const int slice_threads = std::min(4, max_threads);
+    struct Update {
+        const char *name;
+        int width;
+        int height;
+    };
+    const Update updates[] = {{"still", 0, 0}, {"typing", 200, 20}, {"window drag", 640, 480}, {"video", 1280, 720}, {"full", 1920, 1080}};
+    for (auto parallelism : {FrameConverter::Parallelism::Frame, FrameConverter::Parallelism::Slice}) {
+        const int threads = parallelism == FrameConverter::Parallelism::Slice ? slice_threads : 1;
+        std::cout << "1920x1080 partial updates, " << (parallelism == FrameConverter::Parallelism::Slice ? "slices x" : "frames x") << threads << ", " << frames << " frames" << std::endl;
+        for (const auto &update : updates) {
+            runPartial(update.name, update.width, update.height, parallelism, threads, frames);
+        }
+    }
+    return 0;
+}
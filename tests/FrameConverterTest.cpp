@@ -0,0 +1,158 @@
+// partial conversion, only the changed tiles converted and the rest copied from the previous output, must give
+// the same bytes as converting every frame whole: YUV420P and NV12, one thread and slices, over a sequence of
+// small updates, still frames and full changes on a size that is not a multiple of the tiles
+// usage: frame_converter_test, returns non zero on failure
+
+#include <iostream>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+};
+
+#include "../video/FrameConverter.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1000;
+constexpr int HEIGHT = 562;
+constexpr int FRAMES = 40;
+
+// keeps the converted frames in order
+class Output : public Sink<AVFrame> {
+public:
+    std::mutex lock;
+    std::vector<AVFrame*> frames;
+    std::atomic<size_t> received = 0;
+
+    ~Output() override {
+        for (auto &frame : frames) {
+            av_frame_free(&frame);
+        }
+    }
+
+    void handle(AVFrame *frame) override {
+        std::lock_guard<std::mutex> guard(lock);
+        frames.push_back(frame);
+        received.fetch_add(1, std::memory_order_release);
+    }
+};
+
+static void fill(AVFrame *picture, int x, int y, int width, int height, std::mt19937 &random) {
+    for (int j = y; j < y + height; ++j) {
+        for (int i = x; i < x + width; ++i) {
+            const uint32_t pixel = random();
+            std::memcpy(picture->data[0] + j * picture->linesize[0] + 4 * i, &pixel, 4);
+        }
+    }
+}
+
+// the next picture of the sequence: a few rectangles at odd places, sometimes nothing, sometimes everything
+static void update(AVFrame *picture, int index, std::mt19937 &random) {
+    if (index % 10 == 7) {
+        fill(picture, 0, 0, WIDTH, HEIGHT, random);
+        return;
+    }
+    const int rectangles = index % 10 == 3 ? 0 : 1 + static_cast<int>(random() % 4);
+    for (int r = 0; r < rectangles; ++r) {
+        const int x = static_cast<int>(random() % WIDTH);
+        const int y = static_cast<int>(random() % HEIGHT);
+        fill(picture, x, y, std::min(1 + static_cast<int>(random() % 150), WIDTH - x), std::min(1 + static_cast<int>(random() % 40), HEIGHT - y), random);
+    }
+}
+
+static bool samePlanes(const AVFrame *a, const AVFrame *b) {
+    if (a->format != b->format || a->width != b->width || a->height != b->height) {
+        return false;
+    }
+    const bool nv12 = a->format == AV_PIX_FMT_NV12;
+    const int widths[3] = {a->width, nv12 ? 2 * ((a->width + 1) / 2) : (a->width + 1) / 2, (a->width + 1) / 2};
+    const int heights[3] = {a->height, (a->height + 1) / 2, (a->height + 1) / 2};
+    for (int p = 0; p < (nv12 ? 2 : 3); ++p) {
+        for (int j = 0; j < heights[p]; ++j) {
+            if (std::memcmp(a->data[p] + j * a->linesize[p], b->data[p] + j * b->linesize[p], widths[p]) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void waitReceived(const Output &output, size_t count) {
+    for (int i = 0; i < 10'000 && output.received.load(std::memory_order_acquire) < count; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void compare(AVPixelFormat format, FrameConverter::Parallelism parallelism, int threads) {
+    const std::string what = std::string(format == AV_PIX_FMT_NV12 ? "nv12" : "yuv420p") +
+                             (parallelism == FrameConverter::Parallelism::Slice ? " slices x" : " frames x") + std::to_string(threads);
+    AVCodecContext *source_ctx = avcodec_alloc_context3(nullptr);
+    AVCodecContext *sink_ctx = avcodec_alloc_context3(nullptr);
+    source_ctx->width = sink_ctx->width = WIDTH;
+    source_ctx->height = sink_ctx->height = HEIGHT;
+    source_ctx->pix_fmt = AV_PIX_FMT_BGR0;
+    sink_ctx->pix_fmt = format;
+
+    FrameConverter partial;
+    FrameConverter full;
+    Output partial_output;
+    Output full_output;
+    partial.init(source_ctx, sink_ctx, threads, parallelism, true);
+    full.init(source_ctx, sink_ctx, threads, parallelism, false);
+    partial.attachSink(&partial_output);
+    full.attachSink(&full_output);
+    partial.start();
+    full.start();
+
+    std::atomic<uint64_t> &reused_tiles = Metrics::counter("video frame converter: reused tiles");
+    const uint64_t reused_before = reused_tiles.load();
+    std::mt19937 random(format + threads);
+    AVFrame *picture = allocFrame(AV_PIX_FMT_BGR0, WIDTH, HEIGHT);
+    update(picture, 7, random);
+    for (int i = 0; i < FRAMES; ++i) {
+        if (i > 0) {
+            update(picture, i, random);
+        }
+        // a fresh buffer each time as from the grabber, the converter keeps a reference on the previous one
+        for (FrameConverter *converter : {&partial, &full}) {
+            AVFrame *frame = allocFrame(AV_PIX_FMT_BGR0, WIDTH, HEIGHT);
+            av_frame_copy(frame, picture);
+            frame->pts = i;
+            converter->handle(frame);
+        }
+        waitReceived(partial_output, i + 1);
+        waitReceived(full_output, i + 1);
+    }
+
+    partial.stop();
+    full.stop();
+    partial.detachSink(&partial_output);
+    full.detachSink(&full_output);
+
+    check(partial_output.frames.size() == FRAMES && full_output.frames.size() == FRAMES, what + ": all frames converted");
+    for (size_t i = 0; i < std::min(partial_output.frames.size(), full_output.frames.size()); ++i) {
+        check(partial_output.frames[i]->pts == static_cast<int64_t>(i), what + ": frame " + std::to_string(i) + " in order");
+        check(samePlanes(partial_output.frames[i], full_output.frames[i]), what + ": frame " + std::to_string(i) + " identical");
+    }
+    check(reused_tiles.load() > reused_before, what + ": tiles reused");
+
+    av_frame_free(&picture);
+    avcodec_free_context(&source_ctx);
+    avcodec_free_context(&sink_ctx);
+}
+
+int main() {
+    for (AVPixelFormat format : {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12}) {
+        compare(format, FrameConverter::Parallelism::Frame, 1);
+        compare(format, FrameConverter::Parallelism::Slice, 3);
+    }
+    return testResult();
+}
@@ -0,0 +1,151 @@
+// frame pools allocate only until enough buffers are in flight, then reuse them
+// also checks which grabber decoders go through the pool: pcm (alsa) does, rawvideo (x11grab) references the packet
+// usage: frame_pool_test, returns non zero on failure
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+};
+
+#include "../FramePool.h"
+#include "test_utils.h"
+
+static uint64_t allocations(const std::string &name) {
+    return Metrics::counter(name + ": pool allocations").load();
+}
+
+// depth frames in flight at any time, as a pipeline stage holding a few frames
+static void cycle(FramePool &pool, AVFrame *model, int frames, int depth) {
+    std::vector<AVFrame*> in_flight;
+    for (int i = 0; i < frames; ++i) {
+        AVFrame *frame = av_frame_alloc();
+        frame->format = model->format;
+        frame->width = model->width;
+        frame->height = model->height;
+        frame->nb_samples = model->nb_samples;
+        frame->channel_layout = model->channel_layout;
+        frame->channels = model->channels;
+        check(pool.get(frame) == 0, "get");
+        std::memset(frame->data[0], i, frame->linesize[0]);
+        in_flight.push_back(frame);
+        if (static_cast<int>(in_flight.size()) == depth) {
+            av_frame_free(&in_flight.front());
+            in_flight.erase(in_flight.begin());
+        }
+    }
+    for (auto& frame : in_flight) {
+        av_frame_free(&frame);
+    }
+}
+
+static void testVideo() {
+    const std::string name = "video pool test";
+    FramePool pool(name);
+    AVFrame *model = av_frame_alloc();
+    model->format = AV_PIX_FMT_YUV420P;
+    model->width = 1920;
+    model->height = 1080;
+
+    cycle(pool, model, 300, 3);
+    check(allocations(name) == 3, "video allocates once per frame in flight, got " + std::to_string(allocations(name)));
+
+    // a new geometry rebuilds the pool, the frames still held from the old one stay valid
+    AVFrame *held = av_frame_alloc();
+    held->format = model->format;
+    held->width = model->width;
+    held->height = model->height;
+    check(pool.get(held) == 0, "get before the rebuild");
+    model->width = 1280;
+    model->height = 720;
+    const uint64_t before = allocations(name);
+    cycle(pool, model, 300, 3);
+    check(allocations(name) - before == 3, "rebuilt pool allocates once per frame in flight, got " + std::to_string(allocations(name) - before));
+    std::memset(held->data[0], 0, held->linesize[0] * held->height);
+    av_frame_free(&held);
+    av_frame_free(&model);
+}
+
+static void testAudio() {
+    const std::string name = "audio pool test";
+    FramePool pool(name);
+    AVFrame *model = av_frame_alloc();
+    model->format = AV_SAMPLE_FMT_FLTP;
+    model->nb_samples = 960;
+    model->channel_layout = AV_CH_LAYOUT_STEREO;
+    model->channels = 2;
+
+    cycle(pool, model, 1000, 2);
+    check(allocations(name) == 2, "audio allocates once per frame in flight, got " + std::to_string(allocations(name)));
+    av_frame_free(&model);
+}
+
+// decode packets with the pool as get_buffer2, returns the pool allocations
+static uint64_t decode(AVCodecID codec_id, const std::string &name, AVCodecContext *settings, int packet_size) {
+    FramePool pool(name);
+    AVCodec *codec = avcodec_find_decoder(codec_id);
+    AVCodecContext *ctx = avcodec_alloc_context3(codec);
+    ctx->width = settings->width;
+    ctx->height = settings->height;
+    ctx->pix_fmt = settings->pix_fmt;
+    ctx->sample_rate = settings->sample_rate;
+    ctx->channels = settings->channels;
+    ctx->channel_layout = settings->channel_layout;
+    ctx->opaque = &pool;
+    ctx->get_buffer2 = FramePool::getBuffer2;
+    if (avcodec_open2(ctx, codec, nullptr) < 0) {
+        std::cerr << "could not open " << avcodec_get_name(codec_id) << std::endl;
+        std::exit(2);
+    }
+
+    AVPacket *packet = av_packet_alloc();
+    AVFrame *frame = av_frame_alloc();
+    int decoded = 0;
+    for (int i = 0; i < 100; ++i) {
+        av_new_packet(packet, packet_size);
+        std::memset(packet->data, i, packet_size);
+        if (avcodec_send_packet(ctx, packet) < 0) {
+            break;
+        }
+        while (avcodec_receive_frame(ctx, frame) == 0) {
+            ++decoded;
+            av_frame_unref(frame);
+        }
+        av_packet_unref(packet);
+    }
+    check(decoded == 100, avcodec_get_name(codec_id) + std::string(" decoded ") + std::to_string(decoded) + " frames out of 100");
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&ctx);
+    return allocations(name);
+}
+
+static void testDecoders() {
+    AVCodecContext *settings = avcodec_alloc_context3(nullptr);
+    settings->sample_rate = 48000;
+    settings->channels = 2;
+    settings->channel_layout = AV_CH_LAYOUT_STEREO;
+    const uint64_t pcm = decode(AV_CODEC_ID_PCM_S16LE, "pcm decoder pool test", settings, 4 * 480);
+    check(pcm >= 1 && pcm <= 2, "pcm decoder allocates from the pool once, got " + std::to_string(pcm));
+
+    settings->width = 1920;
+    settings->height = 1080;
+    settings->pix_fmt = AV_PIX_FMT_BGR0;
+    const uint64_t raw = decode(AV_CODEC_ID_RAWVIDEO, "rawvideo decoder pool test", settings, 4 * 1920 * 1080);
+    check(raw == 0, "rawvideo references the packet and never uses the pool, got " + std::to_string(raw));
+    avcodec_free_context(&settings);
+}
+
+int main() {
+    testVideo();
+    testAudio();
+    testDecoders();
+
+    return testResult();
+}
@@ -0,0 +1,152 @@
+// frame delivery of x264 at 1080p60 under a synthetic cpu load, with and without the encoder governor:
+// idle, then busy threads on every core as a game would, then idle again, frames paced in real time
+// usage: governor_bench [phase seconds] [load threads]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "../video/EncoderGovernor.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+// a frame out later than this after its capture missed its slot on the client
+constexpr int64_t LATE = 100'000;
+constexpr const char *PHASES[] = {"idle", "loaded", "recovered"};
+
+// frames out of the encoder in each phase, and how late
+class Delivery : public Sink<const FrameStats> {
+public:
+    std::atomic<int> phase = 0;
+    std::atomic<int64_t> frames[3] = {};
+    std::atomic<int64_t> late[3] = {};
+
+    void handle(const FrameStats *stats) override {
+        if (stats->capture_time == AV_NOPTS_VALUE) {
+            return;
+        }
+        const int current = phase;
+        frames[current].fetch_add(1, std::memory_order_relaxed);
+        if (stats->packet_time - stats->capture_time > LATE) {
+            late[current].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+static void run(bool governed, int phase_seconds, int load_threads) {
+    const std::string name = governed ? "governed encoder" : "plain encoder";
+    H264Encoder encoder(false, name);
+    encoder.init({
+            {"bitrate", "15000000"},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    });
+    EncoderGovernor governor(name + " governor");
+    if (governed) {
+        governor.setEncoder(&encoder);
+        governor.init({
+                {"presets", "veryfast,superfast,ultrafast"},
+                {"framerates", "45,30"},
+                {"recovery_time", "3000"},
+        });
+        encoder.Source<const FrameStats>::attachSink(&governor);
+        governor.attachSink(&encoder);
+    }
+    Delivery delivery;
+    encoder.Source<const FrameStats>::attachSink(&delivery);
+    // the feed thread drops the frames it can not take, as with the grabber
+    encoder.start();
+
+    std::atomic<bool> loaded = false;
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> load;
+    for (int i = 0; i < load_threads; ++i) {
+        load.emplace_back([&] {
+            volatile uint64_t sink = 0;
+            while (!stop) {
+                if (!loaded) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                    continue;
+                }
+                for (int k = 0; k < 100'000; ++k) {
+                    sink = sink * 6364136223846793005ULL + 1;
+                }
+            }
+        });
+    }
+
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    const int phase_frames = phase_seconds * 60;
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < 3 * phase_frames; ++i) {
+        if (i % phase_frames == 0) {
+            delivery.phase = i / phase_frames;
+            loaded = i / phase_frames == 1;
+        }
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        encoder.handle(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    stop = true;
+    for (auto &thread : load) {
+        thread.join();
+    }
+    encoder.stop();
+    encoder.Source<const FrameStats>::detachSink(&delivery);
+    if (governed) {
+        encoder.Source<const FrameStats>::detachSink(&governor);
+        governor.detachSink(&encoder);
+    }
+    av_frame_free(&picture);
+
+    std::cout << name << ":" << std::endl;
+    for (int p = 0; p < 3; ++p) {
+        std::cout << std::setw(12) << PHASES[p] << ": " << std::fixed << std::setprecision(1)
+                  << static_cast<double>(delivery.frames[p]) / phase_seconds << " fps delivered, "
+                  << static_cast<double>(delivery.late[p]) * 100 / std::max<int64_t>(1, delivery.frames[p])
+                  << "% later than " << LATE / 1000 << "ms" << std::endl;
+    }
+    if (governed) {
+        std::cout << std::setw(12) << "governor" << ": " << Metrics::counter(name + " governor: steps down").load()
+                  << " steps down, " << Metrics::counter(name + " governor: steps up").load() << " up, ends at preset "
+                  << encoder.getParam("preset") << " " << encoder.getParam("framerate") << " fps, load (%) ";
+        Metrics::histogram(name + " governor: load (%)").print(std::cout);
+        std::cout << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    const int phase_seconds = argc > 1 ? std::atoi(argv[1]) : 20;
+    const int load_threads = argc > 2 ? std::atoi(argv[2]) : static_cast<int>(std::thread::hardware_concurrency());
+    std::cout << WIDTH << "x" << HEIGHT << " 60 fps, x264 veryfast zerolatency, " << phase_seconds << "s per phase, "
+              << load_threads << " load threads" << std::endl;
+    run(false, phase_seconds, load_threads);
+    run(true, phase_seconds, load_threads);
+    return 0;
+}
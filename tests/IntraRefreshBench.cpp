@@ -0,0 +1,114 @@
+// frame size burst of periodic key frames against intra refresh, x264 at 1080p60 paced in real time with the
+// same gop and a key frame request (loss recovery) every few seconds: peak frame size and the rtp packets
+// it is sent in at once, and the frame size variance
+// usage: intra_refresh_bench [seconds] [seconds between requests]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+// rtp payload of a datagram, see RTPVideoSender
+constexpr int PACKET_PAYLOAD = 1472 - 12;
+
+// size of each encoded frame, kept until the end of the run
+class Sizes : public Sink<const FrameStats> {
+public:
+    std::vector<int64_t> sizes;
+
+    void handle(const FrameStats *stats) override {
+        sizes.push_back(stats->size);
+    }
+};
+
+static void run(bool intra_refresh, int seconds, int request_seconds) {
+    const std::string name = intra_refresh ? "intra refresh" : "key frames";
+    H264Encoder encoder(false, name);
+    encoder.init({
+            {"bitrate", "8000000"},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"intra_refresh", intra_refresh ? "1" : "0"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    });
+    Sizes sizes;
+    encoder.Source<const FrameStats>::attachSink(&sizes);
+    encoder.start();
+
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    const int64_t key_frame_request = -1;
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < seconds * 60; ++i) {
+        if (i > 0 && i % (request_seconds * 60) == 0) {
+            encoder.handle(&key_frame_request);
+        }
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        encoder.handle(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    encoder.stop();
+    encoder.Source<const FrameStats>::detachSink(&sizes);
+    av_frame_free(&picture);
+
+    // the first frame is a key frame in both modes, the stream start is not what is compared
+    std::vector<int64_t> frames(sizes.sizes.begin() + std::min<size_t>(1, sizes.sizes.size()), sizes.sizes.end());
+    if (frames.empty()) {
+        std::cout << std::setw(14) << name << ": no frame out" << std::endl;
+        return;
+    }
+    double mean = 0;
+    for (int64_t size : frames) {
+        mean += size;
+    }
+    mean /= frames.size();
+    double variance = 0;
+    for (int64_t size : frames) {
+        variance += (size - mean) * (size - mean);
+    }
+    variance /= frames.size();
+    std::sort(frames.begin(), frames.end());
+    const int64_t peak = frames.back();
+    const int64_t p99 = frames[frames.size() * 99 / 100];
+
+    std::cout << std::setw(14) << name << ": " << frames.size() << " frames, mean " << std::fixed << std::setprecision(0) << mean
+              << " bytes, stddev " << std::sqrt(variance) << " (" << std::setprecision(2) << std::sqrt(variance) / mean
+              << " of the mean), p99 " << p99 << ", peak " << peak << " bytes, " << std::setprecision(1) << peak / mean
+              << "x the mean, burst of " << (peak + PACKET_PAYLOAD - 1) / PACKET_PAYLOAD << " rtp packets" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const int seconds = argc > 1 ? std::atoi(argv[1]) : 30;
+    const int request_seconds = std::max(1, argc > 2 ? std::atoi(argv[2]) : 5);
+    std::cout << WIDTH << "x" << HEIGHT << " 60 fps, x264 veryfast zerolatency 8Mbps, gop 120, " << seconds
+              << "s, a key frame request every " << request_seconds << "s" << std::endl;
+    run(false, seconds, request_seconds);
+    run(true, seconds, request_seconds);
+    return 0;
+}
@@ -0,0 +1,91 @@
+// allocations per frame from the encoder to the rtp sender, and the time to send a packet,
+// x264 on a synthetic 1080p60 picture sent to a local udp port nobody listens on
+// usage: packet_path_bench [frames] [port]
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "../network/RTPVideoSender.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+// frames before the counters are read, the pools are sized on the first key frame
+constexpr int WARM_UP = 120;
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 1200;
+    const std::string port = argc > 2 ? argv[2] : "5004";
+
+    H264Encoder encoder(false, "bench encoder");
+    encoder.init({
+            {"bitrate", "15000000"},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    });
+    RTPVideoSender sender;
+    sender.init(("rtp://127.0.0.1:" + port).c_str(), encoder.getContext());
+    sender.start();
+    encoder.Source<AVPacket>::attachSink(&sender);
+    encoder.startDrain();
+
+    std::atomic<uint64_t> &payload_allocations = Metrics::counter("bench encoder: payload pool allocations");
+    std::atomic<uint64_t> &packet_allocations = Metrics::counter("rtp video sender: packet pool allocations");
+    Histogram &send_time = Metrics::histogram("rtp video sender: send (us)");
+
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+
+    uint64_t payload_start = 0;
+    uint64_t packet_start = 0;
+    const int64_t period = 1'000'000 / 60;
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < WARM_UP + frames; ++i) {
+        if (i == WARM_UP) {
+            payload_start = payload_allocations.load();
+            packet_start = packet_allocations.load();
+            send_time.reset();
+        }
+        // the encoder may still hold the previous picture
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        // the encoder takes ownership of what it is given
+        AVFrame *frame = av_frame_clone(picture);
+        // stamped with the capture time, as the grabber does
+        frame->pts = av_gettime();
+        encoder.handle(frame);
+
+        // real time, the sender would not keep up with a faster feed and drop
+        next += period;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+
+    encoder.stop();
+    sender.stop();
+    encoder.Source<AVPacket>::detachSink(&sender);
+    av_frame_free(&picture);
+
+    std::cout << frames << " frames at " << WIDTH << "x" << HEIGHT << std::endl;
+    std::cout << "payload pool allocations per frame: " << static_cast<double>(payload_allocations.load() - payload_start) / frames << std::endl;
+    std::cout << "packet pool allocations per frame: " << static_cast<double>(packet_allocations.load() - packet_start) / frames << std::endl;
+    std::cout << "send (us): ";
+    send_time.print(std::cout);
+    std::cout << std::endl;
+    return 0;
+}
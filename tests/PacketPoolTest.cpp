@@ -0,0 +1,123 @@
+// packet pool copies allocate only when a packet is bigger than the storage of its entry,
+// the allocation counter is the hook: it must stay flat once the sizes have been seen
+// usage: packet_pool_test, returns non zero on failure
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <random>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+};
+
+#include "../PacketPool.h"
+#include "test_utils.h"
+
+static uint64_t allocations(const std::string &name) {
+    return Metrics::counter(name + ": packet pool allocations").load();
+}
+
+static AVPacket* makePacket(int size, int64_t pts) {
+    AVPacket *packet = av_packet_alloc();
+    av_new_packet(packet, size);
+    std::memset(packet->data, static_cast<int>(pts & 0xFF), size);
+    packet->pts = pts;
+    packet->dts = pts;
+    packet->flags = pts % 60 == 0 ? AV_PKT_FLAG_KEY : 0;
+    return packet;
+}
+
+static bool sameCopy(const AVPacket *copy, const AVPacket *packet) {
+    if (copy->size != packet->size || copy->pts != packet->pts || copy->flags != packet->flags || copy->buf) {
+        return false;
+    }
+    for (int i = 0; i < AV_INPUT_BUFFER_PADDING_SIZE; ++i) {
+        if (copy->data[copy->size + i] != 0) {
+            return false;
+        }
+    }
+    return std::memcmp(copy->data, packet->data, packet->size) == 0;
+}
+
+// a sender with depth packets queued, sizes as an encoder output: small p frames and a key frame every second
+static void stream(PacketPool &pool, int frames, int depth, int key_size, std::mt19937 &random) {
+    std::deque<AVPacket*> in_flight;
+    for (int i = 0; i < frames; ++i) {
+        const int size = i % 60 == 0 ? key_size : 2000 + static_cast<int>(random() % 30000);
+        AVPacket *packet = makePacket(size, i);
+        AVPacket *copy = pool.copy(packet);
+        check(copy && sameCopy(copy, packet), "copy of packet " + std::to_string(i));
+        av_packet_free(&packet);
+        if (!copy) {
+            continue;
+        }
+        in_flight.push_back(copy);
+        if (static_cast<int>(in_flight.size()) == depth) {
+            pool.release(in_flight.front());
+            in_flight.pop_front();
+        }
+    }
+    for (AVPacket *copy : in_flight) {
+        pool.release(copy);
+    }
+}
+
+// every entry in flight with a packet of this size, so they all have the storage for it
+static void warmUp(PacketPool &pool, int size) {
+    std::vector<AVPacket*> held;
+    AVPacket *packet = makePacket(size, 0);
+    for (int i = 0; i < 5; ++i) {
+        held.push_back(pool.copy(packet));
+    }
+    for (AVPacket *copy : held) {
+        check(copy != nullptr, "warm up copy");
+        if (copy) {
+            pool.release(copy);
+        }
+    }
+    av_packet_free(&packet);
+}
+
+int main() {
+    const std::string name = "packet pool test";
+    PacketPool pool(name, 5);
+    std::mt19937 random(1);
+
+    // one payload per entry, then nothing as long as packets are not bigger
+    warmUp(pool, 200'000);
+    check(allocations(name) == 5, "warm up allocates one payload per entry, got " + std::to_string(allocations(name)));
+    stream(pool, 6000, 4, 200'000, random);
+    check(allocations(name) == 5, "steady state allocates, " + std::to_string(allocations(name) - 5) + " allocations");
+
+    // a bigger key frame grows the storage of the entry it lands in, once
+    stream(pool, 600, 4, 400'000, random);
+    const uint64_t grown = allocations(name);
+    check(grown > 5 && grown <= 10, "bigger packets grow each entry at most once, got " + std::to_string(grown - 5));
+    warmUp(pool, 400'000);
+    const uint64_t warm = allocations(name);
+    stream(pool, 6000, 4, 400'000, random);
+    check(allocations(name) == warm, "steady state after growth allocates, " + std::to_string(allocations(name) - warm) + " allocations");
+
+    // all entries in flight: no copy, and no allocation for it
+    std::vector<AVPacket*> held;
+    AVPacket *packet = makePacket(1000, 0);
+    for (int i = 0; i < 5; ++i) {
+        held.push_back(pool.copy(packet));
+        check(held.back() != nullptr, "copy into a free entry");
+    }
+    check(pool.copy(packet) == nullptr, "exhausted pool returns nullptr");
+    pool.release(held.back());
+    held.pop_back();
+    AVPacket *copy = pool.copy(packet);
+    check(copy != nullptr, "released entry is reused");
+    held.push_back(copy);
+    for (AVPacket *entry : held) {
+        pool.release(entry);
+    }
+    av_packet_free(&packet);
+
+    return testResult();
+}
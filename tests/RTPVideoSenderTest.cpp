@@ -0,0 +1,18 @@
+// the rtp codec check used to pick the codecs offered to sessions:
+// H264 and HEVC have an rtp packetization in every FFmpeg the project builds with, AV1 depends on the version
+// usage: rtp_video_sender_test, returns non zero on failure
+
+#include <iostream>
+#include <string>
+
+#include "../network/RTPVideoSender.h"
+#include "test_utils.h"
+
+int main() {
+    check(RTPVideoSender::supports(AV_CODEC_ID_H264), "h264 refused");
+    check(RTPVideoSender::supports(AV_CODEC_ID_HEVC), "hevc refused");
+    // no packetization before FFmpeg 5, either answer is right
+    std::cout << "av1 " << (RTPVideoSender::supports(AV_CODEC_ID_AV1) ? "supported" : "not supported") << std::endl;
+
+    return testResult();
+}
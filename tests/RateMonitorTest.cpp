@@ -0,0 +1,158 @@
+// rate monitor convergence and overshoot on scripted bitrate steps:
+// first on synthetic packets whose rate follows the target after a known lag, then through x264 with the steps
+// given as bitrate requests, the path the "n" command of a session takes
+// usage: rate_monitor_test, returns non zero on failure
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <thread>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../RateMonitor.h"
+#include "../video/H264Encoder.h"
+#include "test_utils.h"
+
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+
+// 60 fps at from_rate, a step to to_rate which the output follows after lag, overshooting by the factor
+// for 200 ms, then at the new rate until the observation is over
+static void testStep(int64_t from_rate, int64_t to_rate, int64_t lag, double overshoot_factor) {
+    const std::string name = "rate monitor test " + std::to_string(from_rate) + " to " + std::to_string(to_rate) +
+            " after " + std::to_string(lag);
+    RateMonitor monitor(name);
+    int64_t time = 1'000'000;
+    for (int i = 0; i < 60; ++i, time += FRAME_INTERVAL) {
+        monitor.record(time, from_rate * FRAME_INTERVAL / 8 / 1'000'000);
+    }
+    const int64_t step_time = time;
+    monitor.step(to_rate, step_time);
+    for (; time < step_time + 2'500'000; time += FRAME_INTERVAL) {
+        const int64_t rate = time < step_time + lag ? from_rate : time < step_time + lag + 200'000 ? to_rate * overshoot_factor : to_rate;
+        monitor.record(time, rate * FRAME_INTERVAL / 8 / 1'000'000);
+    }
+
+    const Histogram &convergence = Metrics::histogram(name + ": rate convergence (us)");
+    const int64_t converged = convergence.getMax();
+    const int64_t settled = lag + (overshoot_factor != 1.0 ? 200'000 : 0);
+    check(convergence.getCount() == 1, name + ": converged once, got " + std::to_string(convergence.getCount()));
+    // the short span must fill with packets at the new rate, plus a frame on each side
+    check(converged >= settled && converged <= settled + 100'000 + 2 * FRAME_INTERVAL,
+          name + ": converged after " + std::to_string(converged) + " us");
+    check(Metrics::counter(name + ": rate steps not converged").load() == 0, name + ": counted as not converged");
+
+    const Histogram &overshoot = Metrics::histogram(name + ": rate overshoot (%)");
+    check(overshoot.getCount() == 1, name + ": one overshoot recorded");
+    const int64_t expected = std::max<int64_t>(0, static_cast<int64_t>(overshoot_factor * 100) - 100);
+    // the peak is on the window, which smooths a 200 ms burst
+    check(overshoot_factor == 1.0 || overshoot.getMax() > 0, name + ": overshoot not seen");
+    check(overshoot.getMax() <= expected, name + ": overshoot " + std::to_string(overshoot.getMax()) + "% above " +
+          std::to_string(expected) + "%");
+}
+
+// the output never reaches the target
+static void testNotConverged() {
+    const std::string name = "rate monitor test stuck";
+    RateMonitor monitor(name);
+    int64_t time = 1'000'000;
+    monitor.step(1'000'000, time);
+    for (; time < 3'500'000; time += FRAME_INTERVAL) {
+        monitor.record(time, 2'000'000 * FRAME_INTERVAL / 8 / 1'000'000);
+    }
+    check(Metrics::histogram(name + ": rate convergence (us)").getCount() == 0, name + ": no convergence recorded");
+    check(Metrics::counter(name + ": rate steps not converged").load() == 1, name + ": counted as not converged");
+}
+
+// bitrate requests forwarded as the session does with "n"
+class BitrateRequests : public Source<const int64_t> {
+public:
+    void request(int64_t bitrate) {
+        forward(&bitrate);
+    }
+};
+
+// noise frames at 640x360, paced in real time since the encoder stamps rate changes and packets with av_gettime
+static void testEncoder() {
+    const std::string name = "rate step encoder";
+    H264Encoder encoder(false, name);
+    encoder.init({
+            {"bitrate", "2000000"},
+            {"width", "640"},
+            {"height", "360"},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "ultrafast"},
+            {"tune", "zerolatency"},
+    });
+    encoder.setInlineDrain(true);
+    BitrateRequests requests;
+    requests.attachSink(&encoder);
+
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, 640, 360);
+    std::mt19937 random(1);
+
+    // each step lasts longer than the observation, so it is finished by the time the next one comes
+    const std::vector<int64_t> steps = {1'000'000, 3'000'000, 1'500'000, 2'500'000};
+    int64_t next = av_gettime_relative();
+    for (size_t i = 0; i < steps.size() * 150 + 150; ++i) {
+        if (i % 150 == 0 && i / 150 < steps.size()) {
+            requests.request(steps[i / 150]);
+        }
+        av_frame_make_writable(picture);
+        for (int p = 0; p < 3; ++p) {
+            const int height = p == 0 ? 360 : 180;
+            const int width = p == 0 ? 640 : 320;
+            for (int y = 0; y < height; ++y) {
+                uint8_t *line = picture->data[p] + y * picture->linesize[p];
+                for (int x = 0; x < width; x += 4) {
+                    const uint32_t noise = random();
+                    std::memcpy(line + x, &noise, 4);
+                }
+            }
+        }
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        encoder.handle(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    requests.detachSink(&encoder);
+    encoder.stop();
+    av_frame_free(&picture);
+
+    const Histogram &convergence = Metrics::histogram(name + ": rate convergence (us)");
+    const Histogram &overshoot = Metrics::histogram(name + ": rate overshoot (%)");
+    const uint64_t not_converged = Metrics::counter(name + ": rate steps not converged").load();
+    std::cout << name << ": " << steps.size() << " steps, convergence (us) ";
+    convergence.print(std::cout);
+    std::cout << ", overshoot (%) ";
+    overshoot.print(std::cout);
+    std::cout << ", not converged " << not_converged << std::endl;
+    // x264 follows its vbv within a few frames on noise, loose bounds for a loaded host
+    check(convergence.getCount() + not_converged == steps.size(), name + ": every step observed");
+    check(not_converged == 0, name + ": " + std::to_string(not_converged) + " steps not converged");
+    check(convergence.getMax() < 1'000'000, name + ": slowest convergence " + std::to_string(convergence.getMax()) + " us");
+}
+
+int main() {
+    testStep(2'000'000, 1'000'000, 0, 1.0);
+    testStep(2'000'000, 1'000'000, 100'000, 1.0);
+    testStep(1'000'000, 3'000'000, 400'000, 1.0);
+    testStep(1'000'000, 2'000'000, 0, 1.5);
+    testNotConverged();
+    testEncoder();
+
+    return testResult();
+}
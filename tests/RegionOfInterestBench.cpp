@@ -0,0 +1,186 @@
+// quality inside and outside the cursor region with and without the region of interest, at the same bitrate:
+// x264 on a synthetic 1080p60 desktop scrolling under a still cursor, decoded and compared to the source
+// usage: roi_bench [frames] [bitrate]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/frame.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+constexpr int ROI_SIZE = 384;
+// box around the cursor, at the centre of the screen
+constexpr int BOX_LEFT = (WIDTH - ROI_SIZE) / 2;
+constexpr int BOX_TOP = (HEIGHT - ROI_SIZE) / 2;
+
+// text like texture, every macroblock costs bits, scrolled one line per frame so nothing is skipped
+static uint8_t luma(int x, int y, int index) {
+    const int row = y + index;
+    const uint32_t hash = (static_cast<uint32_t>(x / 6) * 2654435761u) ^ (static_cast<uint32_t>(row / 12) * 40503u);
+    const bool glyph = (hash >> 7) % 3 != 0 && (x % 6) < 4 && (row % 12) < 9;
+    return glyph ? 40 + ((x * 7 + row * 3) & 31) : 220;
+}
+
+static void draw(AVFrame *frame, int index) {
+    for (int y = 0; y < HEIGHT; ++y) {
+        uint8_t *line = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < WIDTH; ++x) {
+            line[x] = luma(x, y, index);
+        }
+    }
+    for (int p = 1; p < 3; ++p) {
+        for (int y = 0; y < HEIGHT / 2; ++y) {
+            std::memset(frame->data[p] + y * frame->linesize[p], 128, WIDTH / 2);
+        }
+    }
+}
+
+// squared error and ssim of the luma, inside the box and outside, ssim on 8x8 blocks
+struct Quality {
+    double error[2] = {};
+    double pixels[2] = {};
+    double ssim[2] = {};
+    double blocks[2] = {};
+
+    void add(const AVFrame *decoded, int index) {
+        for (int y = 0; y < HEIGHT; ++y) {
+            for (int x = 0; x < WIDTH; ++x) {
+                const int d = decoded->data[0][y * decoded->linesize[0] + x] - luma(x, y, index);
+                const int in = inBox(x, y);
+                error[in] += d * d;
+                pixels[in] += 1;
+            }
+        }
+
+        constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+        constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+        for (int by = 0; by + 8 <= HEIGHT; by += 8) {
+            for (int bx = 0; bx + 8 <= WIDTH; bx += 8) {
+                double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+                for (int y = by; y < by + 8; ++y) {
+                    for (int x = bx; x < bx + 8; ++x) {
+                        const double a = luma(x, y, index);
+                        const double b = decoded->data[0][y * decoded->linesize[0] + x];
+                        sa += a;
+                        sb += b;
+                        saa += a * a;
+                        sbb += b * b;
+                        sab += a * b;
+                    }
+                }
+                const double ma = sa / 64, mb = sb / 64;
+                const double va = saa / 64 - ma * ma, vb = sbb / 64 - mb * mb, cov = sab / 64 - ma * mb;
+                const int in = inBox(bx + 4, by + 4);
+                ssim[in] += ((2 * ma * mb + C1) * (2 * cov + C2)) / ((ma * ma + mb * mb + C1) * (va + vb + C2));
+                blocks[in] += 1;
+            }
+        }
+    }
+
+    double psnr(int in) const {
+        const double mse = error[in] / pixels[in];
+        return mse == 0 ? 99. : 10. * std::log10(255. * 255. / mse);
+    }
+
+    static int inBox(int x, int y) {
+        return x >= BOX_LEFT && x < BOX_LEFT + ROI_SIZE && y >= BOX_TOP && y < BOX_TOP + ROI_SIZE ? 1 : 0;
+    }
+};
+
+// decodes each packet as it comes out, no reordering with zerolatency so the n-th picture is the n-th frame
+class Decoder : public Sink<AVPacket> {
+public:
+    AVCodecContext *ctx;
+    AVFrame *frame;
+    Quality quality;
+    int decoded = 0;
+    int64_t bytes = 0;
+
+    Decoder() {
+        AVCodec *codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+        ctx = avcodec_alloc_context3(codec);
+        frame = av_frame_alloc();
+        if (avcodec_open2(ctx, codec, nullptr) < 0) {
+            std::cerr << "could not open decoder" << std::endl;
+            std::exit(2);
+        }
+    }
+
+    ~Decoder() override {
+        av_frame_free(&frame);
+        avcodec_free_context(&ctx);
+    }
+
+    void handle(AVPacket *packet) override {
+        bytes += packet->size;
+        if (avcodec_send_packet(ctx, packet) < 0) {
+            return;
+        }
+        while (avcodec_receive_frame(ctx, frame) == 0) {
+            quality.add(frame, decoded++);
+            av_frame_unref(frame);
+        }
+    }
+};
+
+static void run(bool roi, int frames, const std::string &bitrate) {
+    H264Encoder encoder(false, roi ? "roi encoder" : "plain encoder");
+    encoder.init({
+            {"bitrate", bitrate},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+            {"roi", roi ? "1" : "0"},
+            {"roi_size", std::to_string(ROI_SIZE)},
+    });
+    encoder.setInlineDrain(true);
+    const CursorPosition cursor = {WIDTH / 2, HEIGHT / 2, true, nullptr, WIDTH, HEIGHT};
+    encoder.handle(&cursor);
+
+    // no feed nor drain thread, each frame is encoded and its packets decoded in handle
+    Decoder decoder;
+    encoder.Source<AVPacket>::attachSink(&decoder);
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    for (int i = 0; i < frames; ++i) {
+        av_frame_make_writable(picture);
+        draw(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        // capture times 60 times a second, encoded as fast as possible
+        frame->pts = 1'000'000 + i * 1'000'000LL / 60;
+        encoder.handle(frame);
+    }
+    encoder.stop();
+    encoder.Source<AVPacket>::detachSink(&decoder);
+    av_frame_free(&picture);
+
+    const Quality &q = decoder.quality;
+    std::cout << std::setw(8) << (roi ? "roi" : "no roi") << std::fixed << std::setprecision(2)
+              << ": " << decoder.bytes * 8 * 60 / std::max(1, decoder.decoded) / 1000 << " kbps, cursor box psnr " << q.psnr(1)
+              << " ssim " << std::setprecision(4) << q.ssim[1] / q.blocks[1] << std::setprecision(2)
+              << ", elsewhere psnr " << q.psnr(0) << " ssim " << std::setprecision(4) << q.ssim[0] / q.blocks[0]
+              << " (" << decoder.decoded << " frames)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 300;
+    const std::string bitrate = argc > 2 ? argv[2] : "6000000";
+    std::cout << WIDTH << "x" << HEIGHT << " at " << bitrate << " bps, " << ROI_SIZE << "x" << ROI_SIZE << " box at the centre" << std::endl;
+    run(false, frames, bitrate);
+    run(true, frames, bitrate);
+    return 0;
+}
@@ -0,0 +1,143 @@
+// concurrent x264 720p60 encodes under the encoder scheduler: groups are added one by one, each at a bitrate
+// far enough from the others to get its own encoder, until the scheduler refuses one (cpu budget) or a group
+// stops keeping up with the capture, frames paced in real time from one shared source
+// usage: scheduler_bench [seconds per step] [cores per encoder]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/EncoderScheduler.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1280;
+constexpr int HEIGHT = 720;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+// a group keeps up when it delivers this share of the captured frames (percent)
+constexpr int64_t SUSTAINED = 95;
+// a frame out later than this after its capture missed its slot on the client
+constexpr int64_t LATE = 100'000;
+
+// the shared frames, as from the converter
+class Feed : public Source<AVFrame> {
+public:
+    void send(AVFrame *frame) {
+        forward(frame);
+    }
+};
+
+// frames out of one group encoder
+class Delivery : public Sink<const FrameStats> {
+public:
+    std::atomic<int64_t> frames = 0;
+    std::atomic<int64_t> late = 0;
+
+    void handle(const FrameStats *stats) override {
+        if (stats->capture_time == AV_NOPTS_VALUE) {
+            return;
+        }
+        frames.fetch_add(1, std::memory_order_relaxed);
+        if (stats->packet_time - stats->capture_time > LATE) {
+            late.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct Group {
+    VideoEncoder *encoder;
+    int64_t bitrate;
+    std::unique_ptr<Delivery> delivery;
+};
+
+static void feed(Feed &source, int frames) {
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < frames; ++i) {
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        picture->pts = av_gettime();
+        source.send(picture);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    av_frame_free(&picture);
+}
+
+int main(int argc, char **argv) {
+    const int seconds = argc > 1 ? std::atoi(argv[1]) : 10;
+    const std::string cores_per_encoder = argc > 2 ? argv[2] : "2";
+    const int frames = seconds * 60;
+
+    Feed source;
+    EncoderScheduler scheduler(source);
+    scheduler.init({
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+            {"cores_per_encoder", cores_per_encoder},
+    });
+    std::cout << WIDTH << "x" << HEIGHT << " 60 fps, x264 veryfast zerolatency, " << cores_per_encoder << " cores per encoder, "
+              << seconds << "s per step" << std::endl;
+
+    std::vector<Group> groups;
+    size_t sustained = 0;
+    // half again the previous bitrate, beyond the join tolerance of every group
+    for (int64_t bitrate = 2'000'000; ; bitrate = bitrate * 3 / 2) {
+        VideoEncoder *encoder = scheduler.acquire(bitrate);
+        if (!encoder) {
+            std::cout << std::setw(3) << groups.size() + 1 << " encoders: refused by the scheduler" << std::endl;
+            break;
+        }
+        groups.push_back({encoder, bitrate, std::make_unique<Delivery>()});
+        for (auto &group : groups) {
+            group.delivery->frames = 0;
+            group.delivery->late = 0;
+        }
+        encoder->Source<const FrameStats>::attachSink(groups.back().delivery.get());
+
+        feed(source, frames);
+        // the last frames leave the encoders
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        int64_t slowest = frames;
+        int64_t late = 0;
+        for (const auto &group : groups) {
+            slowest = std::min<int64_t>(slowest, group.delivery->frames);
+            late += group.delivery->late;
+        }
+        const bool keeps_up = slowest * 100 >= frames * SUSTAINED;
+        std::cout << std::setw(3) << groups.size() << " encoders: slowest at " << std::fixed << std::setprecision(1)
+                  << static_cast<double>(slowest) / seconds << " fps, " << static_cast<double>(late) * 100 / (frames * groups.size())
+                  << "% of the frames later than " << LATE / 1000 << "ms" << (keeps_up ? "" : ", falls behind") << std::endl;
+        if (!keeps_up) {
+            break;
+        }
+        sustained = groups.size();
+    }
+    std::cout << sustained << " concurrent encodes sustained" << std::endl;
+
+    for (auto &group : groups) {
+        group.encoder->Source<const FrameStats>::detachSink(group.delivery.get());
+        scheduler.release(group.encoder);
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+// time from submitting a frame to its first and last RTP packet on the wire, and what slicing costs,
+// x264 on a synthetic 1080p60 picture at 15 Mbps sent to a local udp port read by the bench
+// libavcodec returns whole access units, so the first packet never leaves before the frame is coded:
+// slicing can only shorten the coding, this measures by how much
+// usage: slice_latency_bench [frames] [port]
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/H264Encoder.h"
+#include "../network/RTPVideoSender.h"
+#include "test_utils.h"
+
+constexpr int WIDTH = 1920;
+constexpr int HEIGHT = 1080;
+constexpr int64_t FRAME_INTERVAL = 1'000'000 / 60;
+// frames before the measure, the rate control settles
+constexpr int WARM_UP = 60;
+
+// arrival time, rtp timestamp and marker of each packet received
+struct Arrival {
+    int64_t time;
+    uint32_t timestamp;
+    bool marker;
+};
+
+static void run(const char *label, const std::string &x264_params, int frames, int port) {
+    const std::string name = std::string("slice bench ") + label;
+    H264Encoder encoder(false, name);
+    std::unordered_map<std::string, std::string> options = {
+            {"bitrate", "15000000"},
+            {"width", std::to_string(WIDTH)},
+            {"height", std::to_string(HEIGHT)},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    };
+    if (!x264_params.empty()) {
+        options["x264-params"] = x264_params;
+    }
+    encoder.init(options);
+
+    // rtcp goes to the next port, read it too so the sender gets no icmp error
+    const int rtp_socket = bindUdpSocket(port);
+    const int rtcp_socket = bindUdpSocket(port + 1);
+    std::atomic<bool> stop = false;
+    std::vector<Arrival> arrivals;
+    std::thread receiver([&] {
+        uint8_t buffer[2048];
+        while (!stop) {
+            const ssize_t size = recv(rtp_socket, buffer, sizeof(buffer), 0);
+            if (size >= 12) {
+                const uint32_t timestamp = (buffer[4] << 24) | (buffer[5] << 16) | (buffer[6] << 8) | buffer[7];
+                arrivals.push_back({av_gettime(), timestamp, (buffer[1] & 0x80) != 0});
+            }
+            recv(rtcp_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        }
+    });
+
+    RTPVideoSender sender;
+    sender.init(("rtp://127.0.0.1:" + std::to_string(port)).c_str(), encoder.getContext());
+    sender.start();
+    encoder.Source<AVPacket>::attachSink(&sender);
+    encoder.startDrain();
+
+    AVFrame *picture = allocFrame(AV_PIX_FMT_YUV420P, WIDTH, HEIGHT);
+    std::vector<int64_t> submit_times;
+    int64_t next = av_gettime_relative();
+    for (int i = 0; i < WARM_UP + frames; ++i) {
+        av_frame_make_writable(picture);
+        drawMovingBand(picture, i);
+        AVFrame *frame = av_frame_clone(picture);
+        frame->pts = av_gettime();
+        submit_times.push_back(frame->pts);
+        encoder.handle(frame);
+
+        next += FRAME_INTERVAL;
+        const int64_t wait = next - av_gettime_relative();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(wait));
+        }
+    }
+    // the last packets reach the socket
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    encoder.stop();
+    sender.stop();
+    encoder.Source<AVPacket>::detachSink(&sender);
+    stop = true;
+    receiver.join();
+    close(rtp_socket);
+    close(rtcp_socket);
+    av_frame_free(&picture);
+
+    // frames are sent in order, the n-th timestamp seen is the n-th frame submitted
+    Histogram &first_packet = Metrics::histogram(name + ": submit to first packet (us)");
+    Histogram &last_packet = Metrics::histogram(name + ": submit to last packet (us)");
+    size_t frame = 0;
+    size_t packets = 0;
+    for (size_t i = 0; i < arrivals.size() && frame < submit_times.size(); ++i) {
+        if (i > 0 && arrivals[i].timestamp != arrivals[i - 1].timestamp) {
+            ++frame;
+        }
+        if (frame < static_cast<size_t>(WARM_UP) || frame >= submit_times.size()) {
+            continue;
+        }
+        ++packets;
+        if (i == 0 || arrivals[i].timestamp != arrivals[i - 1].timestamp) {
+            first_packet.record(arrivals[i].time - submit_times[frame]);
+        }
+        if (arrivals[i].marker) {
+            last_packet.record(arrivals[i].time - submit_times[frame]);
+        }
+    }
+
+    std::cout << std::setw(18) << label << ": " << std::fixed << std::setprecision(1)
+              << static_cast<double>(packets) / frames << " packets/frame, mean qp "
+              << Metrics::histogram(name + ": frame qp").getMean() << std::endl;
+    std::cout << std::setw(20) << "first packet (us) ";
+    first_packet.print(std::cout);
+    std::cout << std::endl << std::setw(20) << "last packet (us) ";
+    last_packet.print(std::cout);
+    std::cout << std::endl;
+    if (frame + 1 < submit_times.size()) {
+        std::cout << std::setw(20) << "" << submit_times.size() - frame - 1 << " frames not received" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    const int frames = argc > 1 ? std::atoi(argv[1]) : 1200;
+    const int port = argc > 2 ? std::atoi(argv[2]) : 5006;
+    std::cout << frames << " frames at " << WIDTH << "x" << HEIGHT << " 60 fps, 15 Mbps, x264 veryfast zerolatency" << std::endl;
+    // zerolatency already codes each frame with all threads at once, one slice per thread
+    run("sliced threads", "", frames, port);
+    // one frame per thread, as without zerolatency: a frame of delay per thread
+    run("frame threads", "sliced-threads=0", frames, port);
+    // slices of one rtp packet each, no fragmentation, more slices than threads
+    run("1200 byte slices", "slice-max-size=1200", frames, port);
+    return 0;
+}
@@ -0,0 +1,144 @@
+// time from the start of the pipeline setup to the first RTP video packet on a local udp port, probing with
+// sequential initialization against fast start with the capture and the encoder initialized in parallel,
+// and for the first run the time from the process start
+// usage: startup_bench [runs] [port], needs an X display
+
+#include <iostream>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include <libavdevice/avdevice.h>
+#include <libavutil/time.h>
+};
+
+#include "../video/X11Grabber.h"
+#include "../video/FrameConverter.h"
+#include "../video/H264Encoder.h"
+#include "../network/RTPVideoSender.h"
+#include "../timing.h"
+#include "test_utils.h"
+
+// setup to the first rtp packet received (ms), and process start to it; -1 when none came within 10s
+struct Startup {
+    int64_t from_setup;
+    int64_t from_process_start;
+};
+
+static Startup runOnce(bool fast_start, int port) {
+    const int64_t start = av_gettime();
+    X11Grabber grabber;
+    FrameConverter converter;
+    H264Encoder encoder(false, fast_start ? "fast start encoder" : "probing encoder");
+    RTPVideoSender sender;
+
+    std::unordered_map<std::string, std::string> grabber_options = {
+            {"video_size", "1920x1080"},
+            {"framerate", "60"},
+            {"draw_mouse", "0"},
+            {"fast_start", fast_start ? "1" : "0"},
+    };
+    if (!fast_start) {
+        // what the grabber used before fast start
+        grabber_options["probesize"] = "32M";
+    }
+    const std::unordered_map<std::string, std::string> encoder_options = {
+            {"bitrate", "15000000"},
+            {"width", "1920"},
+            {"height", "1080"},
+            {"framerate", "60"},
+            {"gop_size", "120"},
+            {"pixel_format", std::to_string(AV_PIX_FMT_YUV420P)},
+            {"preset", "veryfast"},
+            {"tune", "zerolatency"},
+    };
+
+    if (fast_start) {
+        auto capture = std::async(std::launch::async, [&grabber, &grabber_options] { grabber.init(grabber_options); });
+        encoder.init(encoder_options);
+        capture.get();
+    } else {
+        grabber.init(grabber_options);
+        encoder.init(encoder_options);
+    }
+
+    // after the inits, which may throw; rtcp goes to the next port, bound too so the sender gets no icmp error
+    const int rtp_socket = bindUdpSocket(port);
+    const int rtcp_socket = bindUdpSocket(port + 1);
+    sender.init(("rtp://127.0.0.1:" + std::to_string(port)).c_str(), encoder.getContext());
+    sender.start();
+    encoder.Source<AVPacket>::attachSink(&sender);
+    encoder.startDrain();
+    converter.init(grabber.getContext(), encoder.getContext(), 2);
+    converter.attachSink(&encoder);
+    converter.start();
+    grabber.Source<AVFrame>::attachSink(&converter);
+    grabber.start();
+
+    // the receive times out every 100ms
+    Startup startup = {-1, -1};
+    uint8_t buffer[2048];
+    const int64_t deadline = av_gettime() + 10'000'000;
+    while (av_gettime() < deadline) {
+        if (recv(rtp_socket, buffer, sizeof(buffer), 0) > 0) {
+            startup = {(av_gettime() - start) / 1000, millisecondsSinceStart()};
+            break;
+        }
+    }
+
+    grabber.stop();
+    converter.stop();
+    encoder.stop();
+    sender.stop();
+    encoder.Source<AVPacket>::detachSink(&sender);
+    close(rtp_socket);
+    close(rtcp_socket);
+    return startup;
+}
+
+int main(int argc, char **argv) {
+    avdevice_register_all();
+    avformat_network_init();
+    const int runs = argc > 1 ? std::max(1, std::atoi(argv[1])) : 5;
+    const int port = argc > 2 ? std::atoi(argv[2]) : 5008;
+    bool first_run = true;
+    for (const bool fast_start : {false, true}) {
+        std::vector<int64_t> times;
+        int failed = 0;
+        for (int i = 0; i < runs; ++i) {
+            try {
+                const Startup startup = runOnce(fast_start, port);
+                if (first_run && startup.from_process_start >= 0) {
+                    std::cout << "first run: " << startup.from_process_start << "ms from the process start to the first rtp packet" << std::endl;
+                }
+                first_run = false;
+                if (startup.from_setup >= 0) {
+                    times.push_back(startup.from_setup);
+                } else {
+                    ++failed;
+                }
+            } catch (const std::exception &e) {
+                std::cerr << e.what() << std::endl;
+                first_run = false;
+                ++failed;
+            }
+        }
+        std::cout << (fast_start ? "fast start, parallel init" : "probing, sequential init") << ": ";
+        if (times.empty()) {
+            std::cout << "no rtp packet";
+        } else {
+            std::sort(times.begin(), times.end());
+            std::cout << "median " << times[times.size() / 2] << "ms, min " << times.front() << "ms, max " << times.back()
+                      << "ms to the first rtp packet";
+        }
+        std::cout << ", " << failed << " failed or timed out runs of " << runs << std::endl;
+    }
+    return 0;
+}
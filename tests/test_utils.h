@@ -0,0 +1,83 @@
+#ifndef REMOTE_DESKTOP_TEST_UTILS_H
+#define REMOTE_DESKTOP_TEST_UTILS_H
+
+// helpers shared by the tests and benches, each one is a single translation unit
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+extern "C" {
+#include <libavutil/frame.h>
+};
+
+inline int failures = 0;
+
+inline void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cerr << "FAIL " << what << std::endl;
+        ++failures;
+    }
+}
+
+// prints the outcome, the exit code of a test
+inline int testResult() {
+    std::cout << (failures ? "failed" : "passed") << std::endl;
+    return failures ? 1 : 0;
+}
+
+// exits when out of memory, nothing to measure then
+inline AVFrame* allocFrame(AVPixelFormat format, int width, int height) {
+    AVFrame *frame = av_frame_alloc();
+    if (frame) {
+        frame->format = format;
+        frame->width = width;
+        frame->height = height;
+    }
+    if (!frame || av_frame_get_buffer(frame, 64) < 0) {
+        std::cerr << "could not allocate frame" << std::endl;
+        std::exit(2);
+    }
+    return frame;
+}
+
+// a moving band over a still YUV420P picture, so the encoder outputs p frames of a realistic size
+inline void drawMovingBand(AVFrame *frame, int index) {
+    const int band = (index * 8) % frame->height;
+    for (int j = 0; j < frame->height; ++j) {
+        std::memset(frame->data[0] + j * frame->linesize[0], j >= band && j < band + 64 ? 235 : (j * 3) & 0xFF, frame->width);
+    }
+    for (int p = 1; p < 3; ++p) {
+        for (int j = 0; j < frame->height / 2; ++j) {
+            std::memset(frame->data[p] + j * frame->linesize[p], 128 + ((j + index) & 15), frame->width / 2);
+        }
+    }
+}
+
+// udp socket on a local port, receives wait 100ms at most
+inline int bindUdpSocket(int port) {
+    const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        std::cerr << "could not create socket" << std::endl;
+        std::exit(2);
+    }
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = inet_addr("127.0.0.1");
+    const int buffer_size = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    const timeval timeout = {0, 100'000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        std::cerr << "could not bind port " << port << std::endl;
+        std::exit(2);
+    }
+    return fd;
+}
+
+#endif //REMOTE_DESKTOP_TEST_UTILS_H
@@ -0,0 +1,21 @@
+#ifndef REMOTE_DESKTOP_TIMING_H
+#define REMOTE_DESKTOP_TIMING_H
+
+#include <chrono>
+#include <ctime>
+
+// set during static initialization, close enough to the process start
+inline const std::chrono::steady_clock::time_point process_start_time = std::chrono::steady_clock::now();
+
+inline int64_t millisecondsSinceStart() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - process_start_time).count();
+}
+
+// cpu time used by the calling thread, to tell the work of a stage from the time it waited for the cpu
+inline int64_t threadCpuMicroseconds() {
+    timespec time = {};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+    return time.tv_sec * 1'000'000LL + time.tv_nsec / 1000;
+}
+
+#endif //REMOTE_DESKTOP_TIMING_H
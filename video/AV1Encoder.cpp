@@ -0,0 +1,35 @@
+#include <algorithm>
+
+#include "AV1Encoder.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+AV1Encoder::AV1Encoder(const std::string &name) : VideoEncoder(false, name) {
+
+}
+
+AVCodec *AV1Encoder::findCodec(const std::unordered_map<std::string, std::string> &) {
+    return avcodec_find_encoder_by_name("libsvtav1");
+}
+
+bool AV1Encoder::allowsPreset(const std::string &preset) const {
+    // svt-av1 presets are numbers, the ones under 8 do not keep up in real time
+    static const std::vector<std::string> presets = {"8", "9", "10", "11", "12", "13"};
+    return std::find(presets.begin(), presets.end(), preset) != presets.end();
+}
+
+bool AV1Encoder::readsRateLive() const {
+    // libsvtav1 gives no way to change the target bitrate of an open encoder
+    return false;
+}
+
+void AV1Encoder::setDefaults() {
+    // fastest preset, no lookahead and a flat hierarchy, frames are not held back for the rate control
+    av_opt_set(codec_ctx->priv_data, "preset", "8", 0);
+    av_opt_set(codec_ctx->priv_data, "la_depth", "0", 0);
+    av_opt_set(codec_ctx->priv_data, "hielevel", "3level", 0);
+    av_opt_set(codec_ctx->priv_data, "rc", "cvbr", 0);
+    codec_ctx->max_b_frames = 0;
+}
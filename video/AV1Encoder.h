@@ -0,0 +1,21 @@
+#ifndef REMOTE_DESKTOP_AV1ENCODER_H
+#define REMOTE_DESKTOP_AV1ENCODER_H
+
+#include "VideoEncoder.h"
+
+// libsvtav1, its rate is only read at open
+// the RTP muxer of this FFmpeg can not packetize av1, the server only offers it once it can
+class AV1Encoder : public VideoEncoder {
+public:
+    explicit AV1Encoder(const std::string &name="av1 encoder");
+    ~AV1Encoder() override = default;
+
+protected:
+    AVCodec *findCodec(const std::unordered_map<std::string, std::string> &params) override;
+    void setDefaults() override;
+    bool allowsPreset(const std::string &preset) const override;
+    bool readsRateLive() const override;
+};
+
+
+#endif //REMOTE_DESKTOP_AV1ENCODER_H
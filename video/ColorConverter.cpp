@@ -0,0 +1,313 @@
+#include <immintrin.h>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+#include "ColorConverter.h"
+
+// Q15 for luma, the 4 pixels sum of chroma adds 2 bits
+constexpr int LUMA_SHIFT = 15;
+constexpr int CHROMA_SHIFT = 17;
+constexpr int32_t CHROMA_OFFSET = (128 << CHROMA_SHIFT) + (1 << (CHROMA_SHIFT - 1));
+
+bool ColorConverter::supports(AVPixelFormat source_format, AVPixelFormat sink_format) {
+    return (source_format == AV_PIX_FMT_BGR0 || source_format == AV_PIX_FMT_BGRA) &&
+           (sink_format == AV_PIX_FMT_YUV420P || sink_format == AV_PIX_FMT_NV12);
+}
+
+void ColorConverter::init(AVPixelFormat sink_format, AVColorSpace colorspace, AVColorRange range) {
+    nv12 = sink_format == AV_PIX_FMT_NV12;
+
+    double kr = 0.299;
+    double kb = 0.114;
+    if (colorspace == AVCOL_SPC_BT709) {
+        kr = 0.2126;
+        kb = 0.0722;
+    }
+    const bool full = range == AVCOL_RANGE_JPEG;
+    const double y_scale = full ? 1. : 219. / 255.;
+    const double c_scale = full ? 1. : 224. / 255.;
+
+    const auto q15 = [](double v) { return static_cast<int32_t>(std::lround(v * (1 << LUMA_SHIFT))); };
+    // coefficients are in memory order (B, G, R), G absorbs the rounding so grey stays exact
+    const int32_t y_sum = q15(y_scale);
+    coefficients.y[0] = q15(kb * y_scale);
+    coefficients.y[2] = q15(kr * y_scale);
+    coefficients.y[1] = y_sum - coefficients.y[0] - coefficients.y[2];
+    coefficients.u[0] = q15(0.5 * c_scale);
+    coefficients.u[2] = q15(-kr / (2. * (1. - kb)) * c_scale);
+    coefficients.u[1] = -coefficients.u[0] - coefficients.u[2];
+    coefficients.v[2] = q15(0.5 * c_scale);
+    coefficients.v[0] = q15(-kb / (2. * (1. - kr)) * c_scale);
+    coefficients.v[1] = -coefficients.v[0] - coefficients.v[2];
+    coefficients.y_offset = ((full ? 0 : 16) << LUMA_SHIFT) + (1 << (LUMA_SHIFT - 1));
+
+    kernel = Kernel::Scalar;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = Kernel::AVX2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        kernel = Kernel::SSE41;
+    }
+}
+
+ColorConverter::Kernel ColorConverter::getKernel() const {
+    return kernel;
+}
+
+const char* ColorConverter::getKernelName() const {
+    switch (kernel) {
+        case Kernel::AVX2:
+            return "avx2";
+        case Kernel::SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
+
+const ColorConverter::Coefficients& ColorConverter::getCoefficients() const {
+    return coefficients;
+}
+
+void ColorConverter::convert(const AVFrame *source, AVFrame *sink, int x, int y, int width, int height) const {
+    const uint8_t *src = source->data[0] + y * source->linesize[0] + 4 * x;
+    uint8_t *const dst[3] = {
+            sink->data[0] + y * sink->linesize[0] + x,
+            sink->data[1] + y / 2 * sink->linesize[1] + (nv12 ? x : x / 2),
+            nv12 ? nullptr : sink->data[2] + y / 2 * sink->linesize[2] + x / 2,
+    };
+    const int dst_stride[3] = {sink->linesize[0], sink->linesize[1], nv12 ? 0 : sink->linesize[2]};
+    switch (kernel) {
+        case Kernel::AVX2:
+            convertAVX2(coefficients, nv12, src, source->linesize[0], dst, dst_stride, width, height);
+            break;
+        case Kernel::SSE41:
+            convertSSE41(coefficients, nv12, src, source->linesize[0], dst, dst_stride, width, height);
+            break;
+        default:
+            convertScalar(coefficients, nv12, src, source->linesize[0], dst, dst_stride, width, height);
+            break;
+    }
+}
+
+void ColorConverter::convert(const AVFrame *source, AVFrame *sink) const {
+    convert(source, sink, 0, 0, source->width, source->height);
+}
+
+static inline uint8_t clip(int32_t v) {
+    return static_cast<uint8_t>(std::clamp(v, 0, 255));
+}
+
+static inline uint8_t luma(const ColorConverter::Coefficients &c, const uint8_t *p) {
+    return clip((c.y[0] * p[0] + c.y[1] * p[1] + c.y[2] * p[2] + c.y_offset) >> LUMA_SHIFT);
+}
+
+void ColorConverter::convertScalar(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height) {
+    for (int j = 0; j < height; j += 2) {
+        // odd size, the missing row or column repeats the last one
+        const bool second_row = j + 1 < height;
+        const uint8_t *s0 = src + j * src_stride;
+        const uint8_t *s1 = second_row ? s0 + src_stride : s0;
+        uint8_t *y0 = dst[0] + j * dst_stride[0];
+        uint8_t *y1 = y0 + dst_stride[0];
+        uint8_t *u = dst[1] + j / 2 * dst_stride[1];
+        uint8_t *v = nv12 ? nullptr : dst[2] + j / 2 * dst_stride[2];
+        for (int i = 0; i < width; i += 2) {
+            const bool second_column = i + 1 < width;
+            const uint8_t *p00 = s0 + 4 * i;
+            const uint8_t *p01 = second_column ? p00 + 4 : p00;
+            const uint8_t *p10 = s1 + 4 * i;
+            const uint8_t *p11 = second_column ? p10 + 4 : p10;
+
+            y0[i] = luma(c, p00);
+            if (second_column) {
+                y0[i + 1] = luma(c, p01);
+            }
+            if (second_row) {
+                y1[i] = luma(c, p10);
+                if (second_column) {
+                    y1[i + 1] = luma(c, p11);
+                }
+            }
+
+            const int32_t b = p00[0] + p01[0] + p10[0] + p11[0];
+            const int32_t g = p00[1] + p01[1] + p10[1] + p11[1];
+            const int32_t r = p00[2] + p01[2] + p10[2] + p11[2];
+            const uint8_t cb = clip((c.u[0] * b + c.u[1] * g + c.u[2] * r + CHROMA_OFFSET) >> CHROMA_SHIFT);
+            const uint8_t cr = clip((c.v[0] * b + c.v[1] * g + c.v[2] * r + CHROMA_OFFSET) >> CHROMA_SHIFT);
+            if (nv12) {
+                u[i] = cb;
+                u[i + 1] = cr;
+            } else {
+                u[i / 2] = cb;
+                v[i / 2] = cr;
+            }
+        }
+    }
+}
+
+// right stripe and last odd row the vector loop left
+static void convertTail(const ColorConverter::Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height, int done_width, int done_height) {
+    if (done_width < width && done_height > 0) {
+        uint8_t *const stripe[3] = {
+                dst[0] + done_width,
+                dst[1] + (nv12 ? done_width : done_width / 2),
+                nv12 ? nullptr : dst[2] + done_width / 2,
+        };
+        ColorConverter::convertScalar(c, nv12, src + 4 * done_width, src_stride, stripe, dst_stride, width - done_width, done_height);
+    }
+    if (done_height < height) {
+        uint8_t *const row[3] = {
+                dst[0] + done_height * dst_stride[0],
+                dst[1] + done_height / 2 * dst_stride[1],
+                nv12 ? nullptr : dst[2] + done_height / 2 * dst_stride[2],
+        };
+        ColorConverter::convertScalar(c, nv12, src + done_height * src_stride, src_stride, row, dst_stride, width, height - done_height);
+    }
+}
+
+// 4 BGR0 pixels to 4 int32 luma
+__attribute__((target("sse4.1")))
+static inline __m128i luma4(__m128i px, __m128i cy, __m128i offset) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), cy);
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), cy);
+    return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), offset), LUMA_SHIFT);
+}
+
+// 2x4 BGR0 pixels to the 4 channels sums of the 2 chroma samples, as 16 bits
+__attribute__((target("sse4.1")))
+static inline __m128i blockSums(__m128i px0, __m128i px1) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(px0, zero), _mm_unpacklo_epi8(px1, zero));
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(px0, zero), _mm_unpackhi_epi8(px1, zero));
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+__attribute__((target("sse4.1")))
+void ColorConverter::convertSSE41(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height) {
+    const __m128i cy = _mm_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+    const __m128i cu = _mm_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+    const __m128i cv = _mm_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+    const __m128i y_offset = _mm_set1_epi32(c.y_offset);
+    const __m128i c_offset = _mm_set1_epi32(CHROMA_OFFSET);
+
+    const int simd_width = width & ~7;
+    const int simd_height = height & ~1;
+    for (int j = 0; j < simd_height; j += 2) {
+        const uint8_t *s0 = src + j * src_stride;
+        const uint8_t *s1 = s0 + src_stride;
+        uint8_t *y0 = dst[0] + j * dst_stride[0];
+        uint8_t *y1 = y0 + dst_stride[0];
+        uint8_t *u = dst[1] + j / 2 * dst_stride[1];
+        uint8_t *v = nv12 ? nullptr : dst[2] + j / 2 * dst_stride[2];
+        for (int i = 0; i < simd_width; i += 8) {
+            const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 4 * i));
+            const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 4 * i + 16));
+            const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 4 * i));
+            const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 4 * i + 16));
+
+            const __m128i l0 = _mm_packs_epi32(luma4(a0, cy, y_offset), luma4(b0, cy, y_offset));
+            const __m128i l1 = _mm_packs_epi32(luma4(a1, cy, y_offset), luma4(b1, cy, y_offset));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(y0 + i), _mm_packus_epi16(l0, l0));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(y1 + i), _mm_packus_epi16(l1, l1));
+
+            const __m128i sa = blockSums(a0, a1);
+            const __m128i sb = blockSums(b0, b1);
+            const __m128i cb = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(_mm_madd_epi16(sa, cu), _mm_madd_epi16(sb, cu)), c_offset), CHROMA_SHIFT);
+            const __m128i cr = _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(_mm_madd_epi16(sa, cv), _mm_madd_epi16(sb, cv)), c_offset), CHROMA_SHIFT);
+            // bytes U0-3 V0-3
+            const __m128i uv = _mm_packus_epi16(_mm_packs_epi32(cb, cr), _mm_setzero_si128());
+            if (nv12) {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(u + i), _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 4)));
+            } else {
+                const int32_t cb4 = _mm_cvtsi128_si32(uv);
+                const int32_t cr4 = _mm_cvtsi128_si32(_mm_srli_si128(uv, 4));
+                std::memcpy(u + i / 2, &cb4, sizeof(cb4));
+                std::memcpy(v + i / 2, &cr4, sizeof(cr4));
+            }
+        }
+    }
+
+    convertTail(c, nv12, src, src_stride, dst, dst_stride, width, height, simd_width, simd_height);
+}
+
+// 8 BGR0 pixels to 8 int32 luma, lane 0 holds pixels 0-3 and lane 1 pixels 4-7
+__attribute__((target("avx2")))
+static inline __m256i luma8(__m256i px, __m256i cy, __m256i offset) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), cy);
+    const __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), cy);
+    return _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(lo, hi), offset), LUMA_SHIFT);
+}
+
+// 2x8 BGR0 pixels to the 4 channels sums of the 4 chroma samples, samples 0-1 in lane 0 and 2-3 in lane 1
+__attribute__((target("avx2")))
+static inline __m256i blockSums(__m256i px0, __m256i px1) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(px0, zero), _mm256_unpacklo_epi8(px1, zero));
+    __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(px0, zero), _mm256_unpackhi_epi8(px1, zero));
+    lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+    hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+    return _mm256_unpacklo_epi64(lo, hi);
+}
+
+__attribute__((target("avx2")))
+void ColorConverter::convertAVX2(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height) {
+    const __m256i cy = _mm256_setr_epi16(c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0,
+                                         c.y[0], c.y[1], c.y[2], 0, c.y[0], c.y[1], c.y[2], 0);
+    const __m256i cu = _mm256_setr_epi16(c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0,
+                                         c.u[0], c.u[1], c.u[2], 0, c.u[0], c.u[1], c.u[2], 0);
+    const __m256i cv = _mm256_setr_epi16(c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0,
+                                         c.v[0], c.v[1], c.v[2], 0, c.v[0], c.v[1], c.v[2], 0);
+    const __m256i y_offset = _mm256_set1_epi32(c.y_offset);
+    const __m256i c_offset = _mm256_set1_epi32(CHROMA_OFFSET);
+    // packs work per lane, gather the low dwords of both lanes back in order
+    const __m256i lanes = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const __m128i chroma_order = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15);
+
+    const int simd_width = width & ~15;
+    const int simd_height = height & ~1;
+    for (int j = 0; j < simd_height; j += 2) {
+        const uint8_t *s0 = src + j * src_stride;
+        const uint8_t *s1 = s0 + src_stride;
+        uint8_t *y0 = dst[0] + j * dst_stride[0];
+        uint8_t *y1 = y0 + dst_stride[0];
+        uint8_t *u = dst[1] + j / 2 * dst_stride[1];
+        uint8_t *v = nv12 ? nullptr : dst[2] + j / 2 * dst_stride[2];
+        for (int i = 0; i < simd_width; i += 16) {
+            const __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s0 + 4 * i));
+            const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s0 + 4 * i + 32));
+            const __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1 + 4 * i));
+            const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s1 + 4 * i + 32));
+
+            __m256i l0 = _mm256_packs_epi32(luma8(a0, cy, y_offset), luma8(b0, cy, y_offset));
+            __m256i l1 = _mm256_packs_epi32(luma8(a1, cy, y_offset), luma8(b1, cy, y_offset));
+            l0 = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(l0, l0), lanes);
+            l1 = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(l1, l1), lanes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + i), _mm256_castsi256_si128(l0));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + i), _mm256_castsi256_si128(l1));
+
+            // lane 0 holds samples 0, 1, 4, 5 and lane 1 samples 2, 3, 6, 7
+            const __m256i sa = blockSums(a0, a1);
+            const __m256i sb = blockSums(b0, b1);
+            const __m256i cb = _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(_mm256_madd_epi16(sa, cu), _mm256_madd_epi16(sb, cu)), c_offset), CHROMA_SHIFT);
+            const __m256i cr = _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(_mm256_madd_epi16(sa, cv), _mm256_madd_epi16(sb, cv)), c_offset), CHROMA_SHIFT);
+            __m256i packed = _mm256_packs_epi32(cb, cr);
+            packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(packed, packed), lanes);
+            // bytes U0-7 V0-7
+            const __m128i uv = _mm_shuffle_epi8(_mm256_castsi256_si128(packed), chroma_order);
+            if (nv12) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i), _mm_unpacklo_epi8(uv, _mm_srli_si128(uv, 8)));
+            } else {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(u + i / 2), uv);
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(v + i / 2), _mm_srli_si128(uv, 8));
+            }
+        }
+    }
+
+    convertTail(c, nv12, src, src_stride, dst, dst_stride, width, height, simd_width, simd_height);
+}
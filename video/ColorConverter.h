@@ -0,0 +1,57 @@
+#ifndef REMOTE_DESKTOP_COLORCONVERTER_H
+#define REMOTE_DESKTOP_COLORCONVERTER_H
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+};
+
+#include <cstdint>
+
+// same size BGR0 to YUV420P/NV12 conversion, hand vectorized for the x11grab output
+// all kernels use the same fixed point math and give the same result
+class ColorConverter {
+public:
+    enum class Kernel {
+        Scalar,
+        SSE41,
+        AVX2,
+    };
+
+    // Q15 coefficients, chroma ones apply to the sum of a 2x2 block
+    struct Coefficients {
+        int16_t y[3];
+        int16_t u[3];
+        int16_t v[3];
+        int32_t y_offset;
+    };
+
+private:
+    Kernel kernel = Kernel::Scalar;
+    Coefficients coefficients = {};
+    bool nv12 = false;
+
+public:
+    ColorConverter() = default;
+    ~ColorConverter() = default;
+
+    static bool supports(AVPixelFormat source_format, AVPixelFormat sink_format);
+
+    // colorspace and range as set in the sink context (unspecified means BT.601 limited, as swscale)
+    void init(AVPixelFormat sink_format, AVColorSpace colorspace, AVColorRange range);
+    Kernel getKernel() const;
+    const char* getKernelName() const;
+    // for calling a given kernel directly, tests compare them with each other
+    const Coefficients& getCoefficients() const;
+
+    // convert the given rectangle, x and y must be even
+    void convert(const AVFrame *source, AVFrame *sink, int x, int y, int width, int height) const;
+    void convert(const AVFrame *source, AVFrame *sink) const;
+
+    static void convertScalar(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height);
+    static void convertSSE41(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height);
+    static void convertAVX2(const Coefficients &c, bool nv12, const uint8_t *src, int src_stride, uint8_t *const dst[3], const int dst_stride[3], int width, int height);
+};
+
+
+#endif //REMOTE_DESKTOP_COLORCONVERTER_H
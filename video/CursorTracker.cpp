@@ -0,0 +1,201 @@
+#include <unistd.h>
+#include <iostream>
+#include <algorithm>
+#include <X11/Xlib.h>
+#include <X11/extensions/Xfixes.h>
+
+#include "CursorTracker.h"
+#include "../exception.h"
+
+// shapes are rarely more than a few dozen, keep the cache bounded anyway
+constexpr size_t MAX_CACHED_SHAPES = 64;
+// follow_mouse value of "centered" in x11grab
+constexpr int FOLLOW_CENTER = -1;
+
+CursorTracker::CursorTracker() : name("cursor tracker") {
+
+}
+
+CursorTracker::~CursorTracker() {
+    std::cout << name << ": next lines are triggered by ~CursorTracker() call" << std::endl;
+    stop();
+    if (display) {
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+}
+
+void CursorTracker::init(const std::unordered_map<std::string, std::string> &params) {
+    // re-init check, close old connection
+    if (display) {
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+
+    display = XOpenDisplay(nullptr);
+    if (!display) {
+        throw InitFail("unable to open X display");
+    }
+
+    int xfixes_error_base;
+    if (!XFixesQueryExtension(display, &xfixes_event_base, &xfixes_error_base)) {
+        throw InitFail("XFixes extension is not available");
+    }
+
+    root = DefaultRootWindow(display);
+    XWindowAttributes attributes;
+    XGetWindowAttributes(display, root, &attributes);
+    requested_width = attributes.width;
+    requested_height = attributes.height;
+
+    for (const auto& [key, val] : params) {
+        if (key == "video_size") {
+            if (std::sscanf(val.c_str(), "%dx%d", &requested_width, &requested_height) != 2) {
+                throw InitFail("video_size is not valid");
+            }
+        } else if (key == "follow_mouse") {
+            if (val == "centered") {
+                follow_mouse = FOLLOW_CENTER;
+            } else {
+                follow_mouse = std::stoi(val);
+                if (follow_mouse < 0) {
+                    throw InitFail("follow_mouse must be centered or a distance in pixels");
+                }
+            }
+        } else if (key == "poll_rate") {
+            poll_interval = std::chrono::microseconds(1'000'000 / std::stoi(val));
+        } else {
+            std::cout << name << ": option " << key << " not found" << std::endl;
+        }
+    }
+
+    region_x = 0;
+    region_y = 0;
+    updateRegion(attributes.width, attributes.height);
+
+    // notified each time the displayed cursor changes, and when the screen is resized
+    XFixesSelectCursorInput(display, root, XFixesDisplayCursorNotifyMask);
+    XSelectInput(display, root, StructureNotifyMask);
+    shapes.clear();
+    updateShape();
+
+    initialized = true;
+    std::cerr << name << ": initialized" << std::endl;
+}
+
+void CursorTracker::start() {
+    if (initialized && stop_condition.load(std::memory_order_relaxed)) {
+        stop_condition.store(false, std::memory_order_relaxed);
+        thread = std::thread(&CursorTracker::run, this);
+    } else {
+        std::cout << name << ": not initialized or thread already running" << std::endl;
+    }
+}
+
+void CursorTracker::stop() {
+    if (!stop_condition.load(std::memory_order_relaxed)) {
+        stop_condition.store(true, std::memory_order_relaxed);
+        if (thread.joinable()) {
+            thread.join();
+        } else {
+            std::cout << name << ": thread is not joinable" << std::endl;
+        }
+    } else {
+        std::cout << name << ": thread is not running" << std::endl;
+    }
+}
+
+void CursorTracker::run() {
+    std::cerr << name << ": pid is " << gettid() << std::endl;
+    XEvent event;
+    Window root_return, child_return;
+    int root_x, root_y, win_x, win_y;
+    unsigned int mask;
+    CursorPosition last = {-1, -1, false, nullptr, 0, 0};
+    auto next = std::chrono::steady_clock::now();
+    while (!stop_condition.load(std::memory_order_relaxed)) {
+        next += poll_interval;
+        std::this_thread::sleep_until(next);
+
+        bool shape_changed = false;
+        while (XPending(display)) {
+            XNextEvent(display, &event);
+            if (event.type == xfixes_event_base + XFixesCursorNotify) {
+                shape_changed = true;
+            } else if (event.type == ConfigureNotify && event.xconfigure.window == root) {
+                updateRegion(event.xconfigure.width, event.xconfigure.height);
+            }
+        }
+
+        if (shape_changed) {
+            updateShape();
+        }
+
+        if (!XQueryPointer(display, root, &root_return, &child_return, &root_x, &root_y, &win_x, &win_y, &mask)) {
+            continue;
+        }
+
+        // same region computation as x11grab, which moves its region at each frame grabbed instead of each poll:
+        // with an edge distance both only agree once the pointer stays still
+        if (follow_mouse == FOLLOW_CENTER) {
+            region_x = root_x - region_width / 2;
+            region_y = root_y - region_height / 2;
+        } else if (follow_mouse > 0) {
+            if (root_x > region_x + region_width - follow_mouse) {
+                region_x = root_x - region_width + follow_mouse;
+            } else if (root_x < region_x + follow_mouse) {
+                region_x = root_x - follow_mouse;
+            }
+            if (root_y > region_y + region_height - follow_mouse) {
+                region_y = root_y - region_height + follow_mouse;
+            } else if (root_y < region_y + follow_mouse) {
+                region_y = root_y - follow_mouse;
+            }
+        }
+        region_x = std::clamp(region_x, 0, std::max(0, screen_width - region_width));
+        region_y = std::clamp(region_y, 0, std::max(0, screen_height - region_height));
+
+        CursorPosition position = {root_x - region_x, root_y - region_y, true, current_shape, region_width, region_height};
+        position.visible = position.x >= 0 && position.x < region_width && position.y >= 0 && position.y < region_height;
+        if (position.x != last.x || position.y != last.y || position.visible != last.visible || position.shape != last.shape ||
+            position.region_width != last.region_width || position.region_height != last.region_height) {
+            forward(&position);
+            last = std::move(position);
+        }
+    }
+}
+
+void CursorTracker::updateShape() {
+    XFixesCursorImage *image = XFixesGetCursorImage(display);
+    if (!image) {
+        return;
+    }
+
+    auto it = shapes.find(image->cursor_serial);
+    if (it == shapes.end()) {
+        if (shapes.size() >= MAX_CACHED_SHAPES) {
+            shapes.clear();
+        }
+
+        auto shape = std::make_shared<CursorImage>();
+        shape->serial = image->cursor_serial;
+        shape->width = image->width;
+        shape->height = image->height;
+        shape->xhot = image->xhot;
+        shape->yhot = image->yhot;
+        // XFixes stores each 32 bits pixel in an unsigned long
+        shape->pixels.assign(image->pixels, image->pixels + image->width * image->height);
+        it = shapes.emplace(image->cursor_serial, std::move(shape)).first;
+    }
+
+    current_shape = it->second;
+    XFree(image);
+}
+
+void CursorTracker::updateRegion(int width, int height) {
+    // same clipping as the x11 grabber
+    screen_width = width;
+    screen_height = height;
+    region_width = std::min(requested_width, screen_width);
+    region_height = std::min(requested_height, screen_height);
+}
@@ -0,0 +1,81 @@
+#ifndef REMOTE_DESKTOP_CURSORTRACKER_H
+#define REMOTE_DESKTOP_CURSORTRACKER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+
+#include "../Source.h"
+
+// cursor image as given by XFixes, pixels are premultiplied ARGB
+struct CursorImage {
+    unsigned long serial;
+    uint16_t width;
+    uint16_t height;
+    uint16_t xhot;
+    uint16_t yhot;
+    std::vector<uint32_t> pixels;
+};
+
+// position is relative to the region captured by the x11 grabber
+struct CursorPosition {
+    int x;
+    int y;
+    bool visible;
+    std::shared_ptr<const CursorImage> shape;
+    // size of the captured region, to scale the position to another resolution
+    int region_width;
+    int region_height;
+};
+
+class CursorTracker : public Source<const CursorPosition> {
+private:
+    std::string name;
+    bool initialized = false;
+
+    // Xlib types, kept opaque so its macros do not leak to every includer
+    struct _XDisplay *display = nullptr;
+    unsigned long root;
+    int xfixes_event_base;
+    int screen_width;
+    int screen_height;
+
+    // capture region, must match the x11 grabber options, clipped to the screen
+    int requested_width;
+    int requested_height;
+    int region_width;
+    int region_height;
+    // x11grab follow_mouse: 0 off, FOLLOW_CENTER, or the distance (pixels) to the region edge that moves it
+    int follow_mouse = 0;
+    // region origin when following the mouse by edge distance, it stays where the last move left it
+    int region_x = 0;
+    int region_y = 0;
+    std::chrono::microseconds poll_interval = std::chrono::microseconds(4000);
+
+    std::unordered_map<unsigned long, std::shared_ptr<const CursorImage>> shapes;
+    std::shared_ptr<const CursorImage> current_shape;
+
+    std::atomic<bool> stop_condition = true;
+    std::thread thread;
+
+public:
+    CursorTracker();
+    ~CursorTracker() override;
+
+    void init(const std::unordered_map<std::string, std::string> &params);
+
+    void start();
+    void stop();
+
+private:
+    void run();
+    void updateShape();
+    void updateRegion(int width, int height);
+};
+
+
+#endif //REMOTE_DESKTOP_CURSORTRACKER_H
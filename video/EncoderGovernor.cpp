@@ -0,0 +1,177 @@
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+
+#include "EncoderGovernor.h"
+#include "../exception.h"
+
+// frames averaged before each decision, a quarter of a second at 60 fps
+constexpr int64_t WINDOW_FRAMES = 15;
+
+EncoderGovernor::EncoderGovernor(const std::string &name) : name(name),
+        load(Metrics::histogram(name + ": load (%)")),
+        cpu_load(Metrics::histogram(name + ": codec cpu load (%)")),
+        steps_down(Metrics::counter(name + ": steps down")),
+        steps_up(Metrics::counter(name + ": steps up")) {
+
+}
+
+void EncoderGovernor::setEncoder(const Encoder *encoder) {
+    this->encoder = encoder;
+}
+
+void EncoderGovernor::init(const std::unordered_map<std::string, std::string> &params) {
+    for (const auto& [key, val] : params) {
+        if (key == "presets" || key == "framerates") {
+            std::istringstream list(val);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                if (key == "presets") {
+                    presets.push_back(item);
+                } else {
+                    framerates.push_back(std::stoi(item));
+                }
+            }
+        } else if (key == "high_load") {
+            high_load = std::stoi(val);
+        } else if (key == "low_load") {
+            low_load = std::stoi(val);
+        } else if (key == "settle_time") {
+            settle_time = std::stoll(val) * 1000;
+        } else if (key == "recovery_time") {
+            recovery_time = std::stoll(val) * 1000;
+        } else {
+            std::cout << name << ": option " << key << " not found" << std::endl;
+        }
+    }
+
+    if (!encoder) {
+        throw InitFail("governor needs an encoder");
+    } else if (std::any_of(framerates.begin(), framerates.end(), [](int f) { return f <= 0; })) {
+        throw InitFail("governor framerates must be positive");
+    } else if (low_load >= high_load) {
+        throw InitFail("governor low load must be below the high one");
+    }
+    undo.clear();
+    expected_preset = encoder->getParam("preset");
+    expected_framerate = encoder->getParam("framerate");
+    previous_preset = expected_preset;
+    previous_framerate = expected_framerate;
+    initialized = true;
+}
+
+void EncoderGovernor::handle(const FrameStats *stats) {
+    if (!initialized || stats->submit_time == AV_NOPTS_VALUE) {
+        return;
+    }
+
+    const int64_t now = stats->packet_time;
+    // the frames of the previous configuration, and the reopening stall, say nothing about the new one
+    if (last_step != AV_NOPTS_VALUE && now - last_step < settle_time) {
+        return;
+    }
+
+    if (stats->capture_time != AV_NOPTS_VALUE) {
+        window_capture += stats->submit_time - stats->capture_time;
+    }
+    // not submit to packet: with frame threads or an async codec it holds the frames queued in the pipeline
+    if (stats->codec_time >= 0) {
+        window_codec += stats->codec_time;
+        window_codec_cpu += stats->codec_cpu_time;
+    }
+    if (++window_frames < WINDOW_FRAMES) {
+        return;
+    }
+
+    // a sink of the encoder frame stats, its parameters are not replaced meanwhile
+    const std::string preset = encoder->getParam("preset");
+    const std::string framerate = encoder->getParam("framerate");
+    const int64_t frame_interval = 1'000'000 / std::max(1, framerate.empty() ? 0 : std::stoi(framerate));
+    const int64_t stage = std::max(window_capture, window_codec) / window_frames;
+    const int64_t current_load = stage * 100 / frame_interval;
+    // a codec call much longer than its cpu time waited for the cpu, or for the codec threads
+    const int64_t current_cpu_load = window_codec_cpu / window_frames * 100 / frame_interval;
+    window_capture = 0;
+    window_codec = 0;
+    window_codec_cpu = 0;
+    window_frames = 0;
+    load.record(current_load);
+    cpu_load.record(current_cpu_load);
+
+    const bool changed = preset != expected_preset || framerate != expected_framerate;
+    if (changed && preset == previous_preset && framerate == previous_framerate && now - last_step < 2 * settle_time) {
+        // the last step is not applied yet, reconfigures are spaced; a step still not applied after that was refused
+        return;
+    } else if (changed) {
+        // changed by a client: its choice is the new base, the governor does not step back above it
+        std::cout << name << ": encoder changed to preset " << preset << " at " << framerate << " fps, new base" << std::endl;
+        undo.clear();
+        expected_preset = preset;
+        expected_framerate = framerate;
+        previous_preset = preset;
+        previous_framerate = framerate;
+        return;
+    }
+
+    if (current_load > high_load) {
+        low_since = AV_NOPTS_VALUE;
+        stepDown(now);
+    } else if (current_load < low_load && current_cpu_load < low_load) {
+        if (low_since == AV_NOPTS_VALUE) {
+            low_since = now;
+        } else if (now - low_since >= recovery_time) {
+            stepUp(now);
+        }
+    } else {
+        low_since = AV_NOPTS_VALUE;
+    }
+}
+
+void EncoderGovernor::stepDown(int64_t now) {
+    EncoderChanges changes;
+    EncoderChanges previous;
+    // the next faster preset, then the next lower framerate, only the one parameter changed is sent
+    auto preset = std::find(presets.begin(), presets.end(), expected_preset);
+    if (preset != presets.end() && std::next(preset) != presets.end()) {
+        changes["preset"] = *std::next(preset);
+        previous["preset"] = expected_preset;
+    } else if (!expected_framerate.empty()) {
+        const int framerate = std::stoi(expected_framerate);
+        auto lower = std::find_if(framerates.begin(), framerates.end(), [framerate](int f) { return f < framerate; });
+        if (lower != framerates.end()) {
+            changes["framerate"] = std::to_string(*lower);
+            previous["framerate"] = expected_framerate;
+        }
+    }
+    if (changes.empty()) {
+        return;
+    }
+
+    steps_down.fetch_add(1, std::memory_order_relaxed);
+    undo.push_back(previous);
+    send(changes, now);
+}
+
+void EncoderGovernor::stepUp(int64_t now) {
+    if (undo.empty()) {
+        return;
+    }
+
+    steps_up.fetch_add(1, std::memory_order_relaxed);
+    const EncoderChanges changes = undo.back();
+    undo.pop_back();
+    send(changes, now);
+}
+
+void EncoderGovernor::send(const EncoderChanges &changes, int64_t now) {
+    last_step = now;
+    low_since = AV_NOPTS_VALUE;
+    previous_preset = expected_preset;
+    previous_framerate = expected_framerate;
+    for (const auto& [key, val] : changes) {
+        (key == "preset" ? expected_preset : expected_framerate) = val;
+    }
+    std::cout << name << ": " << undo.size() << " steps down, preset " << expected_preset << " at "
+              << expected_framerate << " fps" << std::endl;
+    forward(&changes);
+}
@@ -0,0 +1,74 @@
+#ifndef REMOTE_DESKTOP_ENCODERGOVERNOR_H
+#define REMOTE_DESKTOP_ENCODERGOVERNOR_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <unordered_map>
+
+#include "../Encoder.h"
+#include "../Source.h"
+#include "../Sink.h"
+#include "../metrics.h"
+
+// keeps a software encoder within the cpu left by the other processes: when a stage of the frames takes
+// most of the frame interval, it steps down through faster presets then lower framerates, and back up
+// once the load stays low long enough
+// steps are taken from the current parameters of the encoder, a client change becomes the new base
+class EncoderGovernor : public Sink<const FrameStats>, public Source<const EncoderChanges> {
+private:
+    std::string name;
+    bool initialized = false;
+
+    const Encoder *encoder = nullptr;
+    std::vector<std::string> presets;
+    std::vector<int> framerates;
+    // parameters each step down replaced, the last one is restored by the next step up
+    std::vector<EncoderChanges> undo;
+    // preset and framerate the encoder should have after the last step, a difference is a client change
+    std::string expected_preset;
+    std::string expected_framerate;
+    // the same before the last step, still seen while the encoder waits to reopen
+    std::string previous_preset;
+    std::string previous_framerate;
+
+    // load (percent of the frame interval) above which it steps down, and below which it may step up
+    int64_t high_load = 75;
+    int64_t low_load = 40;
+    // after a step, the time (us) to let the encoder reopen and the load settle
+    int64_t settle_time = 2'000'000;
+    // the load must stay low this long (us) before a step up
+    int64_t recovery_time = 5'000'000;
+
+    // frames of the current window: capture to submit, and the codec call of the feeding thread, wall and cpu
+    int64_t window_capture = 0;
+    int64_t window_codec = 0;
+    int64_t window_codec_cpu = 0;
+    int64_t window_frames = 0;
+    int64_t last_step = AV_NOPTS_VALUE;
+    int64_t low_since = AV_NOPTS_VALUE;
+
+    Histogram &load;
+    Histogram &cpu_load;
+    std::atomic<uint64_t> &steps_down;
+    std::atomic<uint64_t> &steps_up;
+
+public:
+    explicit EncoderGovernor(const std::string &name="encoder governor");
+
+    // encoder whose frame stats are handled and which is sent the changes, read for its current parameters
+    void setEncoder(const Encoder *encoder);
+    // presets and framerates to step down through, comma separated, from the slowest and the highest,
+    // high_load and low_load (%), settle_time and recovery_time (ms)
+    void init(const std::unordered_map<std::string, std::string> &params);
+
+    void handle(const FrameStats *stats) override;
+
+private:
+    void stepDown(int64_t now);
+    void stepUp(int64_t now);
+    void send(const EncoderChanges &changes, int64_t now);
+};
+
+
+#endif //REMOTE_DESKTOP_ENCODERGOVERNOR_H
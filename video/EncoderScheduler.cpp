@@ -0,0 +1,222 @@
+#include <pthread.h>
+#include <sched.h>
+#include <iostream>
+#include <thread>
+#include <algorithm>
+#include <cstdlib>
+
+#include "EncoderScheduler.h"
+#include "H264Encoder.h"
+#include "../exception.h"
+
+// a session joins a group asking for the bitrate within this margin (percent), and leaves it beyond the second one
+// the gap between them keeps sessions from moving back and forth as their bitrate moves
+constexpr int64_t JOIN_TOLERANCE = 25;
+constexpr int64_t LEAVE_TOLERANCE = 50;
+
+EncoderScheduler::EncoderScheduler(Source<AVFrame> &frame_source, bool use_nvenc) : name("encoder scheduler"),
+        frame_source(frame_source), use_nvenc(use_nvenc),
+        started(Metrics::counter(name + ": encoders started")),
+        over_budget(Metrics::counter(name + ": requests over budget")) {
+
+}
+
+EncoderScheduler::~EncoderScheduler() {
+    std::cout << name << ": next lines are triggered by ~EncoderScheduler() call" << std::endl;
+    std::vector<Group> closing;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        closing.swap(groups);
+    }
+    for (auto& group : closing) {
+        close(std::move(group.encoder));
+    }
+}
+
+void EncoderScheduler::init(const std::unordered_map<std::string, std::string> &params) {
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    size_t requested_encoders = 0;
+    encoder_params.clear();
+    for (const auto& [key, val] : params) {
+        if (key == "max_encoders") {
+            requested_encoders = std::stoul(val);
+        } else if (key == "cores_per_encoder") {
+            cores_per_encoder = std::max(1, std::stoi(val));
+        } else if (key == "first_core") {
+            first_core = std::clamp(std::stoi(val), 0, cores - 1);
+        } else {
+            encoder_params.emplace(key, val);
+        }
+    }
+
+    // no more encoders than the cores left can run, whatever was asked
+    const size_t budget = std::max(1, (cores - first_core) / cores_per_encoder);
+    max_encoders = requested_encoders ? std::min(requested_encoders, budget) : budget;
+    slots.assign(max_encoders, false);
+
+    initialized = true;
+    std::cerr << name << ": initialized, up to " << max_encoders << " encoders on " << cores_per_encoder << " cores each" << std::endl;
+}
+
+void EncoderScheduler::setContextSink(Sink<const AVCodecContext> *sink) {
+    std::lock_guard<std::mutex> guard(mutex);
+    // the running groups move to the new sink, a sink going away is not notified anymore
+    for (auto& group : groups) {
+        if (context_sink) {
+            group.encoder->Source<const AVCodecContext>::detachSink(context_sink);
+        }
+        if (sink) {
+            group.encoder->Source<const AVCodecContext>::attachSink(sink);
+        }
+    }
+    context_sink = sink;
+}
+
+void EncoderScheduler::setCursorSource(Source<const CursorPosition> *source) {
+    std::lock_guard<std::mutex> guard(mutex);
+    cursor_source = source;
+}
+
+VideoEncoder* EncoderScheduler::acquire(int64_t bitrate) {
+    if (!initialized || bitrate <= 0) {
+        return nullptr;
+    }
+
+    size_t slot;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        Group *closest = nullptr;
+        for (auto& group : groups) {
+            const int64_t distance = std::abs(bitrate - group.bitrate);
+            if (distance * 100 <= group.bitrate * JOIN_TOLERANCE && (!closest || distance < std::abs(bitrate - closest->bitrate))) {
+                closest = &group;
+            }
+        }
+        if (closest) {
+            ++closest->sessions;
+            return closest->encoder.get();
+        }
+
+        // slots of the encoders being opened are taken too
+        slot = std::find(slots.begin(), slots.end(), false) - slots.begin();
+        if (slot == slots.size()) {
+            over_budget.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        slots[slot] = true;
+    }
+
+    std::unique_ptr<VideoEncoder> encoder = create(bitrate, slot);
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!encoder) {
+        slots[slot] = false;
+        return nullptr;
+    }
+    groups.push_back({std::move(encoder), bitrate, 1, slot});
+    return groups.back().encoder.get();
+}
+
+void EncoderScheduler::release(VideoEncoder *encoder) {
+    std::unique_ptr<VideoEncoder> closing;
+    size_t slot;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = std::find_if(groups.begin(), groups.end(), [encoder](const Group &group) {
+            return group.encoder.get() == encoder;
+        });
+        if (it == groups.end() || --it->sessions > 0) {
+            return;
+        }
+        std::cout << name << ": group at " << it->bitrate / 1000 << "kbps closed" << std::endl;
+        closing = std::move(it->encoder);
+        slot = it->slot;
+        groups.erase(it);
+    }
+
+    close(std::move(closing));
+    // the cores are free once the encoder threads are gone
+    std::lock_guard<std::mutex> guard(mutex);
+    slots[slot] = false;
+}
+
+bool EncoderScheduler::fits(const VideoEncoder *encoder, int64_t bitrate) {
+    std::lock_guard<std::mutex> guard(mutex);
+    const Group *group = find(encoder);
+    return group && std::abs(bitrate - group->bitrate) * 100 <= group->bitrate * LEAVE_TOLERANCE;
+}
+
+EncoderScheduler::Group* EncoderScheduler::find(const VideoEncoder *encoder) {
+    for (auto& group : groups) {
+        if (group.encoder.get() == encoder) {
+            return &group;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<VideoEncoder> EncoderScheduler::create(int64_t bitrate, size_t slot) {
+    std::unique_ptr<VideoEncoder> encoder = std::make_unique<H264Encoder>(use_nvenc, "h264 encoder " + std::to_string(bitrate / 1000) + "kbps");
+    auto params = encoder_params;
+    params["bitrate"] = std::to_string(bitrate);
+
+    // codec threads and feed/drain threads inherit the affinity of the thread creating them
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    cpu_set_t previous;
+    cpu_set_t placement;
+    CPU_ZERO(&placement);
+    for (int i = 0; i < cores_per_encoder; ++i) {
+        CPU_SET((first_core + static_cast<int>(slot) * cores_per_encoder + i) % cores, &placement);
+    }
+    const bool pinned = pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0 &&
+                        pthread_setaffinity_np(pthread_self(), sizeof(placement), &placement) == 0;
+    try {
+        encoder->init(params);
+        encoder->start();
+    } catch (const std::exception &e) {
+        std::cout << name << ": fail to start an encoder at " << bitrate / 1000 << "kbps, " << e.what() << std::endl;
+        encoder.reset();
+    }
+    if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+    }
+    if (!encoder) {
+        return nullptr;
+    }
+
+    Sink<const AVCodecContext> *sink;
+    Source<const CursorPosition> *cursor;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        sink = context_sink;
+        cursor = cursor_source;
+    }
+    if (sink) {
+        encoder->Source<const AVCodecContext>::attachSink(sink);
+    }
+    if (cursor) {
+        cursor->attachSink(encoder.get());
+    }
+    frame_source.attachSink(encoder.get());
+    started.fetch_add(1, std::memory_order_relaxed);
+    std::cout << name << ": group at " << bitrate / 1000 << "kbps opened on slot " << slot << std::endl;
+    return encoder;
+}
+
+void EncoderScheduler::close(std::unique_ptr<VideoEncoder> encoder) {
+    // no more frames once detached, the encoder can be stopped
+    frame_source.detachSink(encoder.get());
+    Sink<const AVCodecContext> *sink;
+    Source<const CursorPosition> *cursor;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        sink = context_sink;
+        cursor = cursor_source;
+    }
+    if (cursor) {
+        cursor->detachSink(encoder.get());
+    }
+    if (sink) {
+        encoder->Source<const AVCodecContext>::detachSink(sink);
+    }
+    encoder->stop();
+}
@@ -0,0 +1,80 @@
+#ifndef REMOTE_DESKTOP_ENCODERSCHEDULER_H
+#define REMOTE_DESKTOP_ENCODERSCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "VideoEncoder.h"
+#include "CursorTracker.h"
+#include "../Source.h"
+#include "../Sink.h"
+
+// encoders at the main resolution for groups of sessions asking for similar bitrates, all fed from the shared frames
+// a bad connection only lowers the bitrate of its own group, the number of encoders is capped by a cpu budget
+// and each of them runs on its own cores
+class EncoderScheduler {
+private:
+    struct Group {
+        std::unique_ptr<VideoEncoder> encoder;
+        // bitrate the group was created for, sessions join it when they ask for about the same
+        int64_t bitrate;
+        size_t sessions;
+        size_t slot;
+    };
+
+    std::string name;
+    bool initialized = false;
+
+    Source<AVFrame> &frame_source;
+    bool use_nvenc;
+    // options given to each encoder, bitrate is the one of the group
+    std::unordered_map<std::string, std::string> encoder_params;
+    Sink<const AVCodecContext> *context_sink = nullptr;
+    Source<const CursorPosition> *cursor_source = nullptr;
+
+    // cpu budget, slot i runs on cores first_core + i * cores_per_encoder and the next ones
+    size_t max_encoders = 0;
+    int cores_per_encoder = 2;
+    int first_core = 0;
+    std::vector<bool> slots;
+
+    std::vector<Group> groups;
+    // held for the bookkeeping only, encoders are opened and stopped without it: a reopen notifies
+    // the context sink, which may be waiting on this scheduler meanwhile
+    std::mutex mutex;
+
+    std::atomic<uint64_t> &started;
+    std::atomic<uint64_t> &over_budget;
+
+public:
+    explicit EncoderScheduler(Source<AVFrame> &frame_source, bool use_nvenc=false);
+    ~EncoderScheduler();
+
+    // same options as VideoEncoder::init, plus max_encoders, cores_per_encoder and first_core
+    void init(const std::unordered_map<std::string, std::string> &params);
+    // notified each time an encoder of a group is opened, as with the other encoders
+    void setContextSink(Sink<const AVCodecContext> *sink);
+    // cursor position for the region of interest of the group encoders, set before the first acquire
+    void setCursorSource(Source<const CursorPosition> *source);
+
+    // encoder of the group closest to the bitrate, a new group if none is close and the budget allows, nullptr otherwise
+    VideoEncoder* acquire(int64_t bitrate);
+    // a session of the group leaves, the last one stops the encoder
+    // both may open or stop an encoder, call them without holding a lock the context sink takes
+    void release(VideoEncoder *encoder);
+    // whether a session asking for this bitrate may stay in the group of the encoder
+    bool fits(const VideoEncoder *encoder, int64_t bitrate);
+
+private:
+    Group* find(const VideoEncoder *encoder);
+    // opens an encoder on the slot reserved by the caller, mutex not held
+    std::unique_ptr<VideoEncoder> create(int64_t bitrate, size_t slot);
+    void close(std::unique_ptr<VideoEncoder> encoder);
+};
+
+
+#endif //REMOTE_DESKTOP_ENCODERSCHEDULER_H
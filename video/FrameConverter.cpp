@@ -1,13 +1,42 @@
 #include <unistd.h>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+};
 
 #include "FrameConverter.h"
 #include "../exception.h"
 
-FrameConverter::FrameConverter() : name("video frame converter"), queue(4) {
+// a frame converted ahead of its predecessor waits at most this long for it
+constexpr auto MAX_REORDER_WAIT = std::chrono::milliseconds(20);
+// dirty tracking granularity, even so tiles never split a chroma sample
+constexpr int TILE_WIDTH = 64;
+constexpr int TILE_HEIGHT = 16;
+
+FrameConverter::FrameConverter() : name("video frame converter"), frame_pool(name), queue(4),
+        conversion_time(Metrics::histogram(name + ": conversion (us)")),
+        converted_frames(Metrics::counter(name + ": converted frames")),
+        reorder_waits(Metrics::counter(name + ": reorder waits")),
+        late_drops(Metrics::counter(name + ": late drops")),
+        converted_tiles(Metrics::counter(name + ": converted tiles")),
+        reused_tiles(Metrics::counter(name + ": reused tiles")) {
+
+}
+
+FrameConverter::Tier::Tier(const std::string &name, int width, int height) : width(width), height(height), frame_pool(name) {
 
 }
 
+FrameConverter::Tier::~Tier() {
+    for (auto& context : contexts) {
+        sws_freeContext(context);
+    }
+}
+
 FrameConverter::~FrameConverter() {
     std::cout << name << ": next lines are triggered by ~FrameConverter() call" << std::endl;
     stop();
@@ -15,19 +44,41 @@ FrameConverter::~FrameConverter() {
         sws_freeContext(context);
         av_frame_free(&frame);
     }
+    av_frame_free(&previous_in);
+    av_frame_free(&previous_out);
 }
 
 /*void FrameConverter::init(const std::unordered_map<std::string, std::string> &params) {
 
 }*/
 
-void FrameConverter::init(AVCodecContext *source_ctx, AVCodecContext *sink_ctx, int concurrency) {
+void FrameConverter::init(AVCodecContext *source_ctx, AVCodecContext *sink_ctx, int concurrency, Parallelism parallelism, bool partial) {
     for (auto& [context, frame] : contexts) {
         sws_freeContext(context);
         av_frame_free(&frame);
     }
     contexts.clear();
 
+    this->parallelism = parallelism;
+    source_width = source_ctx->width;
+    source_height = source_ctx->height;
+    sink_width = sink_ctx->width;
+    sink_height = sink_ctx->height;
+    native_conversion = source_width == sink_width && source_height == sink_height && ColorConverter::supports(source_ctx->pix_fmt, sink_ctx->pix_fmt);
+    if (native_conversion) {
+        color_converter.init(sink_ctx->pix_fmt, sink_ctx->colorspace, sink_ctx->color_range);
+        std::cerr << name << ": using " << color_converter.getKernelName() << " color conversion" << std::endl;
+    }
+    partial_conversion = partial && native_conversion && (parallelism == Parallelism::Slice || concurrency == 1);
+    if (partial && !partial_conversion) {
+        std::cout << name << ": partial conversion needs the native conversion and ordered frames, disabled" << std::endl;
+    }
+    if (!previous_in) {
+        previous_in = av_frame_alloc();
+        previous_out = av_frame_alloc();
+    }
+    av_frame_unref(previous_in);
+    av_frame_unref(previous_out);
     for (int i = 0; i < concurrency; ++i) {
         SwsContext *context = sws_getContext(source_ctx->width, source_ctx->height, source_ctx->pix_fmt, sink_ctx->width, sink_ctx->height, sink_ctx->pix_fmt, SWS_AREA, NULL, NULL, NULL);
         AVFrame *frame = av_frame_alloc();
@@ -39,17 +90,54 @@ void FrameConverter::init(AVCodecContext *source_ctx, AVCodecContext *sink_ctx,
         frame->linesize[2] = av_image_get_linesize(sink_ctx->pix_fmt, sink_ctx->width, 2);*/
         contexts.emplace_back(context, frame);
     }
+    for (auto& tier : tiers) {
+        for (auto& context : tier->contexts) {
+            sws_freeContext(context);
+        }
+        tier->contexts.assign(concurrency, nullptr);
+    }
 
-    //buffer_pool = av_buffer_pool_init(av_image_get_buffer_size(sink_ctx->pix_fmt, sink_ctx->width, sink_ctx->height, 0), NULL); // example YUV420 = 12 * w * h
     initialized = true;
-    std::cerr << name << ": initialized" << std::endl;
+    std::cerr << name << ": initialized, " << concurrency << (parallelism == Parallelism::Slice ? " slice" : " frame") << " threads" << std::endl;
+}
+
+Source<AVFrame>& FrameConverter::addTier(int width, int height) {
+    auto& tier = tiers.emplace_back(std::make_unique<Tier>(name + " " + std::to_string(height) + "p", width, height));
+    tier->contexts.assign(contexts.size(), nullptr);
+    std::cerr << name << ": added " << width << "x" << height << " output" << std::endl;
+    return *tier;
+}
+
+void FrameConverter::setMemoryPolicy(const MemoryPolicy &policy) {
+    frame_pool.setMemoryPolicy(policy);
+    for (auto& tier : tiers) {
+        tier->frame_pool.setMemoryPolicy(policy);
+    }
+}
+
+void FrameConverter::setScheduler(CaptureScheduler *scheduler) {
+    this->scheduler = scheduler;
 }
 
 void FrameConverter::start() {
     if (initialized && stop_condition.load(std::memory_order_relaxed)) {
         stop_condition.store(false, std::memory_order_relaxed);
-        for (size_t i = 0; i < contexts.size(); ++i) {
-            threads.emplace_back(&FrameConverter::run, this, i);
+        if (parallelism == Parallelism::Slice) {
+            // read before any thread starts, a band thread reading it itself could miss the first job
+            uint64_t generation;
+            {
+                std::lock_guard<std::mutex> lock(slice_mutex);
+                slice_exit = false;
+                generation = slice_generation;
+            }
+            threads.emplace_back(&FrameConverter::runSlices, this);
+            for (size_t i = 1; i < contexts.size(); ++i) {
+                threads.emplace_back(&FrameConverter::runBand, this, i, generation);
+            }
+        } else {
+            for (size_t i = 0; i < contexts.size(); ++i) {
+                threads.emplace_back(&FrameConverter::run, this, i);
+            }
         }
     } else {
         std::cout << name << ": not initialized or thread already running" << std::endl;
@@ -66,53 +154,416 @@ void FrameConverter::stop() {
                 std::cout << name << ": thread is not joinable" << std::endl;
             }
         }
+        threads.clear();
     } else {
         std::cout << name << ": threads are not running" << std::endl;
     }
 }
 
 void FrameConverter::handle(AVFrame *frame) {
-    if (!queue.try_enqueue(frame)) {
+    // single producer, a number is only used by an enqueued frame so there are no gaps
+    if (queue.try_enqueue({input_sequence, frame})) {
+        ++input_sequence;
+    } else {
         std::cout << name << ": queue is full" << std::endl;
+        if (scheduler) {
+            scheduler->notifyDropped(frame->pts);
+        }
         av_frame_free(&frame);
     }
 }
 
+bool FrameConverter::prepare(const AVFrame *frame_in, AVFrame *frame_out, size_t i) {
+    // source geometry may change at any time (game switching resolution), output keeps the init scale
+    int width = sink_width;
+    int height = sink_height;
+    if (frame_in->width != source_width || frame_in->height != source_height) {
+        width = static_cast<int>(static_cast<int64_t>(frame_in->width) * sink_width / source_width) & ~1;
+        height = static_cast<int>(static_cast<int64_t>(frame_in->height) * sink_height / source_height) & ~1;
+    }
+    contexts[i].second->width = width;
+    contexts[i].second->height = height;
+
+    av_frame_copy_props(frame_out, frame_in);
+    frame_out->format = contexts[i].second->format;
+    frame_out->width = width;
+    frame_out->height = height;
+    if (frame_pool.get(frame_out) < 0) {
+        throw RunError("can't allocate buffer");
+    }
+
+    return native_conversion && frame_in->width == width && frame_in->height == height &&
+           ColorConverter::supports(static_cast<AVPixelFormat>(frame_in->format), static_cast<AVPixelFormat>(frame_out->format));
+}
+
 void FrameConverter::run(size_t i) {
+    std::pair<uint64_t, AVFrame*> job;
     AVFrame* frame_in = nullptr;
     AVFrame* frame_out = av_frame_alloc();
+    std::vector<AVFrame*> tier_frames(tiers.size());
+    for (auto& frame : tier_frames) {
+        frame = av_frame_alloc();
+    }
     try {
         while (!stop_condition.load(std::memory_order_relaxed)) {
-            if (!queue.wait_dequeue_timed(frame_in, std::chrono::milliseconds(100))) {
+            if (!queue.wait_dequeue_timed(job, std::chrono::milliseconds(100))) {
                 continue;
             }
+            frame_in = job.second;
+
+            const int64_t start = av_gettime_relative();
+            if (prepare(frame_in, frame_out, i)) {
+                if (canReusePrevious(frame_in, frame_out)) {
+                    convertPartial(frame_in, frame_out, 0, frame_out->height);
+                } else {
+                    color_converter.convert(frame_in, frame_out);
+                }
+            } else {
+                contexts[i].first = sws_getCachedContext(contexts[i].first, frame_in->width, frame_in->height, static_cast<AVPixelFormat>(frame_in->format),
+                                                         frame_out->width, frame_out->height, static_cast<AVPixelFormat>(frame_out->format), SWS_AREA, NULL, NULL, NULL);
+                if (!contexts[i].first) {
+                    throw RunError("can't create conversion context");
+                }
+                sws_scale(contexts[i].first, frame_in->data, frame_in->linesize, 0, frame_in->height, frame_out->data, frame_out->linesize);
+            }
+            if (partial_conversion) {
+                keepPrevious(frame_in, frame_out);
+            }
+            scaleTiers(i, frame_out, tier_frames);
+            conversion_time.record(av_gettime_relative() - start);
+            converted_frames.fetch_add(1, std::memory_order_relaxed);
 
-            av_frame_copy_props(frame_out, frame_in);
-            frame_out->format = contexts[i].second->format;
-            frame_out->width = contexts[i].second->width;
-            frame_out->height = contexts[i].second->height;
-            if (av_frame_get_buffer(frame_out, 0) < 0) {
-                throw RunError("can't allocate buffer");
+            deliver(job.first, frame_out, tier_frames);
+            av_frame_unref(frame_out);
+            for (auto& frame : tier_frames) {
+                av_frame_unref(frame);
             }
+            av_frame_free(&frame_in);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+    }
 
-            /*frame_out->buf[0] = av_buffer_pool_get(buffer_pool);
-            frame_out->linesize[0] = contexts[i].second->linesize[0];
-            frame_out->linesize[1] = contexts[i].second->linesize[1];
-            frame_out->linesize[2] = contexts[i].second->linesize[2];
-            frame_out->data[0] = frame_out->buf[0]->data;
-            frame_out->data[1] = frame_out->data[0] + 2088992;
-            frame_out->data[2] = frame_out->data[1] + 522272;
-            *frame_out->extended_data = frame_out->buf[0]->data;*/
+    av_frame_free(&frame_out);
+    av_frame_free(&frame_in);
+    for (auto& frame : tier_frames) {
+        av_frame_free(&frame);
+    }
+}
 
-            sws_scale(contexts[i].first, frame_in->data, frame_in->linesize, 0, frame_in->height, frame_out->data, frame_out->linesize);
-            forward(frame_out);
+void FrameConverter::runSlices() {
+    std::pair<uint64_t, AVFrame*> job;
+    AVFrame* frame_in = nullptr;
+    AVFrame* frame_out = av_frame_alloc();
+    std::vector<AVFrame*> tier_frames(tiers.size());
+    for (auto& frame : tier_frames) {
+        frame = av_frame_alloc();
+    }
+    try {
+        while (!stop_condition.load(std::memory_order_relaxed)) {
+            if (!queue.wait_dequeue_timed(job, std::chrono::milliseconds(100))) {
+                continue;
+            }
+            frame_in = job.second;
+
+            const int64_t start = av_gettime_relative();
+            const bool native = prepare(frame_in, frame_out, 0);
+            partial_frame = native && canReusePrevious(frame_in, frame_out);
+            if (frame_out->width == frame_in->width && frame_out->height == frame_in->height) {
+                runSliceJob(false, frame_in, frame_out, tier_frames, native);
+            } else {
+                // vertical scaling filters cross band borders, scaled frames are converted whole
+                contexts[0].first = sws_getCachedContext(contexts[0].first, frame_in->width, frame_in->height, static_cast<AVPixelFormat>(frame_in->format),
+                                                         frame_out->width, frame_out->height, static_cast<AVPixelFormat>(frame_out->format), SWS_AREA, NULL, NULL, NULL);
+                if (!contexts[0].first) {
+                    throw RunError("can't create conversion context");
+                }
+                sws_scale(contexts[0].first, frame_in->data, frame_in->linesize, 0, frame_in->height, frame_out->data, frame_out->linesize);
+            }
+            if (partial_conversion) {
+                keepPrevious(frame_in, frame_out);
+            }
+            if (!tiers.empty()) {
+                // tiers are scaled in parallel, each one from the output rather than from the tier above
+                runSliceJob(true, frame_in, frame_out, tier_frames, native);
+            }
+            conversion_time.record(av_gettime_relative() - start);
+            converted_frames.fetch_add(1, std::memory_order_relaxed);
+
+            deliver(job.first, frame_out, tier_frames);
             av_frame_unref(frame_out);
+            for (auto& frame : tier_frames) {
+                av_frame_unref(frame);
+            }
             av_frame_free(&frame_in);
         }
     } catch (const std::exception &e) {
         std::cerr << e.what() << std::endl;
     }
 
+    {
+        std::lock_guard<std::mutex> lock(slice_mutex);
+        slice_exit = true;
+    }
+    slice_cv.notify_all();
+
     av_frame_free(&frame_out);
     av_frame_free(&frame_in);
+    for (auto& frame : tier_frames) {
+        av_frame_free(&frame);
+    }
+}
+
+void FrameConverter::runSliceJob(bool scale, const AVFrame *frame_in, AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames, bool native) {
+    {
+        std::lock_guard<std::mutex> lock(slice_mutex);
+        slice_scale = scale;
+        slice_in = frame_in;
+        slice_out = frame_out;
+        slice_tier_frames = &tier_frames;
+        slice_native = native;
+        slice_failed = false;
+        slice_pending = contexts.size() - 1;
+        ++slice_generation;
+    }
+    slice_cv.notify_all();
+
+    // the other threads use the frames until they are done, wait for them even on failure
+    try {
+        runSlicePart(0, scale, frame_in, frame_out, tier_frames, native);
+    } catch (...) {
+        std::unique_lock<std::mutex> lock(slice_mutex);
+        slice_done_cv.wait(lock, [this] { return slice_pending == 0; });
+        throw;
+    }
+    std::unique_lock<std::mutex> lock(slice_mutex);
+    slice_done_cv.wait(lock, [this] { return slice_pending == 0; });
+    if (slice_failed) {
+        throw RunError("band thread failed");
+    }
+}
+
+void FrameConverter::runSlicePart(size_t i, bool scale, const AVFrame *frame_in, AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames, bool native) {
+    if (!scale) {
+        convertBand(i, frame_in, frame_out, native);
+        return;
+    }
+    // whole tiers, round robin over the threads
+    for (size_t t = i; t < tiers.size(); t += contexts.size()) {
+        scaleTier(t, i, frame_out, frame_out, tier_frames[t]);
+    }
+}
+
+void FrameConverter::runBand(size_t i, uint64_t generation) {
+    std::unique_lock<std::mutex> lock(slice_mutex);
+    while (true) {
+        slice_cv.wait(lock, [this, generation] { return slice_generation != generation || slice_exit; });
+        if (slice_generation == generation) {
+            break;
+        }
+
+        generation = slice_generation;
+        const bool scale = slice_scale;
+        const AVFrame *frame_in = slice_in;
+        AVFrame *frame_out = slice_out;
+        const std::vector<AVFrame*> &tier_frames = *slice_tier_frames;
+        const bool native = slice_native;
+        lock.unlock();
+        bool failed = false;
+        try {
+            runSlicePart(i, scale, frame_in, frame_out, tier_frames, native);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << std::endl;
+            failed = true;
+        }
+        lock.lock();
+
+        slice_failed = slice_failed || failed;
+        if (--slice_pending == 0) {
+            slice_done_cv.notify_one();
+        }
+    }
+}
+
+bool FrameConverter::canReusePrevious(const AVFrame *frame_in, const AVFrame *frame_out) const {
+    return partial_conversion && previous_in->buf[0] && previous_out->buf[0] &&
+           previous_in->format == frame_in->format && previous_in->width == frame_in->width && previous_in->height == frame_in->height &&
+           previous_out->format == frame_out->format && previous_out->width == frame_out->width && previous_out->height == frame_out->height;
+}
+
+void FrameConverter::keepPrevious(const AVFrame *frame_in, const AVFrame *frame_out) {
+    // references only, output buffers are never written once forwarded
+    av_frame_unref(previous_in);
+    av_frame_unref(previous_out);
+    if (av_frame_ref(previous_in, frame_in) < 0 || av_frame_ref(previous_out, frame_out) < 0) {
+        av_frame_unref(previous_in);
+        av_frame_unref(previous_out);
+    }
+}
+
+void FrameConverter::convertPartial(const AVFrame *frame_in, AVFrame *frame_out, int y, int height) {
+    const int width = frame_out->width;
+    uint64_t converted = 0;
+    uint64_t reused = 0;
+    for (int ty = y; ty < y + height; ty += TILE_HEIGHT) {
+        const int th = std::min(TILE_HEIGHT, y + height - ty);
+        // consecutive tiles in the same state are handled as one rectangle
+        int tx = 0;
+        bool dirty = tileChanged(frame_in, tx, ty, std::min(TILE_WIDTH, width), th);
+        while (tx < width) {
+            int end = tx + TILE_WIDTH;
+            bool next = dirty;
+            while (end < width && (next = tileChanged(frame_in, end, ty, std::min(TILE_WIDTH, width - end), th)) == dirty) {
+                end += TILE_WIDTH;
+            }
+            end = std::min(end, width);
+
+            const int tiles = (end - tx + TILE_WIDTH - 1) / TILE_WIDTH;
+            if (dirty) {
+                color_converter.convert(frame_in, frame_out, tx, ty, end - tx, th);
+                converted += tiles;
+            } else {
+                copyPrevious(frame_out, tx, ty, end - tx, th);
+                reused += tiles;
+            }
+            tx = end;
+            dirty = next;
+        }
+    }
+    converted_tiles.fetch_add(converted, std::memory_order_relaxed);
+    reused_tiles.fetch_add(reused, std::memory_order_relaxed);
+}
+
+bool FrameConverter::tileChanged(const AVFrame *frame_in, int x, int y, int width, int height) const {
+    // packed 4 bytes pixels, the only input of the native conversion
+    for (int j = y; j < y + height; ++j) {
+        if (std::memcmp(frame_in->data[0] + j * frame_in->linesize[0] + 4 * x,
+                        previous_in->data[0] + j * previous_in->linesize[0] + 4 * x, 4 * width) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void FrameConverter::copyPrevious(AVFrame *frame_out, int x, int y, int width, int height) const {
+    for (int j = y; j < y + height; ++j) {
+        std::memcpy(frame_out->data[0] + j * frame_out->linesize[0] + x, previous_out->data[0] + j * previous_out->linesize[0] + x, width);
+    }
+
+    // x and y are even, odd sizes only happen on the frame border
+    const bool nv12 = frame_out->format == AV_PIX_FMT_NV12;
+    const int chroma_x = nv12 ? x : x / 2;
+    const int chroma_width = nv12 ? 2 * ((width + 1) / 2) : (width + 1) / 2;
+    for (int j = y / 2; j < (y + height + 1) / 2; ++j) {
+        for (int p = 1; p < (nv12 ? 2 : 3); ++p) {
+            std::memcpy(frame_out->data[p] + j * frame_out->linesize[p] + chroma_x, previous_out->data[p] + j * previous_out->linesize[p] + chroma_x, chroma_width);
+        }
+    }
+}
+
+void FrameConverter::scaleTiers(size_t i, const AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames) {
+    // each tier is scaled from the one above, already converted and smaller than the source
+    const AVFrame *previous = frame_out;
+    for (size_t t = 0; t < tiers.size(); ++t) {
+        scaleTier(t, i, previous, frame_out, tier_frames[t]);
+        previous = tier_frames[t];
+    }
+}
+
+void FrameConverter::scaleTier(size_t t, size_t i, const AVFrame *source, const AVFrame *frame_out, AVFrame *frame) {
+    Tier &tier = *tiers[t];
+    // keep the tier scale when the source geometry changes
+    const int width = static_cast<int>(static_cast<int64_t>(frame_out->width) * tier.width / sink_width) & ~1;
+    const int height = static_cast<int>(static_cast<int64_t>(frame_out->height) * tier.height / sink_height) & ~1;
+
+    av_frame_copy_props(frame, frame_out);
+    frame->format = frame_out->format;
+    frame->width = width;
+    frame->height = height;
+    if (tier.frame_pool.get(frame) < 0) {
+        throw RunError("can't allocate buffer");
+    }
+
+    const auto format = static_cast<AVPixelFormat>(frame_out->format);
+    tier.contexts[i] = sws_getCachedContext(tier.contexts[i], source->width, source->height, format, width, height, format, SWS_AREA, NULL, NULL, NULL);
+    if (!tier.contexts[i]) {
+        throw RunError("can't create conversion context");
+    }
+    sws_scale(tier.contexts[i], source->data, source->linesize, 0, source->height, frame->data, frame->linesize);
+}
+
+void FrameConverter::deliver(uint64_t sequence, AVFrame *frame, const std::vector<AVFrame*> &tier_frames) {
+    std::unique_lock<std::mutex> lock(reorder_mutex);
+    if (sequence < output_sequence) {
+        // a later frame already went out after giving up on this one
+        late_drops.fetch_add(1, std::memory_order_relaxed);
+        if (scheduler) {
+            scheduler->notifyDropped(frame->pts);
+        }
+        return;
+    }
+
+    if (sequence != output_sequence) {
+        reorder_waits.fetch_add(1, std::memory_order_relaxed);
+        if (!reorder_cv.wait_for(lock, MAX_REORDER_WAIT, [this, sequence] { return sequence <= output_sequence; })) {
+            // the missing frames will be dropped when they arrive
+            output_sequence = sequence;
+        } else if (sequence < output_sequence) {
+            late_drops.fetch_add(1, std::memory_order_relaxed);
+            if (scheduler) {
+                scheduler->notifyDropped(frame->pts);
+            }
+            return;
+        }
+    }
+
+    // forwarded under the lock, sinks see the frames in order
+    forward(frame);
+    for (size_t t = 0; t < tiers.size(); ++t) {
+        tiers[t]->forward(tier_frames[t]);
+    }
+    output_sequence = sequence + 1;
+    lock.unlock();
+    reorder_cv.notify_all();
+}
+
+void FrameConverter::convertBand(size_t i, const AVFrame *frame_in, AVFrame *frame_out, bool native) {
+    // even band heights keep 4:2:0 chroma rows inside a single band
+    const int count = static_cast<int>(contexts.size());
+    const int band_height = ((frame_out->height + count - 1) / count + 1) & ~1;
+    const int y = static_cast<int>(i) * band_height;
+    const int height = std::min(band_height, frame_out->height - y);
+    if (height <= 0) {
+        return;
+    }
+
+    if (native) {
+        if (partial_frame) {
+            convertPartial(frame_in, frame_out, y, height);
+        } else {
+            color_converter.convert(frame_in, frame_out, 0, y, frame_out->width, height);
+        }
+        return;
+    }
+
+    // same size conversion, each band is an independent picture for swscale
+    contexts[i].first = sws_getCachedContext(contexts[i].first, frame_in->width, height, static_cast<AVPixelFormat>(frame_in->format),
+                                             frame_out->width, height, static_cast<AVPixelFormat>(frame_out->format), SWS_AREA, NULL, NULL, NULL);
+    if (!contexts[i].first) {
+        throw RunError("can't create conversion context");
+    }
+
+    const AVPixFmtDescriptor *in_desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame_in->format));
+    const AVPixFmtDescriptor *out_desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame_out->format));
+    const uint8_t *src[4] = {};
+    uint8_t *dst[4] = {};
+    for (int p = 0; p < 4; ++p) {
+        if (frame_in->data[p]) {
+            src[p] = frame_in->data[p] + (y >> (p == 1 || p == 2 ? in_desc->log2_chroma_h : 0)) * frame_in->linesize[p];
+        }
+        if (frame_out->data[p]) {
+            dst[p] = frame_out->data[p] + (y >> (p == 1 || p == 2 ? out_desc->log2_chroma_h : 0)) * frame_out->linesize[p];
+        }
+    }
+    sws_scale(contexts[i].first, src, frame_in->linesize, 0, height, dst, frame_out->linesize);
 }
@@ -14,30 +14,114 @@ extern "C" {
 #include <atomic>
 #include <vector>
 #include <condition_variable>
+#include <mutex>
 #include <unordered_map>
+#include <memory>
 
 #include "../concurrentqueue/blockingconcurrentqueue.h"
 
 #include "../Source.h"
 #include "../Sink.h"
+#include "../metrics.h"
+#include "../FramePool.h"
+#include "../CaptureScheduler.h"
+#include "ColorConverter.h"
 
 class FrameConverter : public Sink<AVFrame>, public Source<AVFrame> {
+public:
+    // Frame: each thread converts whole frames, throughput scales with threads
+    // Slice: threads convert horizontal bands of the same frame, latency scales with threads
+    enum class Parallelism {
+        Frame,
+        Slice,
+    };
+
 private:
+    // simulcast output, scaled from the tier above so the colour conversion is done once
+    class Tier : public Source<AVFrame> {
+    public:
+        int width;
+        int height;
+        // one per thread
+        std::vector<SwsContext*> contexts;
+        FramePool frame_pool;
+
+        Tier(const std::string &name, int width, int height);
+        ~Tier() override;
+
+        using Source<AVFrame>::forward;
+    };
+
     std::string name;
     bool initialized = false;
 
     std::atomic<bool> stop_condition = true;
     std::vector<std::thread> threads;
+    // one per thread, in slice mode each one converts its band
     std::vector<std::pair<SwsContext*, AVFrame*>> contexts;
-    //AVBufferPool *buffer_pool = nullptr;
-    moodycamel::BlockingConcurrentQueue<AVFrame*> queue;
+    Parallelism parallelism = Parallelism::Frame;
+    // geometry given to init, output keeps the same scale when the source changes
+    int source_width;
+    int source_height;
+    int sink_width;
+    int sink_height;
+    // same size BGR0 to YUV conversion skips swscale
+    ColorConverter color_converter;
+    bool native_conversion = false;
+    // dirty tiles only: tiles equal to the previous input are copied from the previous output
+    // needs frames converted one after the other, so slice mode or a single thread
+    bool partial_conversion = false;
+    // set by the slice dispatcher for the current frame
+    bool partial_frame = false;
+    AVFrame *previous_in = nullptr;
+    AVFrame *previous_out = nullptr;
+    FramePool frame_pool;
+    // ordered from the highest resolution down
+    std::vector<std::unique_ptr<Tier>> tiers;
+    // frames with their arrival sequence number, output is forwarded in the same order
+    moodycamel::BlockingConcurrentQueue<std::pair<uint64_t, AVFrame*>> queue;
+    uint64_t input_sequence = 0;
+    std::mutex reorder_mutex;
+    std::condition_variable reorder_cv;
+    uint64_t output_sequence = 0;
+
+    // current slice job, published by thread 0 to the band threads
+    std::mutex slice_mutex;
+    std::condition_variable slice_cv;
+    std::condition_variable slice_done_cv;
+    uint64_t slice_generation = 0;
+    size_t slice_pending = 0;
+    // a job either converts the bands of slice_out or scales the tiers from it
+    bool slice_scale = false;
+    const AVFrame *slice_in = nullptr;
+    AVFrame *slice_out = nullptr;
+    const std::vector<AVFrame*> *slice_tier_frames = nullptr;
+    bool slice_native = false;
+    bool slice_failed = false;
+    bool slice_exit = false;
+
+    Histogram &conversion_time;
+    std::atomic<uint64_t> &converted_frames;
+    std::atomic<uint64_t> &reorder_waits;
+    std::atomic<uint64_t> &late_drops;
+    // told about the frames dropped here, for pull mode capture
+    CaptureScheduler *scheduler = nullptr;
+    std::atomic<uint64_t> &converted_tiles;
+    std::atomic<uint64_t> &reused_tiles;
 
 public:
     FrameConverter();
     ~FrameConverter() override;
 
     //void init(const std::unordered_map<std::string, std::string> &params);
-    void init(AVCodecContext *source_ctx, AVCodecContext *sink_ctx, int concurrency=1);
+    void init(AVCodecContext *source_ctx, AVCodecContext *sink_ctx, int concurrency=1, Parallelism parallelism=Parallelism::Frame, bool partial=false);
+
+    // add a lower resolution output after the previous ones, call after init and before start
+    Source<AVFrame>& addTier(int width, int height);
+    // memory of the output and tier frames
+    void setMemoryPolicy(const MemoryPolicy &policy);
+    // tell the scheduler about the frames dropped, set before the first frame
+    void setScheduler(CaptureScheduler *scheduler);
 
     void start();
     void stop();
@@ -46,6 +130,28 @@ public:
 
 private:
     void run(size_t i);
+    void runSlices();
+    // generation is the one of the last job published before the thread started
+    void runBand(size_t i, uint64_t generation);
+    // publish a job to the band threads, do the part of thread 0 and wait for the others
+    void runSliceJob(bool scale, const AVFrame *frame_in, AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames, bool native);
+    void runSlicePart(size_t i, bool scale, const AVFrame *frame_in, AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames, bool native);
+
+    // output geometry for the given input and its buffers, true when the native kernel applies
+    bool prepare(const AVFrame *frame_in, AVFrame *frame_out, size_t i);
+    void convertBand(size_t i, const AVFrame *frame_in, AVFrame *frame_out, bool native);
+    // previous frames have the same geometry, only the changed tiles need a conversion
+    bool canReusePrevious(const AVFrame *frame_in, const AVFrame *frame_out) const;
+    void keepPrevious(const AVFrame *frame_in, const AVFrame *frame_out);
+    void convertPartial(const AVFrame *frame_in, AVFrame *frame_out, int y, int height);
+    bool tileChanged(const AVFrame *frame_in, int x, int y, int width, int height) const;
+    void copyPrevious(AVFrame *frame_out, int x, int y, int width, int height) const;
+    // each tier from the one above, frame mode
+    void scaleTiers(size_t i, const AVFrame *frame_out, const std::vector<AVFrame*> &tier_frames);
+    // tier t from the given source with the context of thread i
+    void scaleTier(size_t t, size_t i, const AVFrame *source, const AVFrame *frame_out, AVFrame *frame);
+    // forward once every earlier frame is out, give up on the missing ones after a bounded wait
+    void deliver(uint64_t sequence, AVFrame *frame, const std::vector<AVFrame*> &tier_frames);
 };
 
 
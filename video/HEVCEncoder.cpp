@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "HEVCEncoder.h"
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+HEVCEncoder::HEVCEncoder(bool use_nvenc, const std::string &name) : VideoEncoder(use_nvenc, name) {
+
+}
+
+AVCodec *HEVCEncoder::findCodec(const std::unordered_map<std::string, std::string> &) {
+    if (use_nvenc) {
+        return avcodec_find_encoder_by_name("hevc_nvenc");
+    }
+    return avcodec_find_encoder_by_name("libx265");
+}
+
+void HEVCEncoder::setDefaults() {
+    if (use_nvenc) {
+        av_opt_set(codec_ctx->priv_data, "preset", "p4", 0);
+        av_opt_set(codec_ctx->priv_data, "tune", "ull", 0);
+        av_opt_set(codec_ctx->priv_data, "zerolatency", "1", 0);
+        av_opt_set(codec_ctx->priv_data, "rc", "cbr", 0);
+    } else {
+        // no b-frames, no frame threads and no lookahead, each frame comes out as soon as it is coded
+        av_opt_set(codec_ctx->priv_data, "preset", "ultrafast", 0);
+        av_opt_set(codec_ctx->priv_data, "tune", "zerolatency", 0);
+    }
+    codec_ctx->max_b_frames = 0;
+}
+
+bool HEVCEncoder::allowsPreset(const std::string &preset) const {
+    // x265 has the x264 preset names, and is slower on each of them
+    static const std::vector<std::string> x265_presets = {"ultrafast", "superfast", "veryfast"};
+    static const std::vector<std::string> nvenc_presets = {"p1", "p2", "p3", "p4", "ll", "llhp", "hp"};
+    const auto &presets = use_nvenc ? nvenc_presets : x265_presets;
+    return std::find(presets.begin(), presets.end(), preset) != presets.end();
+}
+
+bool HEVCEncoder::readsRateLive() const {
+    // libavcodec only passes the bitrate to libx265 at open
+    return use_nvenc;
+}
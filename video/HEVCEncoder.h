@@ -0,0 +1,20 @@
+#ifndef REMOTE_DESKTOP_HEVCENCODER_H
+#define REMOTE_DESKTOP_HEVCENCODER_H
+
+#include "VideoEncoder.h"
+
+// libx265 or hevc_nvenc
+class HEVCEncoder : public VideoEncoder {
+public:
+    explicit HEVCEncoder(bool use_nvenc=false, const std::string &name="hevc encoder");
+    ~HEVCEncoder() override = default;
+
+protected:
+    AVCodec *findCodec(const std::unordered_map<std::string, std::string> &params) override;
+    void setDefaults() override;
+    bool allowsPreset(const std::string &preset) const override;
+    bool readsRateLive() const override;
+};
+
+
+#endif //REMOTE_DESKTOP_HEVCENCODER_H
@@ -0,0 +1,461 @@
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/time.h>
+};
+
+#include "VideoEncoder.h"
+#include "../exception.h"
+#include "../timing.h"
+
+// bitrate moves smaller than this (percent) are not applied, each one restarts part of the rate control
+constexpr int64_t MIN_RATE_CHANGE = 5;
+// decreases answer congestion and are applied at once, increases are spaced by at least this much (us)
+constexpr int64_t MIN_RATE_INCREASE_INTERVAL = 200'000;
+// margin kept under the bitrate asked by the client
+constexpr double RATE_MARGIN = 0.95;
+// codecs reading their rate only at open are reopened for moves larger than this (percent), each reopen sends a key frame
+constexpr int64_t MIN_REOPEN_RATE_CHANGE = 20;
+// changes asked for reopen the codec at most this often (us), the ones coming meanwhile wait and are merged
+constexpr int64_t MIN_RECONFIGURE_INTERVAL = 2'000'000;
+// key frames for joining sessions are this far apart at least (us), the joins meanwhile wait and share the next one
+constexpr int64_t MIN_JOIN_KEY_FRAME_INTERVAL = 300'000;
+// part of the frame interval a frame may come early and still be encoded, absorbs the capture jitter
+constexpr int64_t DECIMATION_TOLERANCE = 4;
+// unit of the region of interest offsets in x264
+constexpr int MB_SIZE = 16;
+
+VideoEncoder::VideoEncoder(bool use_nvenc, const std::string &name) : Encoder(name), use_nvenc(use_nvenc), queue(2),
+        rate_changes(Metrics::counter(this->name + ": rate changes")),
+        refresh_requests(Metrics::counter(this->name + ": key frame requests left to intra refresh")),
+        join_key_frames(Metrics::counter(this->name + ": key frames for joining sessions")),
+        recovered_losses(Metrics::counter(this->name + ": losses recovered by a key frame")),
+        covered_losses(Metrics::counter(this->name + ": losses already covered")),
+        decimated_frames(Metrics::counter(this->name + ": decimated frames")) {
+
+}
+
+void VideoEncoder::init(const std::unordered_map<std::string, std::string> &params) {
+    // re-init check, free old context
+    if (codec_ctx) {
+        avcodec_free_context(&codec_ctx);
+    }
+    this->params = params;
+
+    AVCodec *codec = findCodec(params);
+    if (!codec) {
+        throw InitFail("Codec not found");
+    }
+
+    codec_ctx = avcodec_alloc_context3(codec);
+    if (!codec_ctx) {
+        throw InitFail("Could not allocate video codec context");
+    }
+
+    // low latency defaults of the codec first, so the params can still override them
+    setDefaults();
+
+    // set options
+    AVDictionary *options = nullptr;
+    for (const auto& [key, val] : params) {
+        if (key == "bitrate") {
+            codec_ctx->bit_rate = std::stoi(val);
+        } else if (key == "width") {
+            codec_ctx->width = std::stoi(val);
+        } else if (key == "height") {
+            codec_ctx->height = std::stoi(val);
+        } else if (key == "pixel_format") {
+            codec_ctx->pix_fmt = static_cast<AVPixelFormat>(std::stoi(val));
+        } else if (key == "framerate") {
+            // pts are capture times, on the same clock as RTP
+            codec_ctx->time_base = {1, 90000};
+            codec_ctx->framerate = {std::stoi(val), 1};
+            min_frame_interval = 1'000'000 / std::max(1, std::stoi(val));
+        } else if (key == "gop_size") {
+            codec_ctx->gop_size = std::stoi(val);
+        } else if (key == "vbv_frames") {
+            vbv_frames = std::max(1, std::stoi(val));
+        } else if (key == "intra_refresh") {
+            intra_refresh = val == "1";
+        } else if (key == "roi") {
+            roi = val == "1";
+        } else if (key == "roi_size") {
+            roi_size = std::stoi(val);
+        } else if (key == "roi_qoffset") {
+            roi_qoffset = std::clamp(std::stod(val), -1.0, 1.0);
+        } else {
+            int ret = av_opt_set(codec_ctx->priv_data, key.c_str(), val.c_str(),0);
+            if (ret == AVERROR_OPTION_NOT_FOUND) {
+                std::cout << name << ": option " << key << " not found" << std::endl;
+            } else if (ret == AVERROR(ERANGE) || ret == AVERROR(EINVAL)) {
+                std::cout << name << ": value for " << key << " is not valid" << std::endl;
+            }
+        }
+    }
+
+    // gop_size is then the refresh period, the stream has no more key frame past the first one
+    if (intra_refresh && av_opt_set(codec_ctx->priv_data, "intra-refresh", "1", 0) < 0) {
+        std::cout << name << ": intra refresh is not supported by this encoder, keep key frames" << std::endl;
+        intra_refresh = false;
+    }
+
+    // libx264 only reconfigures the vbv mid-stream when it was enabled at open
+    if (codec_ctx->bit_rate > 0) {
+        setRate(codec_ctx->bit_rate);
+    }
+    last_rate_change = AV_NOPTS_VALUE;
+
+    usePayloadPool();
+    int ret = avcodec_open2(codec_ctx, codec, &options);
+    if (ret < 0) {
+        throw InitFail("Could not open codec");
+    }
+
+    if (roi && use_nvenc) {
+        std::cout << name << ": region of interest is ignored by nvenc" << std::endl;
+    }
+
+    initialized = true;
+    std::cerr << name << ": initialized" << std::endl;
+    av_dict_free(&options);
+}
+
+void VideoEncoder::runFeed() {
+    std::cerr << name << ": feed thread pid is " << gettid() << std::endl;
+    std::cout << gettid() << std::endl;
+    AVFrame* frame = nullptr;
+    try {
+        while (initialized && !feed_stop_condition) {
+            if (!queue.wait_dequeue_timed(frame, std::chrono::milliseconds(100))) {
+                continue;
+            }
+
+            feedImpl(frame);
+            av_frame_free(&frame);
+        }
+    } catch (const std::exception &e) {
+        std::cout << e.what() << std::endl;
+    }
+}
+
+void VideoEncoder::feedImpl(AVFrame *frame) {
+    // source geometry changed, the codec must be reopened with the new size
+    if (frame->width != codec_ctx->width || frame->height != codec_ctx->height) {
+        if (frame->width == refused_width && frame->height == refused_height) {
+            if (scheduler) {
+                scheduler->notifyDropped(frame->pts);
+            }
+            return;
+        }
+        std::cout << name << ": frame size changed to " << frame->width << "x" << frame->height << std::endl;
+        applyChanges({{"width", std::to_string(frame->width)}, {"height", std::to_string(frame->height)}});
+        if (frame->width != codec_ctx->width || frame->height != codec_ctx->height) {
+            std::cout << name << ": frames of " << frame->width << "x" << frame->height << " dropped" << std::endl;
+            refused_width = frame->width;
+            refused_height = frame->height;
+            if (scheduler) {
+                scheduler->notifyDropped(frame->pts);
+            }
+            return;
+        }
+        refused_width = 0;
+        refused_height = 0;
+    } else {
+        applyChanges();
+    }
+
+    // encoder framerate may be below the capture one, requests stay queued for the next frame encoded
+    const int64_t capture_time = frame->pts;
+    if (capture_time != AV_NOPTS_VALUE && last_capture_time != AV_NOPTS_VALUE &&
+        capture_time - last_capture_time < min_frame_interval - min_frame_interval / DECIMATION_TOLERANCE) {
+        decimated_frames.fetch_add(1, std::memory_order_relaxed);
+        if (scheduler) {
+            scheduler->notifyConsumed(capture_time);
+        }
+        return;
+    }
+
+    request_lock.lock();
+    const int64_t target_bitrate = bitrate_requests.empty() ? 0 : *std::min_element(bitrate_requests.begin(), bitrate_requests.end());
+    bitrate_requests.clear();
+    const int64_t loss = lost_pts;
+    lost_pts = AV_NOPTS_VALUE;
+    // every viewer gets the key frame: a burst of joins or tier moves must not turn into a burst of key frames
+    const int64_t now = av_gettime_relative();
+    const bool join = join_request && (last_join_key_frame == AV_NOPTS_VALUE || now - last_join_key_frame >= MIN_JOIN_KEY_FRAME_INTERVAL);
+    if (join) {
+        join_request = false;
+        last_join_key_frame = now;
+    }
+    request_lock.unlock();
+
+    // grabber stamps frames with their capture time (av_gettime, us), so timestamps reflect the real capture timing
+    if (capture_time != AV_NOPTS_VALUE) {
+        if (first_capture_time == AV_NOPTS_VALUE) {
+            first_capture_time = capture_time;
+        }
+        frame->pts = av_rescale_q(capture_time - first_capture_time, AVRational{1, AV_TIME_BASE}, codec_ctx->time_base);
+    } else {
+        frame->pts = last_pts == AV_NOPTS_VALUE ? 0 : last_pts + av_rescale_q(1, av_inv_q(codec_ctx->framerate), codec_ctx->time_base);
+    }
+    // encoder requires strictly increasing pts
+    if (last_pts != AV_NOPTS_VALUE && frame->pts <= last_pts) {
+        frame->pts = last_pts + 1;
+    }
+    // bitrate == -1 means scream want an I frame, the refresh wave already repairs the picture without its burst
+    const bool key_frame_request = target_bitrate == -1;
+    if (key_frame_request && intra_refresh) {
+        refresh_requests.fetch_add(1, std::memory_order_relaxed);
+    }
+    // a loss needs a new key frame only when none was sent after the lost frame, the refresh wave repairs it otherwise
+    // (libavcodec gives no way to invalidate references, so there is no cheaper recovery than these two)
+    bool loss_recovery = false;
+    if (loss != AV_NOPTS_VALUE) {
+        const int64_t key_pts = last_key_pts;
+        loss_recovery = !intra_refresh && (key_pts == AV_NOPTS_VALUE || key_pts <= loss);
+        (loss_recovery ? recovered_losses : covered_losses).fetch_add(1, std::memory_order_relaxed);
+    }
+    // a joining session would wait for a whole refresh period, and libx264 can not restart a wave without a key frame
+    const bool key_frame = join || ((key_frame_request || loss_recovery) && !intra_refresh);
+    if (join) {
+        join_key_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+    frame->pict_type = key_frame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE; // useful if grabber set all to I-frame so encoder does not output only I-frame
+    if (roi) {
+        addRegionOfInterest(frame);
+    }
+
+    // before sending, the packet may be drained right after
+    recordFrameTimes(frame->pts, capture_time);
+    encoder_lock.lock();
+    if (target_bitrate > 0) {
+        updateRate(target_bitrate);
+    }
+    const int64_t codec_start = av_gettime();
+    const int64_t codec_cpu_start = threadCpuMicroseconds();
+    int ret = avcodec_send_frame(codec_ctx, frame);
+    recordCodecTime(frame->pts, codec_start, codec_cpu_start);
+    encoder_lock.unlock();
+    notifyDrain();
+    if (ret >= 0) {
+        if (capture_time != AV_NOPTS_VALUE) {
+            capture_to_submit.record(av_gettime() - capture_time);
+        }
+        if (scheduler) {
+            scheduler->notifyConsumed(capture_time);
+        }
+        last_pts = frame->pts;
+        last_capture_time = capture_time;
+        ++frame_id;
+        // losses reported until the key frame comes out of the encoder are covered by it
+        if (key_frame) {
+            last_key_pts = frame->pts;
+        }
+    } else if (ret == AVERROR(EAGAIN)) {
+        std::cout << name << ": encoder buffer may be full, drop frame" << std::endl;
+        if (scheduler) {
+            scheduler->notifyDropped(capture_time);
+        }
+    } else if (ret < 0) {
+        throw RunError("error when sending frame to encoder");
+    }
+}
+
+void VideoEncoder::applyChanges(EncoderChanges changes) {
+    const int64_t now = av_gettime();
+    const bool forced = !changes.empty();
+    request_lock.lock();
+    if (!forced && (pending_changes.empty() || (last_reconfigure != AV_NOPTS_VALUE && now - last_reconfigure < MIN_RECONFIGURE_INTERVAL))) {
+        request_lock.unlock();
+        return;
+    }
+    // the pending ones go along, they would reopen the codec again right after
+    for (auto& [key, val] : pending_changes) {
+        changes.emplace(key, std::move(val));
+    }
+    pending_changes.clear();
+    request_lock.unlock();
+
+    auto preset = changes.find("preset");
+    if (preset != changes.end() && !allowsPreset(preset->second)) {
+        std::cout << name << ": preset " << preset->second << " refused" << std::endl;
+        changes.erase(preset);
+    }
+    for (auto it = changes.begin(); it != changes.end();) {
+        auto param = params.find(it->first);
+        it = param != params.end() && param->second == it->second ? changes.erase(it) : std::next(it);
+    }
+    if (changes.empty()) {
+        return;
+    }
+
+    // the reopened codec keeps the bitrate the clients asked for, not the nominal one, unless it is the change
+    const bool rate_change = changes.count("bitrate") > 0;
+    if (!rate_change && codec_ctx->bit_rate > 0) {
+        changes["bitrate"] = std::to_string(codec_ctx->bit_rate);
+    }
+    std::cout << name << ": reconfigure on " << (forced ? "geometry change" : rate_change ? "bitrate request" : "client request") << std::endl;
+    last_capture_time = AV_NOPTS_VALUE;
+    last_reconfigure = now;
+    const bool applied = reconfigure(changes);
+    if (applied && rate_change) {
+        rate_monitor.step(codec_ctx->bit_rate, av_gettime());
+        rate_changes.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void VideoEncoder::setRate(int64_t bitrate) {
+    // read at each frame by the codecs reading their rate live, only at open by the others
+    codec_ctx->bit_rate = bitrate;
+    codec_ctx->rc_max_rate = bitrate;
+    // vbv_frames frames at the nominal framerate, a frame is one second when it is unknown
+    const double frame_duration = codec_ctx->framerate.num > 0 ? av_q2d(av_inv_q(codec_ctx->framerate)) : 1.0;
+    codec_ctx->rc_buffer_size = static_cast<int>(std::min<double>(INT_MAX, bitrate * vbv_frames * frame_duration));
+}
+
+void VideoEncoder::updateRate(int64_t target_bitrate) {
+    const int64_t bitrate = RATE_MARGIN * target_bitrate;
+    if (std::abs(bitrate - codec_ctx->bit_rate) * 100 < codec_ctx->bit_rate * MIN_RATE_CHANGE) {
+        return;
+    }
+
+    const int64_t now = av_gettime();
+    if (bitrate > codec_ctx->bit_rate && last_rate_change != AV_NOPTS_VALUE && now - last_rate_change < MIN_RATE_INCREASE_INTERVAL) {
+        return;
+    }
+
+    if (!readsRateLive()) {
+        // reopened with the other changes before the next frame, only for large moves
+        if (std::abs(bitrate - codec_ctx->bit_rate) * 100 >= codec_ctx->bit_rate * MIN_REOPEN_RATE_CHANGE) {
+            request_lock.lock();
+            pending_changes["bitrate"] = std::to_string(bitrate);
+            request_lock.unlock();
+            last_rate_change = now;
+        }
+        return;
+    }
+
+    setRate(bitrate);
+    last_rate_change = now;
+    rate_monitor.step(bitrate, now);
+    rate_changes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VideoEncoder::addRegionOfInterest(AVFrame *frame) {
+    cursor_lock.lock();
+    const int x = cursor_x;
+    const int y = cursor_y;
+    const int region_width = cursor_region_width;
+    const int region_height = cursor_region_height;
+    const bool visible = cursor_visible;
+    cursor_lock.unlock();
+    if (!visible || region_width <= 0 || region_height <= 0) {
+        return;
+    }
+
+    // the frame may be a scaled tier of the captured region, the box covers the same content on each of them
+    const int width = std::min(frame->width, roi_size * frame->width / region_width);
+    const int height = std::min(frame->height, roi_size * frame->height / region_height);
+    const int center_x = static_cast<int>(static_cast<int64_t>(x) * frame->width / region_width);
+    const int center_y = static_cast<int>(static_cast<int64_t>(y) * frame->height / region_height);
+    // moved rather than cropped at the edges, so the area and the bit budget stay the same
+    const int left = std::clamp(center_x - width / 2, 0, frame->width - width);
+    const int top = std::clamp(center_y - height / 2, 0, frame->height - height);
+
+    // x264 applies the offsets to whole macroblocks, the balance is computed on the ones the box touches
+    const int64_t area = static_cast<int64_t>((left + width + MB_SIZE - 1) / MB_SIZE - left / MB_SIZE) *
+                         ((top + height + MB_SIZE - 1) / MB_SIZE - top / MB_SIZE);
+    const int64_t frame_area = static_cast<int64_t>((frame->width + MB_SIZE - 1) / MB_SIZE) * ((frame->height + MB_SIZE - 1) / MB_SIZE);
+    if (area >= frame_area) {
+        // an offset on the whole frame is only another bitrate, the rate control would undo it
+        return;
+    }
+
+    // the rest of the frame gets the opposite offset weighted by area, so the mean quantizer stays the same,
+    // when the box covers most of the frame the background can not go far enough and the box offset is lowered
+    double qoffset = roi_qoffset;
+    double background_qoffset = -qoffset * area / (frame_area - area);
+    if (std::abs(background_qoffset) > 1.0) {
+        background_qoffset = std::copysign(1.0, background_qoffset);
+        qoffset = -background_qoffset * (frame_area - area) / area;
+    }
+
+    AVFrameSideData *side_data = av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, 2 * sizeof(AVRegionOfInterest));
+    if (!side_data) {
+        return;
+    }
+
+    // earlier regions take precedence where they overlap
+    auto *regions = reinterpret_cast<AVRegionOfInterest*>(side_data->data);
+    regions[0].self_size = sizeof(AVRegionOfInterest);
+    regions[0].top = top;
+    regions[0].bottom = top + height;
+    regions[0].left = left;
+    regions[0].right = left + width;
+    regions[0].qoffset = av_d2q(qoffset, 100);
+    regions[1].self_size = sizeof(AVRegionOfInterest);
+    regions[1].top = 0;
+    regions[1].bottom = frame->height;
+    regions[1].left = 0;
+    regions[1].right = frame->width;
+    regions[1].qoffset = av_d2q(background_qoffset, 100);
+}
+
+void VideoEncoder::handle(AVFrame *frame) {
+    if (feed_thread.joinable()) {
+        if (!queue.try_enqueue(frame)) {
+            std::cout << name << ": queue is full" << std::endl;
+            if (scheduler) {
+                scheduler->notifyDropped(frame->pts);
+            }
+            av_frame_free(&frame);
+        }
+    // possible to run without feed thread so source will try to handle the job
+    } else if (initialized) {
+        feedImpl(frame);
+        av_frame_free(&frame);
+    }
+}
+
+void VideoEncoder::handle(const int64_t *bitrate_request) {
+    request_lock.lock();
+    bitrate_requests.push_back(*bitrate_request);
+    request_lock.unlock();
+}
+
+void VideoEncoder::requestJoinKeyFrame() {
+    request_lock.lock();
+    join_request = true;
+    request_lock.unlock();
+}
+
+void VideoEncoder::handle(const CursorPosition *position) {
+    cursor_lock.lock();
+    cursor_x = position->x;
+    cursor_y = position->y;
+    cursor_region_width = position->region_width;
+    cursor_region_height = position->region_height;
+    cursor_visible = position->visible;
+    cursor_lock.unlock();
+}
+
+void VideoEncoder::handle(const FrameLoss *loss) {
+    request_lock.lock();
+    lost_pts = lost_pts == AV_NOPTS_VALUE ? loss->pts : std::min(lost_pts, loss->pts);
+    request_lock.unlock();
+}
+
+void VideoEncoder::handle(const EncoderChanges *changes) {
+    request_lock.lock();
+    for (const auto& [key, val] : *changes) {
+        pending_changes[key] = val;
+    }
+    request_lock.unlock();
+}
@@ -0,0 +1,115 @@
+#ifndef REMOTE_DESKTOP_VIDEOENCODER_H
+#define REMOTE_DESKTOP_VIDEOENCODER_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+#include <libavdevice/avdevice.h>
+#include <libswscale/swscale.h>
+};
+
+#include <vector>
+
+#include "../readerwriterqueue/readerwritercircularbuffer.h"
+
+#include "../Encoder.h"
+#include "../Sink.h"
+#include "../spinlock.h"
+#include "CursorTracker.h"
+
+// frame feeding, live rate control, client requests and region of interest shared by the video codecs,
+// each codec gives its encoder, low latency defaults and what it can change while running
+class VideoEncoder : public Encoder, public Sink<const int64_t>, public Sink<const FrameLoss>, public Sink<const EncoderChanges>,
+                    public Sink<const CursorPosition> {
+protected:
+    bool use_nvenc;
+
+private:
+    int64_t first_capture_time = AV_NOPTS_VALUE;
+    int64_t last_pts = AV_NOPTS_VALUE;
+
+    moodycamel::BlockingReaderWriterCircularBuffer<AVFrame*> queue;
+    std::vector<int64_t> bitrate_requests;
+    spinlock request_lock;
+    // vbv buffer in frames at the current bitrate, set at open so the rate control can be reconfigured later
+    int vbv_frames = 1;
+    int64_t last_rate_change = AV_NOPTS_VALUE;
+    std::atomic<uint64_t> &rate_changes;
+
+    // a column of intra macroblocks sweeps the picture over gop_size frames instead of periodic key frames,
+    // it also stands for the key frames asked by the clients, which already decode the stream
+    bool intra_refresh = false;
+    std::atomic<uint64_t> &refresh_requests;
+    // a session joins the stream and has nothing to refresh, it gets a key frame even with intra refresh
+    bool join_request = false;
+    int64_t last_join_key_frame = AV_NOPTS_VALUE;
+    std::atomic<uint64_t> &join_key_frames;
+
+    // asked by the clients, applied by the feeding thread before the next frame
+    EncoderChanges pending_changes;
+    int64_t last_reconfigure = AV_NOPTS_VALUE;
+    // source geometry the codec refused, its frames are dropped instead of reopening the codec for each of them
+    int refused_width = 0;
+    int refused_height = 0;
+
+    // frames come at the capture rate, the ones closer than this (us) to the last encoded one are dropped
+    int64_t min_frame_interval = 0;
+    int64_t last_capture_time = AV_NOPTS_VALUE;
+    std::atomic<uint64_t> &decimated_frames;
+
+    // oldest frame lost by a client since the last frame fed, AV_NOPTS_VALUE if none
+    int64_t lost_pts = AV_NOPTS_VALUE;
+    std::atomic<uint64_t> &recovered_losses;
+    std::atomic<uint64_t> &covered_losses;
+
+    // region of interest centered on the cursor, where the user is looking
+    // only libx264 reads it, and only with adaptive quantization enabled
+    bool roi = false;
+    int roi_size = 384;
+    double roi_qoffset = -0.2;
+    spinlock cursor_lock;
+    int cursor_x = 0;
+    int cursor_y = 0;
+    int cursor_region_width = 0;
+    int cursor_region_height = 0;
+    bool cursor_visible = false;
+
+public:
+    VideoEncoder(bool use_nvenc, const std::string &name);
+    ~VideoEncoder() override = default;
+
+    void init(const std::unordered_map<std::string, std::string> &params) override;
+
+    void handle(AVFrame *frame) override;
+    void handle(const int64_t *bitrate_request) override;
+    void handle(const FrameLoss *loss) override;
+    void handle(const EncoderChanges *changes) override;
+    void handle(const CursorPosition *position) override;
+
+    // a key frame whatever the refresh mode, for a session attached or moved to this encoder: the next frame
+    // encoded, or the first one once the previous join key frame is far enough
+    void requestJoinKeyFrame();
+
+protected:
+    virtual AVCodec *findCodec(const std::unordered_map<std::string, std::string> &params) = 0;
+    // low latency options of the codec, set before the params which may override them
+    virtual void setDefaults() = 0;
+    // presets the clients may ask for, the ones fast enough for real time at the capture resolution
+    virtual bool allowsPreset(const std::string &preset) const = 0;
+    // whether the codec reads a new bitrate between frames, it is reopened for large changes otherwise
+    virtual bool readsRateLive() const = 0;
+
+private:
+    void runFeed() override;
+    void feedImpl(AVFrame *frame);
+    // reopens the codec with the pending changes once the interval since the last reopen is over,
+    // at once with the given ones, which must be applied before the next frame (geometry)
+    void applyChanges(EncoderChanges changes = {});
+    void setRate(int64_t bitrate);
+    void updateRate(int64_t target_bitrate);
+    void addRegionOfInterest(AVFrame *frame);
+};
+
+
+#endif //REMOTE_DESKTOP_VIDEOENCODER_H
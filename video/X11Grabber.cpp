@@ -1,13 +1,26 @@
 #include <iostream>
+#include <algorithm>
 #include <X11/Xlib.h>
 
 #include "X11Grabber.h"
 #include "../exception.h"
 
+// screen size is polled, a resolution switch is seen within this delay
+constexpr auto SCREEN_CHECK_DELAY = std::chrono::milliseconds(250);
+
 X11Grabber::X11Grabber() : Grabber("x11 grabber") {
 
 }
 
+X11Grabber::~X11Grabber() {
+    // grab thread uses the display, stop it first
+    stop();
+    if (display) {
+        XCloseDisplay(display);
+        display = nullptr;
+    }
+}
+
 void X11Grabber::init(std::unordered_map<std::string, std::string> &params) {
     // re-init check, free old context
     if (codec_ctx) {
@@ -15,28 +28,92 @@ void X11Grabber::init(std::unordered_map<std::string, std::string> &params) {
     }
 
     if (format_ctx) {
-        avformat_free_context(format_ctx);
-        format_ctx = nullptr;
+        avformat_close_input(&format_ctx);
+    }
+
+    if (&params != &this->params) {
+        this->params = params;
     }
 
+    if (!display) {
+        display = XOpenDisplay(nullptr);
+        if (!display) {
+            throw InitFail("unable to open X display");
+        }
+    }
+    updateScreenSize();
+
     // set options
     AVDictionary *options = nullptr;
+    bool fast_start = false;
+    int width = screen_width;
+    int height = screen_height;
+    int framerate = 30;
+    FramePacer::LatePolicy late_policy = FramePacer::LatePolicy::Skip;
+    // "pacer" captures on the grid of the frame pacer, "external" when the capture scheduler is set (pull mode),
+    // "device" leaves it to the x11grab timer
+    std::string pacing = "pacer";
     for (const auto& [key, val] : params) {
-        av_dict_set(&options, key.c_str(), val.c_str(),0);
+        if (key == "fast_start") {
+            fast_start = val == "1";
+        } else if (key == "pacing") {
+            if (val != "pacer" && val != "external" && val != "device") {
+                throw InitFail("pacing is not valid");
+            }
+            pacing = val;
+        } else if (key == "framerate") {
+            framerate = std::stoi(val);
+        } else if (key == "late_policy") {
+            late_policy = val == "catch_up" ? FramePacer::LatePolicy::CatchUp : FramePacer::LatePolicy::Skip;
+        } else if (key == "video_size") {
+            if (std::sscanf(val.c_str(), "%dx%d", &width, &height) != 2) {
+                throw InitFail("video_size is not valid");
+            }
+        } else {
+            av_dict_set(&options, key.c_str(), val.c_str(),0);
+        }
     }
 
+    // x11grab sleeps with relative delays that drift, and only when ahead of its own timer,
+    // when the pacer or the scheduler drives capture, a high rate keeps it behind so it captures as soon as asked
+    if (pacing == "device") {
+        av_dict_set(&options, "framerate", std::to_string(framerate).c_str(), 0);
+        pacer.reset();
+    } else {
+        av_dict_set(&options, "framerate", "1000", 0);
+        if (pacing == "pacer") {
+            pacer = std::make_unique<FramePacer>(name, framerate, late_policy);
+        } else {
+            pacer.reset();
+        }
+    }
+    // region can not be larger than the screen
+    const std::string video_size = std::to_string(std::min(width, screen_width)) + "x" + std::to_string(std::min(height, screen_height));
+    av_dict_set(&options, "video_size", video_size.c_str(), 0);
+
     format_ctx = avformat_alloc_context();
+    if (fast_start) {
+        // nothing to detect, the demuxer header already describes the stream
+        format_ctx->probesize = 32;
+        format_ctx->max_analyze_duration = 0;
+    }
     AVInputFormat *ifmt = av_find_input_format("x11grab");
     // build display string according to environment variable DISPLAY
-    char* env_display = std::getenv("DISPLAY");
-    char* av_filename = strcat(env_display,".0+0,0");
+    // copy it, the environment is read by other X clients (cursor tracker) concurrently
+    const char* env_display = std::getenv("DISPLAY");
+    if (!env_display) {
+        throw InitFail("DISPLAY is not set");
+    }
+    const std::string av_filename = std::string(env_display) + ".0+0,0";
     
     // offset due to screens of different sizes
-    if(avformat_open_input(&format_ctx, av_filename, ifmt, &options) != 0) {
+    if(avformat_open_input(&format_ctx, av_filename.c_str(), ifmt, &options) != 0) {
         throw InitFail("Couldn't open input stream");
     }
 
-    if(avformat_find_stream_info(format_ctx,NULL) < 0) {
+    // read_header of x11grab (size, pixel format, framerate) fills the stream parameters from the device configuration,
+    // probing only reads and decodes frames for nothing
+    if(!fast_start && avformat_find_stream_info(format_ctx,NULL) < 0) {
         throw InitFail("Couldn't find stream information");
     }
 
@@ -55,6 +132,7 @@ void X11Grabber::init(std::unordered_map<std::string, std::string> &params) {
         throw InitFail("Could not allocate video codec context");
     }
 
+    // no get_buffer2: rawvideo frames reference the packet, x11grab already takes it from its own pool of shm segments
     if(avcodec_open2(codec_ctx, codec, NULL) < 0) {
         throw InitFail("Could not open codec");
     }
@@ -63,3 +141,43 @@ void X11Grabber::init(std::unordered_map<std::string, std::string> &params) {
     std::cerr << name << ": initialized" << std::endl;
     av_dict_free(&options);
 }
+
+bool X11Grabber::checkSource() {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < next_check) {
+        return !reopen_failed;
+    }
+    next_check = now + SCREEN_CHECK_DELAY;
+
+    const int old_width = screen_width;
+    const int old_height = screen_height;
+    updateScreenSize();
+    if (!reopen_failed && screen_width == old_width && screen_height == old_height) {
+        return true;
+    }
+
+    std::cout << name << ": screen size changed to " << screen_width << "x" << screen_height << ", reopen device" << std::endl;
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        init(params);
+    } catch (const std::exception &e) {
+        // the mode switch may not be over yet, capture stays stopped until a reopen succeeds
+        std::cerr << name << ": fail to reopen device (" << e.what() << "), retry in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(SCREEN_CHECK_DELAY).count() << "ms" << std::endl;
+        reopen_failed = true;
+        return false;
+    }
+    reopen_failed = false;
+    std::cout << name << ": reopened in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms" << std::endl;
+    return true;
+}
+
+void X11Grabber::updateScreenSize() {
+    Window root;
+    int x, y;
+    unsigned int width, height, border, depth;
+    if (XGetGeometry(display, DefaultRootWindow(display), &root, &x, &y, &width, &height, &border, &depth)) {
+        screen_width = static_cast<int>(width);
+        screen_height = static_cast<int>(height);
+    }
+}
@@ -4,15 +4,33 @@
 #include <atomic>
 #include <thread>
 #include <vector>
+#include <chrono>
 #include "../Grabber.h"
 #include "../Source.h"
 
 class X11Grabber : public Grabber {
+private:
+    std::unordered_map<std::string, std::string> params;
+
+    // own connection to watch the screen size, Xlib type kept opaque
+    struct _XDisplay *display = nullptr;
+    int screen_width = 0;
+    int screen_height = 0;
+    std::chrono::steady_clock::time_point next_check;
+    // the last reopen failed, retried at each check until it succeeds
+    bool reopen_failed = false;
+
 public:
     explicit X11Grabber();
-    ~X11Grabber() override = default;
+    ~X11Grabber() override;
 
     void init(std::unordered_map<std::string, std::string> &params) override;
+
+protected:
+    bool checkSource() override;
+
+private:
+    void updateScreenSize();
 };
 
 